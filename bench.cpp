@@ -0,0 +1,269 @@
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <cstdint>
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <new>
+#include <string>
+#include <vector>
+
+// before schedule.h, so that it is compiled as C++
+#include "main/command.h"
+extern "C" {
+#include "main/util.h"
+#include "main/schedule.h"
+}
+#include "main/tz.h"
+
+/* Micro-benchmarks of the pure functions shared by the firmware and the
+ * client. Prints JSON on stdout, one entry per function:
+ *   ns_per_op       median of the rounds
+ *   min_ns_per_op   fastest round
+ *   allocs_per_op   operator new calls per call of the function
+ * so that two runs (e.g. two commits, see --label) can be compared.
+ *
+ * gcc -O2 -c main/util.c main/schedule.c main/tz.c
+ * g++ -std=c++17 -O2 -o bench bench.cpp util.o schedule.o tz.o
+ */
+
+#define ROUNDS 5
+
+static uint64_t s_allocs = 0;
+
+void* operator new(size_t size) {
+    s_allocs++;
+    void* p = malloc(size == 0 ? 1 : size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    free(p);
+}
+
+// keeps the compiler from dropping a result nobody reads
+template <typename T>
+inline void keep(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct Result {
+    std::string name;
+    uint64_t iterations;
+    double ns_per_op;
+    double min_ns_per_op;
+    double allocs_per_op;
+};
+
+struct Options {
+    long min_ms = 500;
+    std::string label;
+    std::string filter;
+};
+
+template <typename F>
+static double run_batch(F& op, uint64_t iterations) {
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < iterations; i++) {
+        op(i);
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+/* Doubles the iterations until a round lasts min_ms / ROUNDS, then
+ * times ROUNDS rounds of that many iterations.
+ */
+template <typename F>
+static void measure(const Options& opt, std::vector<Result>& results, const char* name, F op) {
+    if (!opt.filter.empty() && strstr(name, opt.filter.c_str()) == nullptr) {
+        return;
+    }
+    const double round_ns = opt.min_ms * 1e6 / ROUNDS;
+    uint64_t iterations = 1;
+    while (run_batch(op, iterations) < round_ns && iterations < (1ull << 40)) {
+        iterations *= 2;
+    }
+
+    double ns[ROUNDS];
+    uint64_t allocs = s_allocs;
+    for (int i = 0; i < ROUNDS; i++) {
+        ns[i] = run_batch(op, iterations) / iterations;
+    }
+    allocs = s_allocs - allocs;
+    std::sort(ns, ns + ROUNDS);
+    results.push_back({name, iterations, ns[ROUNDS / 2], ns[0], (double)allocs / (iterations * ROUNDS)});
+}
+
+static std::string json_string(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        if (static_cast<unsigned char>(c) >= 0x20) {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+static void print_json(const Options& opt, const std::vector<Result>& results) {
+    std::cout << "{" << std::endl;
+    std::cout << "  \"label\": " << json_string(opt.label) << "," << std::endl;
+    std::cout << "  \"compiler\": " << json_string(__VERSION__) << "," << std::endl;
+    std::cout << "  \"benchmarks\": [" << std::endl;
+    for (size_t i = 0; i < results.size(); i++) {
+        const Result& r = results[i];
+        std::cout << "    {\"name\": " << json_string(r.name)
+                  << ", \"iterations\": " << r.iterations
+                  << ", \"ns_per_op\": " << r.ns_per_op
+                  << ", \"min_ns_per_op\": " << r.min_ns_per_op
+                  << ", \"allocs_per_op\": " << r.allocs_per_op
+                  << "}" << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+    std::cout << "  ]" << std::endl;
+    std::cout << "}" << std::endl;
+}
+
+// mon-fri=07:00-12:00,14:00-19:00;sat=09:00-12:00
+static void weekly_spec(schedule_spec_t* spec) {
+    memset(spec, 0, sizeof(*spec));
+    spec->count = 3;
+    spec->window[0] = {0x3e, 7, 0, 12, 0};
+    spec->window[1] = {0x3e, 14, 0, 19, 0};
+    spec->window[2] = {0x40, 9, 0, 12, 0};
+}
+
+void usage(const char* prog) {
+    std::cout << "Usage: " << prog << " [--min-ms MS] [--label TEXT] [FILTER]" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  --min-ms MS     Time spent on each function (default 500)" << std::endl;
+    std::cout << "  --label TEXT    Copied to the output, e.g. $(git rev-parse --short HEAD)" << std::endl;
+    std::cout << "  FILTER          Only the functions whose name contains FILTER" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    Options opt;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--min-ms") == 0 && i + 1 < argc) {
+            opt.min_ms = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--label") == 0 && i + 1 < argc) {
+            opt.label = argv[++i];
+        } else if (argv[i][0] != '-' && opt.filter.empty()) {
+            opt.filter = argv[i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (opt.min_ms <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::vector<Result> results;
+
+    // command codec (main/command.h)
+    const struct Period period = {7, 30, 22, 15};
+    uint8_t value[COMMAND_MAX_SIZE];
+    measure(opt, results, "command_encode_period", [&](uint64_t) {
+        keep(command_encode_period(&period, value));
+        keep(value);
+    });
+    uint8_t period_bytes[COMMAND_PERIOD_SIZE] = {7, 30, 22, 0};
+    measure(opt, results, "command_decode_period", [&](uint64_t) {
+        struct Period decoded;
+        keep(command_decode_period(period_bytes, sizeof(period_bytes), &decoded));
+        keep(decoded);
+    });
+    const std::string ssid = "myssid", pass = "mypassword";
+    measure(opt, results, "command_encode_wifi", [&](uint64_t) {
+        keep(command_encode_wifi(ssid.c_str(), pass.c_str(), value));
+        keep(value);
+    });
+    uint8_t wifi_bytes[COMMAND_WIFI_SIZE];
+    command_encode_wifi(ssid.c_str(), pass.c_str(), wifi_bytes);
+    measure(opt, results, "command_decode_wifi", [&](uint64_t) {
+        command_wifi_t wifi;
+        keep(command_decode_wifi(wifi_bytes, sizeof(wifi_bytes), &wifi));
+        keep(wifi);
+    });
+
+    // firmware: checks of the UDP messages
+    const char* url = "http://palantir/thermo/update-sensor.php";
+    measure(opt, results, "is_valid_url", [&](uint64_t) {
+        keep(url);
+        keep(is_valid_url(url));
+    });
+
+    // firmware: relay schedule, which replaced is_time_in()
+    schedule_spec_t spec;
+    weekly_spec(&spec);
+    static schedule_t sched;
+    measure(opt, results, "schedule_build", [&](uint64_t) {
+        schedule_build(&sched, &spec);
+        keep(sched);
+    });
+    schedule_build(&sched, &spec);
+    measure(opt, results, "schedule_is_on", [&](uint64_t i) {
+        keep(schedule_is_on(&sched, (int)(i % SCHEDULE_MINUTES)));
+    });
+    measure(opt, results, "schedule_next_transition", [&](uint64_t i) {
+        keep(schedule_next_transition(&sched, (int)(i % SCHEDULE_MINUTES)));
+    });
+
+    uint8_t schedule_bytes[COMMAND_SCHEDULE_SIZE(COMMAND_MAX_WINDOWS)];
+    size_t schedule_len = command_encode_schedule(&spec, schedule_bytes);
+    measure(opt, results, "command_decode_schedule", [&](uint64_t) {
+        schedule_spec_t decoded;
+        keep(command_decode_schedule(schedule_bytes, schedule_len, &decoded));
+        keep(decoded);
+    });
+
+    // firmware: local time of the schedule, which replaced localtime()
+    const char* tz = "CET-1CEST,M3.5.0,M10.5.0/3";
+    measure(opt, results, "tz_parse", [&](uint64_t) {
+        tz_rule_t rule;
+        keep(tz);
+        keep(tz_parse(tz, &rule));
+        keep(rule);
+    });
+    tz_rule_t rule;
+    tz_parse(tz, &rule);
+    tz_year_t year = {};
+    // a minute apart, over the years
+    const int64_t start = 1700000000;
+    measure(opt, results, "tz_offset", [&](uint64_t i) {
+        keep(tz_offset(&rule, &year, start + (int64_t)(i % 10000000) * 60));
+    });
+    setenv("TZ", tz, 1);
+    tzset();
+    measure(opt, results, "localtime_r", [&](uint64_t i) {
+        time_t t = start + (time_t)(i % 10000000) * 60;
+        struct tm tm;
+        keep(localtime_r(&t, &tm)->tm_min);
+    });
+
+    print_json(opt, results);
+    return 0;
+}
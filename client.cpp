@@ -1,43 +1,149 @@
 #include <iostream>
 #include <cstring>
 #include <cstdarg>
+#include <cctype>
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <stdexcept>
 #include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <chrono>
+#include <unordered_map>
+#include <fcntl.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <map>
+#include <random>
+#include <cmath>
+
+#include "main/control.h"
+#include "main/command.h"
+
+// the codec also runs at compile time
+static_assert([] {
+    uint8_t value[COMMAND_WIFI_SIZE] {};
+    return command_encode_wifi("ssid", "pass", value) == COMMAND_WIFI_SIZE && value[3] == 'd' && value[32] == 'p';
+}());
 
 #define ADDRESS "192.168.1.38"
 #define PORT 3333
 
-// TODO bug si on essaie de mettre 0 comme heure de début
 int DEBUG = 0;
 
-enum MSG_FLAG {
-    PERIOD_FLAG,
-    ADRESS_FLAG,
-    SSID_FLAG
-};
+/* hh:mm into hours and minutes, false if out of range */
+bool parse_hhmm(const std::string& s, int& hour, int& minute) {
+    char end;
+    if (sscanf(s.c_str(), "%d:%d%c", &hour, &minute, &end) != 2) {
+        return false;
+    }
+    return hour >= 0 && hour <= 23 && minute >= 0 && minute <= 59;
+}
 
-std::string format(std::string ssid, std::string pass) {
-    // Validate input lengths
-    if (ssid.length() > 32) {
-        throw std::invalid_argument("SSID must be 32 characters or less");
+/* Days as a bit mask, bit 0 being Sunday: "all", or a comma separated
+ * list of days and ranges of days such as "mon-fri,sun".
+ */
+bool parse_days(const std::string& s, int& mask) {
+    static const char* names[7] = {"sun", "mon", "tue", "wed", "thu", "fri", "sat"};
+    auto day = [](const std::string& name) {
+        for (int i = 0; i < 7; i++) {
+            if (name == names[i]) {
+                return i;
+            }
+        }
+        return -1;
+    };
+    if (s == "all") {
+        mask = 0x7f;
+        return true;
     }
-    if (pass.length() > 64) {
-        throw std::invalid_argument("Password must be 64 characters or less");
+    mask = 0;
+    std::istringstream items(s);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        size_t dash = item.find('-');
+        int from = day(item.substr(0, dash));
+        int to = dash == std::string::npos ? from : day(item.substr(dash + 1));
+        if (from == -1 || to == -1) {
+            return false;
+        }
+        // mon-fri, but also fri-mon through the week end
+        for (int d = from; ; d = (d + 1) % 7) {
+            mask |= 1 << d;
+            if (d == to) {
+                break;
+            }
+        }
     }
+    return mask != 0;
+}
 
-    // Create a 96-character string (to be exactly 96 chars + null terminator when converted)
-    std::string formatted(96, '\0');
-
-    // Copy SSID to the first 32 characters, padding with null bytes if shorter
-    std::copy(ssid.begin(), ssid.end(), formatted.begin());
-
-    // Copy password starting at index 32, padding with null bytes if shorter
-    std::copy(pass.begin(), pass.end(), formatted.begin() + 32);
+/* Weekly schedule: entries separated by ';', each made of days, '=' and a comma
+ * separated list of hh:mm-hh:mm windows, e.g.
+ *   mon-fri=07:00-12:00,14:00-19:00;sat=09:00-12:00
+ * Appended to out as encoded by command_encode_schedule().
+ */
+bool format_schedule(const std::string& spec, std::string& out) {
+    command_schedule_t sched {};
+    std::istringstream entries(spec);
+    std::string entry;
+    while (std::getline(entries, entry, ';')) {
+        if (entry.empty()) {
+            continue;
+        }
+        size_t eq = entry.find('=');
+        int days;
+        if (eq == std::string::npos || !parse_days(entry.substr(0, eq), days)) {
+            std::cout << "Error: invalid days in " << entry << std::endl;
+            return false;
+        }
+        std::istringstream ranges(entry.substr(eq + 1));
+        std::string range;
+        while (std::getline(ranges, range, ',')) {
+            size_t dash = range.find('-');
+            int start_h, start_m, end_h, end_m;
+            if (dash == std::string::npos || !parse_hhmm(range.substr(0, dash), start_h, start_m)
+                    || !parse_hhmm(range.substr(dash + 1), end_h, end_m)) {
+                std::cout << "Error: invalid window " << range << std::endl;
+                return false;
+            }
+            if (sched.count == COMMAND_MAX_WINDOWS) {
+                std::cout << "Error: " << COMMAND_MAX_WINDOWS << " windows max" << std::endl;
+                return false;
+            }
+            sched.window[sched.count++] = {
+                static_cast<uint8_t>(days),
+                static_cast<uint8_t>(start_h), static_cast<uint8_t>(start_m),
+                static_cast<uint8_t>(end_h), static_cast<uint8_t>(end_m)
+            };
+        }
+    }
+    uint8_t value[COMMAND_SCHEDULE_SIZE(COMMAND_MAX_WINDOWS)];
+    size_t len = command_encode_schedule(&sched, value);
+    out.append(reinterpret_cast<const char*>(value), len);
+    return len > 0;
+}
 
-    return formatted;
+/* Duration of an override: a number of minutes, or of seconds, minutes or
+ * hours followed by s, m or h, e.g. 90s or 2h. False if it is 0 or too long.
+ */
+bool parse_duration(const std::string& s, uint32_t& seconds) {
+    char unit = 'm';
+    char end;
+    unsigned long n;
+    int fields = sscanf(s.c_str(), "%lu%c%c", &n, &unit, &end);
+    if (fields < 1 || fields > 2 || !isdigit(static_cast<unsigned char>(s[0]))) {
+        return false;
+    }
+    unsigned long scale = unit == 's' ? 1 : unit == 'm' ? 60 : unit == 'h' ? 3600 : 0;
+    if (scale == 0 || n == 0 || n > UINT32_MAX / scale) {
+        return false;
+    }
+    seconds = static_cast<uint32_t>(n * scale);
+    return true;
 }
 
 void debug(const char *format, ...) {
@@ -52,159 +158,1150 @@ void debug(const char *format, ...) {
 
 
 
-int main(int argc, char *argv[]) {
-    if (argc == 1 || (argc == 2 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0))) {
-        std::cout << "Usage: " << argv[0] << " [0/1/2] [[hh:mm] [hh:mm]] [http[s]://...] [SSID PASS]" << std::endl;
-        std::cout << std::endl;
-        std::cout << "  [0/1/2]         Select the data you want to send" << std::endl;
-        std::cout << "  [hh:mm]         Start of the period between 00:00 and 23:59" << std::endl;
-        std::cout << "  [hh:mm]         End of the period between 00:00 and 23:59" << std::endl;
-        std::cout << "  [http[s]://...] URl used to update BME datai. Max 200 bytes" << std::endl;
-        std::cout << "  [SSID PASS]     SSID and password to connect the ESP32" << std::endl;
-        std::cout << "                  SSID has 32 max characters" << std::endl;
-        std::cout << "                  PASS has 64 max characters" << std::endl;
-        return 0;
-    }
-
-    const int flag { atoi(argv[1]) };
+/* Builds the datagram for flag with its command line arguments.
+ * Prints the error and returns false if the arguments are invalid.
+ */
+bool build_message(int flag, const std::string& arg2, const std::string& arg3, std::string& msg) {
+    msg = "";
+    // adding flag to msg
+    msg += static_cast<char>(flag);
 
+    // adding args to msg
+    uint8_t value[COMMAND_MAX_SIZE];
+    size_t len = 0;
     switch (flag) {
-        case MSG_FLAG::PERIOD_FLAG:
-        case MSG_FLAG::SSID_FLAG:
-            if (argc != 4) {
-                std::cout << "Error: 3 arguments required to send period or SSID" << std::endl;
-                return 1;
+        case CONTROL_PERIOD: {
+            Period period {};
+            if (!parse_hhmm(arg2, period.start_h, period.start_m) || !parse_hhmm(arg3, period.end_h, period.end_m)) {
+                std::cout << "Error: invalid period: " << arg2 << " " << arg3 << std::endl;
+                return false;
+            }
+            len = command_encode_period(&period, value);
+            break;
+        }
+        case CONTROL_URL:
+            len = command_encode_url(arg2.c_str(), value);
+            if (len == 0) {
+                std::cout << "Adress must be 1 to " << COMMAND_URL_MAX << " char long. Current length is " << arg2.length() << std::endl;
+                return false;
             }
             break;
-        case MSG_FLAG::ADRESS_FLAG:
-            if (argc != 3) {
-                std::cout << "Error: 2 arguments required to send url" << std::endl;
-                return 1;
+        case CONTROL_WIFI:
+            len = command_encode_wifi(arg2.c_str(), arg3.c_str(), value);
+            if (len == 0) {
+                std::cout << "Error: SSID must be " << COMMAND_SSID_MAX << " characters or less, password "
+                          << COMMAND_PASS_MAX << " characters or less" << std::endl;
+                return false;
             }
             break;
+        case CONTROL_SCHEDULE:
+            return format_schedule(arg2, msg);
+        case CONTROL_OVERRIDE: {
+            command_override_t o {};
+            if (arg2 == "on") {
+                o.mode = COMMAND_OVERRIDE_ON;
+            } else if (arg2 == "off") {
+                o.mode = COMMAND_OVERRIDE_OFF;
+            } else if (arg2 != "auto") {
+                std::cout << "Error: override must be on, off or auto, not " << arg2 << std::endl;
+                return false;
+            }
+            if (!arg3.empty() && (o.mode == COMMAND_OVERRIDE_NONE || !parse_duration(arg3, o.duration_s))) {
+                std::cout << "Error: invalid duration " << arg3 << " for " << arg2 << std::endl;
+                return false;
+            }
+            len = command_encode_override(&o, value);
+            break;
+        }
         default:
-            std::cout << "Error: Unknown flag " << argv[1] << std::endl;
+            std::cout << "Error: Unknown flag " << flag << std::endl;
+            return false;
+    }
+    msg.append(reinterpret_cast<const char*>(value), len);
+    debug("%zu bytes of value\n", len);
+    return true;
+}
+
+/* Number of arguments expected after the flag, or -1 if the flag is unknown.
+ * optional gets how many of the last ones may be left out.
+ */
+int flag_arg_count(int flag, int& optional) {
+    optional = 0;
+    switch (flag) {
+        case CONTROL_PERIOD:
+        case CONTROL_WIFI:
+            return 2;
+        case CONTROL_URL:
+        case CONTROL_SCHEDULE:
             return 1;
+        case CONTROL_OVERRIDE:
+            // the duration
+            optional = 1;
+            return 2;
+        default:
+            return -1;
     }
+}
 
-    std::string arg1 = argv[1];
-    std::string arg2 = argv[2];
+static const char* command_name(int flag) {
+    static const char* names[] = {"period", "url", "wifi", "schedule", "override"};
+    return flag >= 0 && flag < 5 ? names[flag] : "?";
+}
 
+/* Builds the datagram for the commands of args: "flag args..." groups
+ * separated by "+". A single command is sent as a v1 message, unless v2
+ * is set; several commands go in one v2 datagram (see main/control.h).
+ * Prints the error and returns false if the commands are invalid.
+ */
+bool build_commands(const std::vector<std::string>& args, bool v2, std::string& msg) {
+    std::vector<std::string> commands;
+    size_t i = 0;
+    while (i < args.size()) {
+        size_t end = std::find(args.begin() + i, args.end(), "+") - args.begin();
+        int flag = atoi(args[i].c_str());
+        int optional;
+        int count = flag_arg_count(flag, optional);
+        int given = static_cast<int>(end - i) - 1;
+        if (count < 0 || given > count || given < count - optional) {
+            std::cout << "Error: wrong number of arguments for flag " << args[i] << std::endl;
+            return false;
+        }
+        std::string arg2 = i + 1 < end ? args[i + 1] : "";
+        std::string arg3 = i + 2 < end ? args[i + 2] : "";
+        std::string command;
+        if (!build_message(flag, arg2, arg3, command)) {
+            return false;
+        }
+        commands.push_back(command);
+        i = end + 1;
+    }
+    if (commands.empty()) {
+        std::cout << "Error: no command" << std::endl;
+        return false;
+    }
+    if (commands.size() == 1 && !v2) {
+        msg = commands[0];
+        return true;
+    }
+    if (commands.size() > CONTROL_MAX_COMMANDS) {
+        std::cout << "Error: " << CONTROL_MAX_COMMANDS << " commands max per datagram" << std::endl;
+        return false;
+    }
 
-    std::string msg = "";
-    // adding flag to msg
-    msg += static_cast<char>(stoi(arg1));
+    // retries keep the sequence number, so the device answers them without applying twice
+    static std::mt19937 rng(std::random_device{}());
+    uint8_t buf[CONTROL_HEADER_SIZE + CONTROL_MAX_COMMANDS * (CONTROL_TLV_HEADER + 255)];
+    control_encode_header(static_cast<uint16_t>(rng()), static_cast<uint8_t>(commands.size()), buf);
+    size_t len = CONTROL_HEADER_SIZE;
+    for (const std::string& command : commands) {
+        // the v1 message is the flag then the value
+        len += control_encode_command(command[0], command.data() + 1, command.length() - 1, buf + len, sizeof(buf) - len);
+    }
+    msg.assign(reinterpret_cast<char*>(buf), len);
+    return true;
+}
 
-    // adding args to msg
-    switch (flag) {
-        case MSG_FLAG::PERIOD_FLAG:
-            {
-                std::string arg3 = argv[3];
-                std::string hours[2] = {arg2, arg3};
-                for (int i = 0; i < 2; i++) {
-                    std::string hour = "";
-                    std::string minute = "";
-                    sscanf(hours[i].c_str(), "%2s:%2s", &hour[0], &minute[0]);
-
-                    if (stoi(hour) < 0 || stoi(hour) > 23) {
-                        std::cout << "Error: invalid hour: " << hours[i] << std::endl;
-                        return 1;
-                    }
-                    if (stoi(minute) < 0 || stoi(minute) > 59) {
-                        std::cout << "Error: invalid minute: " << hours[i] << std::endl;
-                        return 1;
-                    }
-
-                    char ascii_hour = static_cast<char>(stoi(hour));
-                    char ascii_minute = static_cast<char>(stoi(minute));
-
-                    debug("length ascii: hour %ld minute %ld\n", hour.length(), minute.length());
-                    msg += ascii_hour;
-                    msg += ascii_minute;
-                }
+enum class Reply {
+    ACCEPTED,
+    INVALID,
+    MISMATCH
+};
+
+/* v1: the ESP32 echoes the message when it accepts it,
+ * and answers "invalid" otherwise.
+ * v2: one status per command. detail gets them when some are refused.
+ * Query: any answer to it is accepted.
+ */
+Reply check_reply(const std::string& msg, const char* res, size_t len, std::string* detail = nullptr) {
+    const uint8_t* m = reinterpret_cast<const uint8_t*>(msg.data());
+    if (msg.length() == CONTROL_QUERY_SIZE && m[0] == CONTROL_QUERY_MAGIC) {
+        return control_answers_query(reinterpret_cast<const uint8_t*>(res), len, m) ? Reply::ACCEPTED : Reply::MISMATCH;
+    }
+    if (control_is_v2(m, msg.length())) {
+        control_header_t sent {}, got {};
+        control_command_t cmds[CONTROL_MAX_COMMANDS];
+        const uint8_t* status;
+        control_decode_header(m, msg.length(), &sent);
+        control_decode_commands(m, msg.length(), &sent, cmds, CONTROL_MAX_COMMANDS);
+        if (!control_decode_response(reinterpret_cast<const uint8_t*>(res), len, &got, &status) || got.seq != sent.seq) {
+            return Reply::MISMATCH; // late answer to another datagram
+        }
+        if (got.count == 0) {
+            if (detail) {
+                *detail = "datagram refused";
             }
-            break;
-        case MSG_FLAG::ADRESS_FLAG:
-            if (arg2.length() > 200) {
-                std::cout << "Adress must be 200 char max long. Current length is " << arg2.length() << std::endl;
-                return 1;
+            return Reply::INVALID;
+        }
+        if (got.count != sent.count) {
+            return Reply::MISMATCH;
+        }
+        bool ok = true;
+        std::string text;
+        for (int i = 0; i < got.count; i++) {
+            ok = ok && status[i] == CONTROL_OK;
+            text += std::string(i ? ", " : "") + command_name(cmds[i].type) + ": " + control_status_name(status[i]);
+        }
+        if (detail) {
+            *detail = text;
+        }
+        return ok ? Reply::ACCEPTED : Reply::INVALID;
+    }
+    if (len == msg.length() && memcmp(res, msg.data(), len) == 0) {
+        return Reply::ACCEPTED;
+    }
+    if (std::string(res, len).find("invalid") != std::string::npos) {
+        return Reply::INVALID;
+    }
+    return Reply::MISMATCH;
+}
+
+
+/* Fleet mode
+ *
+ * Sends a command to every device of a list at once, over a single
+ * non-blocking socket driven by epoll. Each device has its own deadline
+ * and retry counter, so the whole push takes about one round trip
+ * plus the retries of the slowest devices.
+ *
+ * The deadline comes from the round trip times measured on the previous
+ * runs, as TCP does (RFC 6298), and doubles at each retry. The estimates
+ * are kept in a small file between runs.
+ */
+
+#define MIN_TIMEOUT_MS 20
+
+struct RttStats {
+    double srtt_ms = 0;
+    double rttvar_ms = 0;
+    int samples = 0;
+};
+
+struct Device {
+    enum State { PENDING, ACCEPTED, INVALID, FAILED };
+
+    std::string name;
+    sockaddr_in addr;
+    std::string msg;
+    int tries = 0;
+    State state = PENDING;
+    bool to_send = true;
+    std::chrono::steady_clock::time_point first_sent_at;
+    std::chrono::steady_clock::time_point sent_at;
+    std::chrono::steady_clock::time_point deadline;
+    double rtt_ms = 0;
+    double ack_ms = 0; // from the first datagram sent to the answer, retries included
+    int timeout_ms = 0;
+    RttStats* rtt = nullptr;
+    std::string detail;
+    std::string reply; // the answer accepted
+};
+
+struct FleetOptions {
+    int timeout_ms = 500; // until a device has an RTT estimate
+    int max_timeout_ms = 8000;
+    int retries = 5;
+    bool v2 = false;
+    std::string rtt_cache; // none unless --rtt-cache is given
+    bool report = true; // print the outcome of each device
+};
+
+void rtt_add(RttStats& rtt, double sample_ms) {
+    if (rtt.samples == 0) {
+        rtt.srtt_ms = sample_ms;
+        rtt.rttvar_ms = sample_ms / 2;
+    } else {
+        rtt.rttvar_ms = 0.75 * rtt.rttvar_ms + 0.25 * std::fabs(rtt.srtt_ms - sample_ms);
+        rtt.srtt_ms = 0.875 * rtt.srtt_ms + 0.125 * sample_ms;
+    }
+    rtt.samples++;
+}
+
+// time to wait for the first answer
+int rtt_timeout(const RttStats& rtt, const FleetOptions& opt) {
+    if (rtt.samples == 0) {
+        return opt.timeout_ms;
+    }
+    int ms = static_cast<int>(std::ceil(rtt.srtt_ms + std::max(1.0, 4 * rtt.rttvar_ms)));
+    return std::clamp(ms, MIN_TIMEOUT_MS, opt.max_timeout_ms);
+}
+
+static std::string addr_name(const sockaddr_in& addr) {
+    return std::string(inet_ntoa(addr.sin_addr)) + ":" + std::to_string(ntohs(addr.sin_port));
+}
+
+/* One line per device: address srtt_ms rttvar_ms samples.
+ * A missing file is an empty cache.
+ */
+void load_rtt(const std::string& path, std::unordered_map<std::string, RttStats>& stats) {
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream words(line.substr(0, line.find('#')));
+        std::string name;
+        RttStats rtt;
+        if (words >> name >> rtt.srtt_ms >> rtt.rttvar_ms >> rtt.samples && rtt.samples > 0) {
+            stats[name] = rtt;
+        }
+    }
+}
+
+void save_rtt(const std::string& path, const std::unordered_map<std::string, RttStats>& stats) {
+    std::string tmp = path + ".tmp";
+    std::ofstream file(tmp);
+    file << "# address srtt_ms rttvar_ms samples" << std::endl;
+    for (const auto& it : stats) {
+        if (it.second.samples > 0) {
+            file << it.first << " " << it.second.srtt_ms << " " << it.second.rttvar_ms << " " << it.second.samples << std::endl;
+        }
+    }
+    file.close();
+    if (!file || rename(tmp.c_str(), path.c_str()) != 0) {
+        std::cout << "Warning: unable to write " << path << std::endl;
+    }
+}
+
+static uint64_t addr_key(const sockaddr_in& addr) {
+    return (static_cast<uint64_t>(addr.sin_addr.s_addr) << 16) | addr.sin_port;
+}
+
+bool resolve(const std::string& host_port, sockaddr_in& addr) {
+    std::string host = host_port;
+    int port = PORT;
+    size_t colon = host_port.rfind(':');
+    if (colon != std::string::npos) {
+        host = host_port.substr(0, colon);
+        port = atoi(host_port.c_str() + colon + 1);
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_aton(host.c_str(), &addr.sin_addr)) {
+        return true;
+    }
+
+    addrinfo hints {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo* res = nullptr;
+    if (getaddrinfo(host.c_str(), nullptr, &hints, &res) != 0 || res == nullptr) {
+        return false;
+    }
+    addr.sin_addr = reinterpret_cast<sockaddr_in*>(res->ai_addr)->sin_addr;
+    freeaddrinfo(res);
+    return true;
+}
+
+/* Reads the device list. Each line is:
+ *   host[:port] [flag args... [+ flag args...]]
+ * A line without a command gets the default one (msg may then be empty
+ * if no command was given on the command line). '#' starts a comment.
+ * An address listed twice is an error: the replies could not be told apart.
+ */
+bool load_devices(const std::string& path, const std::string& default_msg, bool v2, std::vector<Device>& devices) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cout << "Error: unable to open " << path << std::endl;
+        return false;
+    }
+
+    std::unordered_map<uint64_t, int> listed; // line of each address
+    std::string line;
+    int lineno = 0;
+    while (std::getline(file, line)) {
+        lineno++;
+        line = line.substr(0, line.find('#'));
+        std::istringstream words(line);
+        std::vector<std::string> args;
+        std::string word;
+        while (words >> word) {
+            args.push_back(word);
+        }
+        if (args.empty()) {
+            continue;
+        }
+
+        Device dev;
+        dev.name = args[0];
+        if (!resolve(dev.name, dev.addr)) {
+            std::cout << path << ":" << lineno << ": unknown host " << dev.name << std::endl;
+            return false;
+        }
+        auto first = listed.emplace(addr_key(dev.addr), lineno);
+        if (!first.second) {
+            std::cout << path << ":" << lineno << ": " << dev.name << " already listed line "
+                << first.first->second << std::endl;
+            return false;
+        }
+
+        if (args.size() == 1) {
+            dev.msg = default_msg;
+        } else if (!build_commands(std::vector<std::string>(args.begin() + 1, args.end()), v2, dev.msg)) {
+            std::cout << path << ":" << lineno << ": invalid command" << std::endl;
+            return false;
+        }
+
+        if (dev.msg.empty()) {
+            std::cout << path << ":" << lineno << ": no command for " << dev.name << std::endl;
+            return false;
+        }
+        devices.push_back(dev);
+    }
+    return true;
+}
+
+/* Sends every pending datagram. Returns false if the socket is full
+ * and EPOLLOUT must be awaited.
+ */
+static bool fleet_send(int sock, std::vector<Device>& devices) {
+    using clock = std::chrono::steady_clock;
+    for (Device& dev : devices) {
+        if (!dev.to_send) {
+            continue;
+        }
+        if (sendto(sock, dev.msg.data(), dev.msg.length(), 0, (sockaddr *)&dev.addr, sizeof(dev.addr)) == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return false;
             }
-            msg += arg2;
-            break;
-        case MSG_FLAG::SSID_FLAG:
-            {
-                std::string arg3 {argv[3]};
-                msg += format(arg2, arg3);
-                std::cout << msg << std::endl;
+            // unreachable host and so on: counted as a try
+            debug("%s: sendto: %s\n", dev.name.c_str(), strerror(errno));
+        }
+        dev.to_send = false;
+        dev.sent_at = clock::now();
+        if (dev.tries++ == 0) {
+            dev.first_sent_at = dev.sent_at;
+        }
+        dev.deadline = dev.sent_at + std::chrono::milliseconds(dev.timeout_ms);
+    }
+    return true;
+}
+
+static void fleet_receive(int sock, std::vector<Device>& devices, std::unordered_map<uint64_t, size_t>& index) {
+    char res[256];
+    while (1) {
+        sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t len = recvfrom(sock, res, sizeof(res), 0, (sockaddr *)&from, &from_len);
+        if (len < 0) {
+            // EAGAIN: socket drained
+            return;
+        }
+        auto it = index.find(addr_key(from));
+        if (it == index.end()) {
+            debug("Reply from unknown device %s\n", inet_ntoa(from.sin_addr));
+            continue;
+        }
+        Device& dev = devices[it->second];
+        if (dev.state != Device::PENDING) {
+            continue; // late duplicate
+        }
+        Reply reply = check_reply(dev.msg, res, len, &dev.detail);
+        if (reply != Reply::MISMATCH) {
+            auto now = std::chrono::steady_clock::now();
+            dev.rtt_ms = std::chrono::duration<double, std::milli>(now - dev.sent_at).count();
+            dev.ack_ms = std::chrono::duration<double, std::milli>(now - dev.first_sent_at).count();
+            // after a retry, the answer may be to any of the datagrams (Karn)
+            if (dev.tries == 1) {
+                rtt_add(*dev.rtt, dev.rtt_ms);
             }
+        }
+        switch (reply) {
+            case Reply::ACCEPTED:
+                dev.state = Device::ACCEPTED;
+                dev.reply.assign(res, len);
+                break;
+            case Reply::INVALID:
+                dev.state = Device::INVALID;
+                break;
+            case Reply::MISMATCH:
+                // stale answer to an earlier datagram: dropped, the deadline
+                // of the device drives the retries and their backoff
+                debug("Mismatched reply from %s dropped\n", dev.name.c_str());
+                break;
+        }
+    }
+}
+
+int run_fleet(std::vector<Device>& devices, const FleetOptions& opt) {
+    using clock = std::chrono::steady_clock;
+
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (sock == -1) {
+        perror("Error creating socket");
+        return 1;
+    }
+    int ep = epoll_create1(0);
+    if (ep == -1) {
+        perror("Error creating epoll");
+        close(sock);
+        return 1;
+    }
+    epoll_event ev {};
+    ev.events = EPOLLIN;
+    ev.data.fd = sock;
+    epoll_ctl(ep, EPOLL_CTL_ADD, sock, &ev);
+
+    std::unordered_map<std::string, RttStats> stats;
+    if (!opt.rtt_cache.empty()) {
+        load_rtt(opt.rtt_cache, stats);
+    }
+    std::unordered_map<uint64_t, size_t> index;
+    for (size_t i = 0; i < devices.size(); i++) {
+        index[addr_key(devices[i].addr)] = i;
+        devices[i].rtt = &stats[addr_name(devices[i].addr)];
+        devices[i].timeout_ms = rtt_timeout(*devices[i].rtt, opt);
+        debug("%s: timeout %d ms\n", devices[i].name.c_str(), devices[i].timeout_ms);
+    }
+
+    const auto start = clock::now();
+    size_t pending = devices.size();
+    bool want_out = false;
+    while (pending) {
+        bool all_sent = fleet_send(sock, devices);
+        if (all_sent == want_out) {
+            // (un)subscribe to EPOLLOUT
+            want_out = !all_sent;
+            ev.events = want_out ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+            epoll_ctl(ep, EPOLL_CTL_MOD, sock, &ev);
+        }
+
+        // wait until the first deadline
+        auto now = clock::now();
+        auto next = now + std::chrono::milliseconds(opt.max_timeout_ms);
+        for (const Device& dev : devices) {
+            if (dev.state == Device::PENDING && !dev.to_send) {
+                next = std::min(next, dev.deadline);
+            }
+        }
+        int wait_ms = std::max<int>(0, std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count() + 1);
+
+        epoll_event events[4];
+        int n = epoll_wait(ep, events, 4, wait_ms);
+        for (int i = 0; i < n; i++) {
+            if (events[i].events & EPOLLIN) {
+                fleet_receive(sock, devices, index);
+            }
+        }
+
+        now = clock::now();
+        pending = 0;
+        for (Device& dev : devices) {
+            if (dev.state != Device::PENDING) {
+                continue;
+            }
+            if (!dev.to_send && now >= dev.deadline) {
+                if (dev.tries > opt.retries) {
+                    dev.state = Device::FAILED;
+                    continue;
+                }
+                // back off, so that a slow device is not flooded
+                dev.timeout_ms = std::min(dev.timeout_ms * 2, opt.max_timeout_ms);
+                dev.to_send = true;
+            }
+            pending++;
+        }
+    }
+    close(ep);
+    close(sock);
+    if (!opt.rtt_cache.empty()) {
+        save_rtt(opt.rtt_cache, stats);
+    }
+
+    int failures = 0;
+    for (const Device& dev : devices) {
+        failures += dev.state != Device::ACCEPTED;
+    }
+    if (!opt.report) {
+        return failures == 0 ? 0 : 2;
+    }
+
+    double slowest_ms = 0;
+    for (const Device& dev : devices) {
+        std::cout << dev.name << "\t";
+        switch (dev.state) {
+            case Device::ACCEPTED:
+                // an override on or off is on the relay when acked, auto follows shortly after
+                std::cout << "ok\t" << dev.tries << " tries\t" << dev.ack_ms << " ms";
+                slowest_ms = std::max(slowest_ms, dev.ack_ms);
+                break;
+            case Device::INVALID:
+                std::cout << "invalid\t" << dev.tries << " tries\t" << dev.detail;
+                break;
+            default:
+                std::cout << "no answer\t" << dev.tries << " tries";
+        }
+        std::cout << std::endl;
+    }
+    double total_ms = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+    std::cout << devices.size() - failures << "/" << devices.size() << " devices updated in "
+        << total_ms << " ms, slowest ack " << slowest_ms << " ms" << std::endl;
+    return failures == 0 ? 0 : 2;
+}
+
+/* Discovery
+ *
+ * Broadcasts one probe and lists every device answering it within the
+ * window. The list is written as a fleet file, so that later commands can
+ * be sent to the devices found with --fleet.
+ */
+
+struct DiscoverOptions {
+    std::string broadcast = "255.255.255.255";
+    int window_ms = 1000;
+    std::string cache = "devices.txt";
+};
+
+static std::string format_mac(const uint8_t* mac) {
+    char text[18];
+    snprintf(text, sizeof(text), "%02x:%02x:%02x:%02x:%02x:%02x", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    return text;
+}
+
+static std::string format_device(const control_device_t& d) {
+    char text[128];
+    if (d.windows) {
+        snprintf(text, sizeof(text), "id %u, mac %s, version %s, schedule of %u windows",
+                d.id, format_mac(d.mac).c_str(), d.version, d.windows);
+    } else {
+        snprintf(text, sizeof(text), "id %u, mac %s, version %s, period %02d:%02d-%02d:%02d",
+                d.id, format_mac(d.mac).c_str(), d.version,
+                d.period.start_h, d.period.start_m, d.period.end_h, d.period.end_m);
+    }
+    return text;
+}
+
+// keyed by address, so that a device answering twice is listed once
+bool discover(const DiscoverOptions& opt, std::map<std::string, control_device_t>& found) {
+    using clock = std::chrono::steady_clock;
+    sockaddr_in addr;
+    if (!resolve(opt.broadcast, addr)) {
+        std::cout << "Error: unknown address " << opt.broadcast << std::endl;
+        return false;
+    }
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock == -1) {
+        perror("Error creating socket");
+        return false;
+    }
+    int broadcast = 1;
+    setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &broadcast, sizeof(broadcast));
+
+    static std::mt19937 rng(std::random_device{}());
+    const uint16_t seq = static_cast<uint16_t>(rng());
+    uint8_t probe[CONTROL_PROBE_SIZE];
+    control_encode_probe(seq, probe);
+    if (sendto(sock, probe, sizeof(probe), 0, (sockaddr *)&addr, sizeof(addr)) == -1) {
+        perror("Error sending probe");
+        close(sock);
+        return false;
+    }
+
+    const auto end = clock::now() + std::chrono::milliseconds(opt.window_ms);
+    pollfd pfd { sock, POLLIN, 0 };
+    while (1) {
+        int wait_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end - clock::now()).count();
+        if (wait_ms <= 0 || poll(&pfd, 1, wait_ms) <= 0) {
             break;
-        default:
-            std::cout << "Unknown flag." << argv[0] << std::endl;
+        }
+        uint8_t res[CONTROL_DEVICE_MAX_SIZE + 1];
+        sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t len = recvfrom(sock, res, sizeof(res), 0, (sockaddr *)&from, &from_len);
+        control_device_t d;
+        if (len < 0 || !control_decode_device(res, len, &d) || d.seq != seq) {
+            continue;
+        }
+        std::string name = std::string(inet_ntoa(from.sin_addr)) + ":" + std::to_string(ntohs(from.sin_port));
+        found[name] = d;
     }
+    close(sock);
+    return true;
+}
 
-    std::cout << "Msg length: " << msg.length() << std::endl;
+// the cache is a fleet file, the details being comments
+bool write_cache(const std::string& path, const std::map<std::string, control_device_t>& found) {
+    std::string tmp = path + ".tmp";
+    std::ofstream file(tmp);
+    file << "# found by --discover, to be used with --fleet" << std::endl;
+    for (const auto& dev : found) {
+        file << dev.first << "\t# " << format_device(dev.second) << std::endl;
+    }
+    file.close();
+    if (!file || rename(tmp.c_str(), path.c_str()) != 0) {
+        std::cout << "Error: unable to write " << path << std::endl;
+        return false;
+    }
+    return true;
+}
 
-    int Try = 1;
-    while (Try != 0) {
-        std::cout << "Try: " << Try << "..." << std::endl;
+/* Boot profile
+ *
+ * Asks the devices when they reached each boot phase (main/boot.h), and
+ * prints the time since boot with the time taken since the previous phase.
+ */
 
-        int sock = socket(AF_INET, SOCK_DGRAM, 0);
-        if (sock == -1) {
-            perror("Error creating socket");
-            return 1;
+static const char* reset_name(int reason) {
+    // esp_reset_reason_t
+    static const char* const names[] = {
+        "unknown", "power on", "external", "software", "panic", "interrupt watchdog",
+        "task watchdog", "watchdog", "deep sleep", "brownout", "SDIO",
+    };
+    return reason >= 0 && reason < (int)(sizeof(names) / sizeof(names[0])) ? names[reason] : "?";
+}
+
+static void print_profile(const Device& dev) {
+    control_profile_t p;
+    if (!control_decode_profile(reinterpret_cast<const uint8_t*>(dev.reply.data()), dev.reply.length(), &p)) {
+        std::cout << dev.name << "\tno profile (older firmware?)" << std::endl;
+        return;
+    }
+    std::cout << dev.name << "\treset: " << reset_name(p.reset_reason);
+    if (p.flags & (CONTROL_BOOT_CACHED_AP | CONTROL_BOOT_FULL_SCAN)) {
+        std::cout << (p.flags & CONTROL_BOOT_CACHED_AP ? ", cached AP" : ", no cached AP")
+                  << (p.flags & CONTROL_BOOT_FULL_SCAN ? ", full scan" : "")
+                  << (p.flags & CONTROL_BOOT_STATIC_IP ? ", static IP" : ", DHCP");
+    }
+    std::cout << std::endl;
+
+    uint32_t previous = 0;
+    for (int i = 0; i < p.count; i++) {
+        char line[80];
+        if (p.ms[i] == CONTROL_PHASE_NONE) {
+            snprintf(line, sizeof(line), "  %-14s -", control_phase_name(i));
+        } else if (p.ms[i] >= previous) {
+            snprintf(line, sizeof(line), "  %-14s %8u ms  +%u ms", control_phase_name(i),
+                    (unsigned)p.ms[i], (unsigned)(p.ms[i] - previous));
+            previous = p.ms[i];
+        } else {
+            // the last phases are not ordered: the relay may be set before the first upload
+            snprintf(line, sizeof(line), "  %-14s %8u ms", control_phase_name(i), (unsigned)p.ms[i]);
         }
+        std::cout << line << std::endl;
+    }
+}
 
-        sockaddr_in addr;
-        memset(&addr, 0, sizeof(addr));
-        addr.sin_family = AF_INET;
-        addr.sin_port = htons(PORT);
-        inet_aton(ADDRESS, &addr.sin_addr);
+/* Override state
+ *
+ * Asks the devices whether their relay is forced (command 4) or follows the
+ * schedule, and prints it with the state of the relays.
+ */
+
+static void print_override(const Device& dev) {
+    control_override_state_t s;
+    if (!control_decode_override_state(reinterpret_cast<const uint8_t*>(dev.reply.data()), dev.reply.length(), &s)) {
+        std::cout << dev.name << "\tno override state (older firmware?)" << std::endl;
+        return;
+    }
+    char relays[16];
+    snprintf(relays, sizeof(relays), "0x%x", (unsigned)s.relays);
+    std::cout << dev.name << "\t";
+    if (s.mode == COMMAND_OVERRIDE_NONE) {
+        std::cout << "schedule";
+    } else {
+        std::cout << "forced " << (s.mode == COMMAND_OVERRIDE_ON ? "on" : "off");
+        if (s.remaining_s) {
+            std::cout << ", " << s.remaining_s << " s left";
+        }
+    }
+    std::cout << "\trelays " << relays << "\t" << dev.ack_ms << " ms" << std::endl;
+}
 
-        if (sendto(sock, msg.c_str(), msg.length(), 0, (sockaddr *)&addr, sizeof(addr)) == -1) {
-            perror("Error sending message");
-            close(sock);
+/* Metrics
+ *
+ * Scrapes the counters of the devices (main/metrics.h) and prints them in
+ * the text format of Prometheus, labelled with the address of the device.
+ * bme_up is 0 for the devices which did not answer.
+ */
+
+struct MetricDesc {
+    const char* name;
+    const char* labels; // added to the device label, may be empty
+    const char* help;
+};
+
+// same order as control_counter_t
+static const MetricDesc s_counters[] = {
+    { "bme_udp_received_total", "", "Datagrams received on the control port" },
+    { "bme_udp_invalid_total", "", "Commands refused" },
+    { "bme_udp_restarts_total", "", "Restarts of the control socket" },
+    { "bme_uploads_total", "", "Batches of readings posted" },
+    { "bme_upload_failures_total", "", "Batches of readings not accepted" },
+    { "bme_upload_bytes_total", "", "Bytes of the batches posted" },
+    { "bme_relay_switches_total", "", "Relay channels switched by the schedule" },
+    { "bme_schedule_checks_total", "", "Evaluations of the schedule" },
+    { "bme_wifi_reconnects_total", "", "Disconnections from the access point" },
+};
+
+// same order as control_gauge_t
+static const MetricDesc s_gauges[] = {
+    { "bme_uptime_seconds", "", "Time since boot" },
+    { "bme_heap_free_bytes", "", "Free heap" },
+    { "bme_heap_min_free_bytes", "", "Lowest free heap since boot" },
+    { "bme_stack_free_bytes", "task=\"bmxtask\"", "Stack never used by the task" },
+    { "bme_stack_free_bytes", "task=\"udp_server\"", "Stack never used by the task" },
+    { "bme_stack_free_bytes", "task=\"light_manager\"", "Stack never used by the task" },
+    { "bme_clock_sync_age_seconds", "", "Time since the last SNTP sync" },
+    { "bme_clock_drift_microseconds", "", "Correction made by the last SNTP sync" },
+};
+
+static_assert(sizeof(s_counters) / sizeof(s_counters[0]) == CONTROL_COUNTERS, "a counter has no name");
+static_assert(sizeof(s_gauges) / sizeof(s_gauges[0]) == CONTROL_GAUGES, "a gauge has no name");
+
+static std::string labels(const std::string& device, const char* more) {
+    return "{device=\"" + device + "\"" + (*more ? "," : "") + more + "}";
+}
+
+// a family of samples, one per device having it
+template <typename F>
+static void print_family(std::ostream& out, const MetricDesc* descs, size_t count, const char* type,
+        const std::vector<std::pair<std::string, control_metrics_t>>& scraped, F value) {
+    for (size_t i = 0; i < count; i++) {
+        // the samples of a family must follow each other
+        if (i == 0 || strcmp(descs[i].name, descs[i - 1].name) != 0) {
+            out << "# HELP " << descs[i].name << " " << descs[i].help << std::endl;
+            out << "# TYPE " << descs[i].name << " " << type << std::endl;
+        }
+        for (const auto& it : scraped) {
+            int64_t v;
+            if (value(it.second, i, v)) {
+                out << descs[i].name << labels(it.first, descs[i].labels) << " " << v << std::endl;
+            }
+        }
+    }
+}
+
+void print_prometheus(std::ostream& out, const std::vector<Device>& devices) {
+    std::vector<std::pair<std::string, control_metrics_t>> scraped;
+    out << "# HELP bme_up Whether the device answered the scrape" << std::endl;
+    out << "# TYPE bme_up gauge" << std::endl;
+    for (const Device& dev : devices) {
+        control_metrics_t m;
+        bool up = dev.state == Device::ACCEPTED
+            && control_decode_metrics(reinterpret_cast<const uint8_t*>(dev.reply.data()), dev.reply.length(), &m);
+        out << "bme_up" << labels(dev.name, "") << " " << up << std::endl;
+        if (up) {
+            scraped.emplace_back(dev.name, m);
+        }
+    }
+
+    // an older firmware has less of them
+    print_family(out, s_counters, CONTROL_COUNTERS, "counter", scraped,
+            [](const control_metrics_t& m, size_t i, int64_t& v) { v = m.counter[i]; return i < m.counters; });
+    print_family(out, s_gauges, CONTROL_GAUGES, "gauge", scraped,
+            [](const control_metrics_t& m, size_t i, int64_t& v) {
+                v = i == CONTROL_CLOCK_DRIFT_US ? (int32_t)m.gauge[i] : m.gauge[i];
+                return i < m.gauges && !(i == CONTROL_CLOCK_SYNC_AGE_S && m.gauge[i] == CONTROL_CLOCK_NONE);
+            });
+
+    const char* name = "bme_upload_latency_seconds";
+    out << "# HELP " << name << " Time taken by the uploads" << std::endl;
+    out << "# TYPE " << name << " histogram" << std::endl;
+    for (const auto& it : scraped) {
+        const control_metrics_t& m = it.second;
+        uint64_t count = 0;
+        for (int i = 0; i < m.buckets; i++) {
+            count += m.bucket[i];
+            std::string le = "+Inf";
+            if (i < m.buckets - 1) {
+                std::ostringstream bound;
+                bound << control_latency_bound(i) / 1000.0;
+                le = bound.str();
+            }
+            out << name << "_bucket" << labels(it.first, ("le=\"" + le + "\"").c_str()) << " " << count << std::endl;
+        }
+        out << name << "_sum" << labels(it.first, "") << " " << m.latency_sum_ms / 1000.0 << std::endl;
+        out << name << "_count" << labels(it.first, "") << " " << count << std::endl;
+    }
+}
+
+void usage(const char* prog) {
+    std::cout << "Usage: " << prog << " [0/1/2/3/4] [[hh:mm] [hh:mm]] [http[s]://...] [SSID PASS] [SCHEDULE]"
+              << " [on|off|auto [DURATION]]" << std::endl;
+    std::cout << "       " << prog << " [--v2] COMMAND [+ COMMAND...]" << std::endl;
+    std::cout << "       " << prog << " --fleet FILE [--timeout MS] [--max-timeout MS] [--retries N] [--rtt-cache FILE]" << std::endl;
+    std::cout << "       " << std::string(strlen(prog), ' ') << "         [--v2] [COMMAND [+ COMMAND...]]" << std::endl;
+    std::cout << "       " << prog << " --discover [--broadcast ADDR[:PORT]] [--window MS] [--cache FILE]" << std::endl;
+    std::cout << "       " << prog << " --profile [--fleet FILE] [--timeout MS] [--retries N] [HOST[:PORT]...]" << std::endl;
+    std::cout << "       " << prog << " --metrics [--fleet FILE] [--timeout MS] [--retries N] [--out FILE] [HOST[:PORT]...]" << std::endl;
+    std::cout << "       " << prog << " --state [--fleet FILE] [--timeout MS] [--retries N] [HOST[:PORT]...]" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  [0/1/2/3/4]       Select the data you want to send" << std::endl;
+    std::cout << "  [hh:mm]         Start of the period between 00:00 and 23:59" << std::endl;
+    std::cout << "  [hh:mm]         End of the period between 00:00 and 23:59" << std::endl;
+    std::cout << "  [http[s]://...] URl used to update BME datai. Max 199 bytes" << std::endl;
+    std::cout << "  [SSID PASS]     SSID and password to connect the ESP32" << std::endl;
+    std::cout << "                  SSID has 32 max characters" << std::endl;
+    std::cout << "                  PASS has 64 max characters" << std::endl;
+    std::cout << "  [SCHEDULE]      Weekly schedule, replacing the period, e.g." << std::endl;
+    std::cout << "                  'mon-fri=07:00-12:00,14:00-19:00;sat,sun=09:00-12:00'" << std::endl;
+    std::cout << "                  Days are sun..sat or all. 16 windows max" << std::endl;
+    std::cout << "  [on|off|auto [DURATION]]  Force the relay on or off at once, until the" << std::endl;
+    std::cout << "                  schedule takes over again after DURATION (minutes, or" << std::endl;
+    std::cout << "                  e.g. 90s, 2h) or auto is sent. Not kept across reboots" << std::endl;
+    std::cout << "  COMMAND         One of the above, flag and arguments" << std::endl;
+    std::cout << "  + COMMAND       Up to 4 commands sent in one v2 datagram, applied" << std::endl;
+    std::cout << "                  together or not at all" << std::endl;
+    std::cout << "  --v2            Send a single command as v2 too (status codes)" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  --fleet FILE    Send to every device listed in FILE, one per line:" << std::endl;
+    std::cout << "                  host[:port] [COMMAND [+ COMMAND...]]" << std::endl;
+    std::cout << "                  Devices without a command get the one of the command line" << std::endl;
+    std::cout << "  --timeout MS    Time to wait for the first answer of a device whose round" << std::endl;
+    std::cout << "                  trip time is not known yet (default 500)" << std::endl;
+    std::cout << "  --max-timeout MS  Limit of the timeouts, doubled at each retry (default 8000)" << std::endl;
+    std::cout << "  --retries N     Number of retries per device (default 5)" << std::endl;
+    std::cout << "  --rtt-cache FILE  Round trip times kept between runs (none by default)" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  --discover      List the devices answering a broadcast probe" << std::endl;
+    std::cout << "  --broadcast ADDR Where the probe goes (default 255.255.255.255)" << std::endl;
+    std::cout << "  --window MS     Time to collect the answers (default 1000)" << std::endl;
+    std::cout << "  --cache FILE    Fleet file written with the devices found (default devices.txt)" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  --profile       Print the time each device took to reach its boot phases," << std::endl;
+    std::cout << "                  for the devices of --fleet and the HOSTs (default " << ADDRESS << ")" << std::endl;
+    std::cout << "  --metrics       Print the metrics of the same devices for Prometheus" << std::endl;
+    std::cout << "  --state         Print whether their relay is forced, and its state" << std::endl;
+    std::cout << "  --out FILE      Write them to FILE instead, e.g. for the textfile collector" << std::endl;
+}
+
+int discover_main(int argc, char *argv[]) {
+    DiscoverOptions opt;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--broadcast" && i + 1 < argc) {
+            opt.broadcast = argv[++i];
+        } else if (arg == "--window" && i + 1 < argc) {
+            opt.window_ms = atoi(argv[++i]);
+        } else if (arg == "--cache" && i + 1 < argc) {
+            opt.cache = argv[++i];
+        } else {
+            usage(argv[0]);
             return 1;
         }
+    }
 
-        char res[256] = {0};
-        socklen_t addr_len = sizeof(addr);
-        if (recvfrom(sock, res, sizeof(res), 0, (sockaddr *)&addr, &addr_len) == -1) {
-            perror("Error receiving response");
-            close(sock);
+    std::map<std::string, control_device_t> found;
+    if (!discover(opt, found)) {
+        return 1;
+    }
+    for (const auto& dev : found) {
+        std::cout << dev.first << "\t" << format_device(dev.second) << std::endl;
+    }
+    std::cout << found.size() << " devices found" << std::endl;
+    if (!opt.cache.empty() && !write_cache(opt.cache, found)) {
+        return 1;
+    }
+    return found.empty() ? 2 : 0;
+}
+
+struct QueryOptions {
+    FleetOptions fleet;
+    std::string path;
+    std::vector<std::string> hosts;
+    std::string out; // --metrics only
+};
+
+// [--fleet FILE] [--timeout MS] [--retries N] [--out FILE] [HOST[:PORT]...]
+bool parse_query_args(int argc, char *argv[], QueryOptions& opt) {
+    opt.fleet.report = false;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if ((arg == "--fleet" || arg == "-f") && i + 1 < argc) {
+            opt.path = argv[++i];
+        } else if (arg == "--timeout" && i + 1 < argc) {
+            opt.fleet.timeout_ms = atoi(argv[++i]);
+        } else if (arg == "--retries" && i + 1 < argc) {
+            opt.fleet.retries = atoi(argv[++i]);
+        } else if (arg == "--out" && i + 1 < argc && strcmp(argv[1], "--metrics") == 0) {
+            opt.out = argv[++i];
+        } else if (arg[0] != '-') {
+            opt.hosts.push_back(arg);
+        } else {
+            return false;
+        }
+    }
+    if (opt.path.empty() && opt.hosts.empty()) {
+        opt.hosts.push_back(ADDRESS);
+    }
+    return opt.fleet.timeout_ms > 0;
+}
+
+/* Sends the query to the devices of the fleet file and to the hosts,
+ * as a fleet push. Returns the code of run_fleet(), 1 if the devices
+ * could not be listed.
+ */
+int query_devices(const QueryOptions& opt, uint8_t query, std::vector<Device>& devices) {
+    static std::mt19937 rng(std::random_device{}());
+    uint8_t bytes[CONTROL_QUERY_SIZE];
+    control_encode_query(static_cast<uint16_t>(rng()), query, bytes);
+    const std::string msg(reinterpret_cast<const char*>(bytes), sizeof(bytes));
+
+    if (!opt.path.empty() && !load_devices(opt.path, msg, false, devices)) {
+        return 1;
+    }
+    for (const std::string& host : opt.hosts) {
+        Device dev;
+        dev.name = host;
+        if (!resolve(host, dev.addr)) {
+            std::cout << "Error: unknown host " << host << std::endl;
             return 1;
         }
+        // every device gets the same query: a duplicate is merged
+        auto same = [&dev](const Device& d) { return addr_key(d.addr) == addr_key(dev.addr); };
+        if (std::any_of(devices.begin(), devices.end(), same)) {
+            std::cout << "Warning: " << host << " listed twice, queried once" << std::endl;
+            continue;
+        }
+        devices.push_back(dev);
+    }
+    // the commands of the fleet file are not sent
+    for (Device& dev : devices) {
+        dev.msg = msg;
+    }
+    return run_fleet(devices, opt.fleet);
+}
 
-        std::string res_str = res;
-        if (flag != MSG_FLAG::PERIOD_FLAG) {
-            std::cout << "Response length: " << strlen(res) << std::endl;
-        }
-        if (res_str.find("invalid") != std::string::npos) {
-            Try = 0;
-            std::cout << "Invalid message. Please check" << std::endl;
-        } else if (res_str == msg) {
-            Try = 0;
-        } else if (flag == MSG_FLAG::PERIOD_FLAG || flag == MSG_FLAG::SSID_FLAG) {
-            bool is_invalid = false;
-            int x = flag == MSG_FLAG::PERIOD_FLAG ? 5 : 32 + 64 + 1;
-            for (int i = 0; i <= x; i++) {
-                if (res[i] != msg[i]) {
-                    is_invalid = true;
-                    break;
-                }
-            }
-            if (is_invalid) {
-                std::cout << "Invalid value" << std::endl;
-                Try++;
-            } else { 
-                Try = 0;
-            }
+int profile_main(int argc, char *argv[]) {
+    QueryOptions opt;
+    if (!parse_query_args(argc, argv, opt)) {
+        usage(argv[0]);
+        return 1;
+    }
+    std::vector<Device> devices;
+    int ret = query_devices(opt, CONTROL_QUERY_PROFILE, devices);
+    for (const Device& dev : devices) {
+        if (dev.state == Device::ACCEPTED) {
+            print_profile(dev);
         } else {
-            Try++;
+            std::cout << dev.name << "\tno answer\t" << dev.tries << " tries" << std::endl;
         }
+    }
+    return ret;
+}
 
-        close(sock);
+int state_main(int argc, char *argv[]) {
+    QueryOptions opt;
+    if (!parse_query_args(argc, argv, opt)) {
+        usage(argv[0]);
+        return 1;
+    }
+    std::vector<Device> devices;
+    int ret = query_devices(opt, CONTROL_QUERY_OVERRIDE, devices);
+    for (const Device& dev : devices) {
+        if (dev.state == Device::ACCEPTED) {
+            print_override(dev);
+        } else {
+            std::cout << dev.name << "\tno answer\t" << dev.tries << " tries" << std::endl;
+        }
+    }
+    return ret;
+}
+
+int metrics_main(int argc, char *argv[]) {
+    QueryOptions opt;
+    if (!parse_query_args(argc, argv, opt)) {
+        usage(argv[0]);
+        return 1;
+    }
+    std::vector<Device> devices;
+    int ret = query_devices(opt, CONTROL_QUERY_METRICS, devices);
+    if (ret == 1) {
+        return ret;
+    }
+    if (opt.out.empty()) {
+        print_prometheus(std::cout, devices);
+        return ret;
+    }
+    // replaced at once, for the textfile collector of node_exporter
+    std::string tmp = opt.out + ".tmp";
+    std::ofstream file(tmp);
+    print_prometheus(file, devices);
+    file.close();
+    if (!file || rename(tmp.c_str(), opt.out.c_str()) != 0) {
+        std::cout << "Error: unable to write " << opt.out << std::endl;
+        return 1;
+    }
+    return ret;
+}
+
+int fleet_main(int argc, char *argv[]) {
+    FleetOptions opt;
+    std::string path;
+    int i = 1;
+    for (; i < argc; i++) {
+        std::string arg = argv[i];
+        if ((arg == "--fleet" || arg == "-f") && i + 1 < argc) {
+            path = argv[++i];
+        } else if (arg == "--timeout" && i + 1 < argc) {
+            opt.timeout_ms = atoi(argv[++i]);
+        } else if (arg == "--max-timeout" && i + 1 < argc) {
+            opt.max_timeout_ms = atoi(argv[++i]);
+        } else if (arg == "--retries" && i + 1 < argc) {
+            opt.retries = atoi(argv[++i]);
+        } else if (arg == "--rtt-cache" && i + 1 < argc) {
+            opt.rtt_cache = argv[++i];
+        } else if (arg == "--v2") {
+            opt.v2 = true;
+        } else {
+            break;
+        }
+    }
+    if (path.empty() || opt.timeout_ms <= 0 || opt.max_timeout_ms < MIN_TIMEOUT_MS) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    std::string default_msg;
+    if (i < argc && !build_commands(std::vector<std::string>(argv + i, argv + argc), opt.v2, default_msg)) {
+        return 1;
     }
 
-    return 0;
+    std::vector<Device> devices;
+    if (!load_devices(path, default_msg, opt.v2, devices)) {
+        return 1;
+    }
+    return run_fleet(devices, opt);
 }
 
+int main(int argc, char *argv[]) {
+    if (argc == 1 || (argc == 2 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0))) {
+        usage(argv[0]);
+        return 0;
+    }
+
+    if (strcmp(argv[1], "--discover") == 0) {
+        return discover_main(argc, argv);
+    }
+    if (strcmp(argv[1], "--profile") == 0) {
+        return profile_main(argc, argv);
+    }
+    if (strcmp(argv[1], "--metrics") == 0) {
+        return metrics_main(argc, argv);
+    }
+    if (strcmp(argv[1], "--state") == 0) {
+        return state_main(argc, argv);
+    }
+
+    bool v2 = strcmp(argv[1], "--v2") == 0;
+    if (argv[1][0] == '-' && !(v2 && argc > 2 && argv[2][0] != '-')) {
+        return fleet_main(argc, argv);
+    }
+
+    const int first = v2 ? 2 : 1;
+    std::string msg;
+    if (!build_commands(std::vector<std::string>(argv + first, argv + argc), v2, msg)) {
+        return 1;
+    }
+
+    std::cout << "Msg length: " << msg.length() << std::endl;
+
+    // a fleet of one: same timeouts, backoff and retry limit
+    Device dev;
+    dev.name = ADDRESS;
+    resolve(dev.name, dev.addr);
+    dev.msg = msg;
+    std::vector<Device> devices { dev };
+    FleetOptions opt;
+    opt.v2 = v2;
+    return run_fleet(devices, opt);
+}
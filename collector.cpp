@@ -0,0 +1,576 @@
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <chrono>
+#include <memory>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "tsdb.h"
+#include "main/telemetry.h"
+
+/* Receives the readings of the sensors on two listeners:
+ * - HTTP: POSTs to update-sensor.php, either as form lines
+ *     temp=%f&hum=%f&press=%f&source=%d[&time=%lu&seq=%lu]\n
+ *   (one line per reading, several lines per POST when the sensor batches
+ *   them) or as binary frames of main/telemetry.h
+ *   (Content-Type: application/x-bme-telemetry);
+ * - UDP, with --udp-port: one telemetry frame per datagram, each acked. Gaps
+ *   in the sequence numbers of a sensor are reported as lost readings.
+ * Both append the readings to a CSV file in large writes:
+ *   time,source,temp,hum,press
+ * and/or to the store of tsdb.h.
+ *
+ * One thread and one epoll loop serve every connection. Requests are
+ * parsed in place in the receive buffer of the connection.
+ *
+ * g++ -std=c++17 -O2 -o collector collector.cpp tsdb.cpp
+ */
+
+#define PORT 80
+#define BUFFER_SIZE 8192
+#define MAX_EVENTS 256
+// a replay comes back at most this far behind: more than the flash store
+// of a sensor holds (64K of 32-byte records)
+#define SEQ_REPLAY_MAX 4096
+
+struct Reading {
+    int64_t time;
+    int source;
+    float temp;
+    float hum;
+    float press;
+};
+
+// last reading numbered by a source, for the lost readings
+struct SourceSeq {
+    uint32_t seq;
+    uint32_t timestamp;
+};
+
+struct Connection {
+    int fd = -1;
+    char buf[BUFFER_SIZE];
+    size_t len = 0;
+};
+
+struct Options {
+    int port = PORT;
+    const char* out = nullptr;
+    const char* store = nullptr;
+    int udp_port = 0;
+    size_t batch = 4096;
+    int flush_ms = 1000;
+};
+
+static bool iequals(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); i++) {
+        if (tolower(a[i]) != tolower(b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename T>
+static bool parse_number(std::string_view s, T& value) {
+    auto res = std::from_chars(s.data(), s.data() + s.size(), value);
+    return res.ec == std::errc() && res.ptr == s.data() + s.size();
+}
+
+// finite, and within what a telemetry_record_t holds
+static bool valid_measure(float value, float min, float max) {
+    return std::isfinite(value) && value >= min && value <= max;
+}
+
+/* Parses one "temp=..&hum=..&press=..&source=.." line.
+ * Unknown fields are ignored, as the PHP script did.
+ */
+bool parse_reading(std::string_view line, int64_t now, Reading& r) {
+    bool has_temp = false, has_hum = false, has_press = false, has_source = false;
+    r.time = now;
+    while (!line.empty()) {
+        size_t amp = line.find('&');
+        std::string_view field = line.substr(0, amp);
+        line = amp == std::string_view::npos ? std::string_view() : line.substr(amp + 1);
+
+        size_t eq = field.find('=');
+        if (eq == std::string_view::npos) {
+            continue;
+        }
+        std::string_view key = field.substr(0, eq);
+        std::string_view value = field.substr(eq + 1);
+        if (key == "temp") {
+            has_temp = parse_number(value, r.temp);
+        } else if (key == "hum") {
+            has_hum = parse_number(value, r.hum);
+        } else if (key == "press") {
+            has_press = parse_number(value, r.press);
+        } else if (key == "source") {
+            has_source = parse_number(value, r.source);
+        } else if (key == "time") {
+            int64_t t = 0;
+            if (parse_number(value, t) && t != 0) {
+                r.time = t;
+            }
+        }
+    }
+    return has_temp && has_hum && has_press && has_source
+        && valid_measure(r.temp, INT16_MIN / 100.0f, INT16_MAX / 100.0f)
+        && valid_measure(r.hum, 0, UINT16_MAX / 100.0f)
+        && valid_measure(r.press, 0, INT32_MAX / 10.0f);
+}
+
+class Collector {
+public:
+    explicit Collector(const Options& opt) : opt_(opt) {
+        readings_.reserve(opt.batch);
+        out_buf_.resize(opt.batch * 64);
+    }
+
+    int run();
+
+private:
+    void accept_all();
+    void on_readable(Connection& c);
+    // returns the number of bytes consumed, 0 if the request is incomplete, -1 on error
+    ssize_t handle_request(Connection& c, std::string_view data);
+    void reply(Connection& c, const char* status, bool keep_alive);
+    void close_connection(Connection& c);
+    void add(const Reading& r);
+    // returns the number of readings of the frame, 0 if it is malformed
+    int add_frame(std::string_view frame);
+    void on_datagrams();
+    void flush();
+    void write_out(size_t len);
+
+    Options opt_;
+    int listen_fd_ = -1;
+    int udp_fd_ = -1;
+    int ep_ = -1;
+    int timer_fd_ = -1;
+    int out_fd_ = STDOUT_FILENO;
+    std::unique_ptr<tsdb::Writer> store_;
+    std::vector<std::unique_ptr<Connection>> conns_; // indexed by fd
+    std::vector<Reading> readings_;
+    std::vector<char> out_buf_;
+    std::unordered_map<int, SourceSeq> last_seq_; // by source
+    int64_t now_ = 0;
+};
+
+int Collector::run() {
+    if (opt_.out) {
+        out_fd_ = open(opt_.out, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (out_fd_ == -1) {
+            perror("Error opening output");
+            return 1;
+        }
+    } else if (opt_.store) {
+        out_fd_ = -1;
+    }
+    if (opt_.store) {
+        store_ = std::make_unique<tsdb::Writer>(opt_.store);
+    }
+
+    listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (listen_fd_ == -1) {
+        perror("Error creating socket");
+        return 1;
+    }
+    int opt = 1;
+    setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(opt_.port);
+    if (bind(listen_fd_, (sockaddr *)&addr, sizeof(addr)) == -1 || listen(listen_fd_, SOMAXCONN) == -1) {
+        perror("Error binding socket");
+        return 1;
+    }
+
+    ep_ = epoll_create1(0);
+    epoll_event ev {};
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_fd_;
+    epoll_ctl(ep_, EPOLL_CTL_ADD, listen_fd_, &ev);
+
+    if (opt_.udp_port) {
+        udp_fd_ = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        addr.sin_port = htons(opt_.udp_port);
+        if (udp_fd_ == -1 || bind(udp_fd_, (sockaddr *)&addr, sizeof(addr)) == -1) {
+            perror("Error binding UDP socket");
+            return 1;
+        }
+        ev.data.fd = udp_fd_;
+        epoll_ctl(ep_, EPOLL_CTL_ADD, udp_fd_, &ev);
+    }
+
+    // readings are written at least every flush_ms
+    timer_fd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    itimerspec ts {};
+    ts.it_interval.tv_sec = opt_.flush_ms / 1000;
+    ts.it_interval.tv_nsec = (opt_.flush_ms % 1000) * 1000000L;
+    ts.it_value = ts.it_interval;
+    timerfd_settime(timer_fd_, 0, &ts, nullptr);
+    ev.data.fd = timer_fd_;
+    epoll_ctl(ep_, EPOLL_CTL_ADD, timer_fd_, &ev);
+
+    std::cerr << "Listening on port " << opt_.port << std::endl;
+
+    epoll_event events[MAX_EVENTS];
+    while (1) {
+        int n = epoll_wait(ep_, events, MAX_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("epoll_wait");
+            break;
+        }
+        now_ = std::chrono::duration_cast<std::chrono::seconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == listen_fd_) {
+                accept_all();
+            } else if (fd == udp_fd_) {
+                on_datagrams();
+            } else if (fd == timer_fd_) {
+                uint64_t expirations;
+                if (read(timer_fd_, &expirations, sizeof(expirations)) > 0) {
+                    flush();
+                }
+            } else if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                on_readable(*conns_[fd]);
+            }
+        }
+    }
+    flush();
+    return 1;
+}
+
+void Collector::accept_all() {
+    while (1) {
+        int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK);
+        if (fd == -1) {
+            return;
+        }
+        int opt = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+        if (static_cast<size_t>(fd) >= conns_.size()) {
+            conns_.resize(fd + 1);
+        }
+        if (!conns_[fd]) {
+            conns_[fd] = std::make_unique<Connection>();
+        }
+        conns_[fd]->fd = fd;
+        conns_[fd]->len = 0;
+
+        epoll_event ev {};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = fd;
+        epoll_ctl(ep_, EPOLL_CTL_ADD, fd, &ev);
+    }
+}
+
+void Collector::on_readable(Connection& c) {
+    while (1) {
+        ssize_t n = recv(c.fd, c.buf + c.len, sizeof(c.buf) - c.len, 0);
+        if (n == 0) {
+            close_connection(c);
+            return;
+        }
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                close_connection(c);
+            }
+            return;
+        }
+        c.len += n;
+
+        // pipelined requests are handled one after the other
+        size_t done = 0;
+        while (done < c.len) {
+            ssize_t used = handle_request(c, std::string_view(c.buf + done, c.len - done));
+            if (used < 0) {
+                close_connection(c);
+                return;
+            }
+            if (used == 0) {
+                break;
+            }
+            done += used;
+        }
+        if (done > 0) {
+            memmove(c.buf, c.buf + done, c.len - done);
+            c.len -= done;
+        }
+        if (c.len == sizeof(c.buf)) {
+            reply(c, "413 Payload Too Large", false);
+            close_connection(c);
+            return;
+        }
+    }
+}
+
+ssize_t Collector::handle_request(Connection& c, std::string_view data) {
+    size_t header_end = data.find("\r\n\r\n");
+    if (header_end == std::string_view::npos) {
+        return 0;
+    }
+    std::string_view head = data.substr(0, header_end);
+
+    size_t eol = head.find("\r\n");
+    std::string_view request_line = head.substr(0, eol);
+    bool keep_alive = request_line.substr(request_line.rfind(' ') + 1) != "HTTP/1.0";
+    size_t content_length = 0;
+    bool binary = false;
+
+    while (eol != std::string_view::npos) {
+        head = head.substr(eol + 2);
+        eol = head.find("\r\n");
+        std::string_view line = head.substr(0, eol);
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos) {
+            continue;
+        }
+        std::string_view name = line.substr(0, colon);
+        std::string_view value = line.substr(colon + 1);
+        while (!value.empty() && value.front() == ' ') {
+            value.remove_prefix(1);
+        }
+        if (iequals(name, "Content-Length")) {
+            if (!parse_number(value, content_length)) {
+                reply(c, "400 Bad Request", false);
+                return -1;
+            }
+        } else if (iequals(name, "Content-Type")) {
+            binary = iequals(value, TELEMETRY_CONTENT_TYPE);
+        } else if (iequals(name, "Connection")) {
+            keep_alive = iequals(value, "keep-alive") || (keep_alive && !iequals(value, "close"));
+        }
+    }
+
+    size_t body_start = header_end + 4;
+    if (body_start + content_length > sizeof(c.buf)) {
+        reply(c, "413 Payload Too Large", false);
+        return -1;
+    }
+    if (data.size() < body_start + content_length) {
+        return 0;
+    }
+
+    if (request_line.substr(0, 5) != "POST ") {
+        reply(c, "405 Method Not Allowed", keep_alive);
+        return keep_alive ? body_start + content_length : -1;
+    }
+
+    std::string_view body = data.substr(body_start, content_length);
+    int accepted = binary ? add_frame(body) : 0;
+    while (!binary && !body.empty()) {
+        size_t nl = body.find('\n');
+        std::string_view line = body.substr(0, nl);
+        body = nl == std::string_view::npos ? std::string_view() : body.substr(nl + 1);
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        Reading r;
+        if (!line.empty() && parse_reading(line, now_, r)) {
+            add(r);
+            accepted++;
+        }
+    }
+
+    reply(c, accepted ? "200 OK" : "400 Bad Request", keep_alive);
+    return keep_alive ? body_start + content_length : -1;
+}
+
+void Collector::reply(Connection& c, const char* status, bool keep_alive) {
+    char res[128];
+    int len = snprintf(res, sizeof(res), "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: %s\r\n\r\n",
+            status, keep_alive ? "keep-alive" : "close");
+    // a few bytes on a fresh socket: the send buffer has room
+    send(c.fd, res, len, MSG_NOSIGNAL);
+}
+
+void Collector::close_connection(Connection& c) {
+    epoll_ctl(ep_, EPOLL_CTL_DEL, c.fd, nullptr);
+    close(c.fd);
+    c.fd = -1;
+    c.len = 0;
+}
+
+void Collector::add(const Reading& r) {
+    readings_.push_back(r);
+    if (readings_.size() == opt_.batch) {
+        flush();
+    }
+}
+
+int Collector::add_frame(std::string_view frame) {
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(frame.data());
+    int count = telemetry_frame_count(data, frame.size());
+    if (count <= 0) {
+        return 0;
+    }
+    for (int i = 0; i < count; i++) {
+        telemetry_record_t rec;
+        if (!telemetry_decode_record(telemetry_frame_record(data, i), &rec)) {
+            continue;
+        }
+        /* Replayed readings come back with older numbers and times. A
+         * lower number on a newer reading, or far lower, is a counter
+         * started again (flash erased, older firmware): counted from there. */
+        auto last = last_seq_.find(rec.sensor);
+        if (last == last_seq_.end()) {
+            last_seq_[rec.sensor] = { rec.seq, rec.timestamp };
+        } else if (rec.seq > last->second.seq) {
+            if (rec.seq > last->second.seq + 1) {
+                std::cerr << "Source " << rec.sensor << ": " << rec.seq - last->second.seq - 1
+                    << " readings missing before " << rec.seq << std::endl;
+            }
+            last->second = { rec.seq, rec.timestamp };
+        } else if (rec.seq + SEQ_REPLAY_MAX < last->second.seq
+                || (rec.seq < last->second.seq && last->second.timestamp && rec.timestamp > last->second.timestamp)) {
+            std::cerr << "Source " << rec.sensor << ": sequence restarted at " << rec.seq
+                << " after " << last->second.seq << std::endl;
+            last->second = { rec.seq, rec.timestamp };
+        }
+
+        Reading r;
+        r.time = rec.timestamp ? rec.timestamp : now_;
+        r.source = rec.sensor;
+        r.temp = telemetry_temp(&rec);
+        r.hum = telemetry_hum(&rec);
+        r.press = telemetry_press(&rec);
+        add(r);
+    }
+    return count;
+}
+
+void Collector::on_datagrams() {
+    uint8_t buf[1500];
+    while (1) {
+        sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        ssize_t len = recvfrom(udp_fd_, buf, sizeof(buf), 0, (sockaddr *)&from, &from_len);
+        if (len < 0) {
+            return;
+        }
+        std::string_view frame(reinterpret_cast<char*>(buf), len);
+        int count = add_frame(frame);
+        telemetry_record_t last;
+        if (count > 0 && telemetry_decode_record(telemetry_frame_record(buf, count - 1), &last)) {
+            uint8_t ack[TELEMETRY_ACK_SIZE];
+            telemetry_encode_ack(last.sensor, last.seq, ack);
+            sendto(udp_fd_, ack, sizeof(ack), 0, (sockaddr *)&from, from_len);
+        }
+    }
+}
+
+void Collector::flush() {
+    if (readings_.empty()) {
+        return;
+    }
+    if (store_) {
+        for (const Reading& r : readings_) {
+            store_->append(r.source, tsdb::Point { r.time, { r.temp, r.press, r.hum } });
+        }
+        store_->sync();
+    }
+    if (out_fd_ == -1) {
+        readings_.clear();
+        return;
+    }
+
+    size_t len = 0;
+    for (const Reading& r : readings_) {
+        while (1) {
+            size_t left = out_buf_.size() - len;
+            int n = snprintf(out_buf_.data() + len, left, "%lld,%d,%.2f,%.2f,%.2f\n",
+                    static_cast<long long>(r.time), r.source, r.temp, r.hum, r.press);
+            if (n < 0) {
+                break;
+            }
+            if (static_cast<size_t>(n) < left) {
+                len += n;
+                break;
+            }
+            // the line did not fit: write what is there, or make room for a line that long
+            if (len > 0) {
+                write_out(len);
+                len = 0;
+            } else {
+                out_buf_.resize(n + 1);
+            }
+        }
+    }
+    write_out(len);
+    readings_.clear();
+}
+
+void Collector::write_out(size_t len) {
+    size_t written = 0;
+    while (written < len) {
+        ssize_t n = write(out_fd_, out_buf_.data() + written, len - written);
+        if (n <= 0) {
+            perror("Error writing readings");
+            break;
+        }
+        written += n;
+    }
+}
+
+void usage(const char* prog) {
+    std::cout << "Usage: " << prog << " [--port PORT] [--udp-port PORT] [--out FILE] [--store DIR] [--batch N] [--flush-ms MS]" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  --port PORT     TCP port to listen on (default " << PORT << ")" << std::endl;
+    std::cout << "  --udp-port PORT UDP port for binary telemetry frames (disabled by default)" << std::endl;
+    std::cout << "  --out FILE      CSV file the readings are appended to (default stdout)" << std::endl;
+    std::cout << "                  time,source,temp,hum,press" << std::endl;
+    std::cout << "  --store DIR     Store the readings in DIR, see tsquery (no CSV unless --out is given)" << std::endl;
+    std::cout << "  --batch N       Readings written per write (default 4096)" << std::endl;
+    std::cout << "  --flush-ms MS   Maximum time a reading waits to be written (default 1000)" << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    Options opt;
+    for (int i = 1; i < argc; i++) {
+        std::string_view arg = argv[i];
+        if (arg == "--port" && i + 1 < argc) {
+            opt.port = atoi(argv[++i]);
+        } else if (arg == "--out" && i + 1 < argc) {
+            opt.out = argv[++i];
+        } else if (arg == "--udp-port" && i + 1 < argc) {
+            opt.udp_port = atoi(argv[++i]);
+        } else if (arg == "--store" && i + 1 < argc) {
+            opt.store = argv[++i];
+        } else if (arg == "--batch" && i + 1 < argc) {
+            opt.batch = std::max(1, atoi(argv[++i]));
+        } else if (arg == "--flush-ms" && i + 1 < argc) {
+            opt.flush_ms = std::max(1, atoi(argv[++i]));
+        } else {
+            usage(argv[0]);
+            return arg == "-h" || arg == "--help" ? 0 : 1;
+        }
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    Collector collector(opt);
+    return collector.run();
+}
@@ -0,0 +1,57 @@
+#ifndef FREERTOS_CONFIG_H
+#define FREERTOS_CONFIG_H
+
+/* Kernel configuration of the host build (GCC/POSIX port). Close to the
+ * ESP-IDF one where the firmware depends on it: 1 ms ticks would hide the
+ * 10 ms tick of the ESP32, so the tick stays at 100 Hz.
+ */
+
+#define configUSE_PREEMPTION 1
+#define configUSE_PORT_OPTIMISED_TASK_SELECTION 0
+#define configUSE_IDLE_HOOK 0
+#define configUSE_TICK_HOOK 0
+#define configUSE_DAEMON_TASK_STARTUP_HOOK 0
+#define configTICK_RATE_HZ ((TickType_t)100)
+// in words; the POSIX port wants at least PTHREAD_STACK_MIN bytes per task
+#define configMINIMAL_STACK_SIZE ((unsigned short)4096)
+#define configTOTAL_HEAP_SIZE ((size_t)(256 * 1024))
+#define configMAX_TASK_NAME_LEN 16
+#define configUSE_TRACE_FACILITY 1
+#define configUSE_16_BIT_TICKS 0
+#define configIDLE_SHOULD_YIELD 1
+#define configUSE_MUTEXES 1
+#define configUSE_RECURSIVE_MUTEXES 1
+#define configUSE_COUNTING_SEMAPHORES 1
+#define configUSE_TASK_NOTIFICATIONS 1
+#define configQUEUE_REGISTRY_SIZE 8
+#define configCHECK_FOR_STACK_OVERFLOW 0
+#define configUSE_MALLOC_FAILED_HOOK 0
+#define configUSE_APPLICATION_TASK_TAG 0
+#define configGENERATE_RUN_TIME_STATS 0
+#define configSUPPORT_DYNAMIC_ALLOCATION 1
+#define configSUPPORT_STATIC_ALLOCATION 1
+#define configKERNEL_PROVIDED_STATIC_MEMORY 1
+#define configMAX_PRIORITIES 25
+#define configUSE_CO_ROUTINES 0
+
+#define configUSE_TIMERS 1
+#define configTIMER_TASK_PRIORITY (configMAX_PRIORITIES - 1)
+#define configTIMER_QUEUE_LENGTH 20
+#define configTIMER_TASK_STACK_DEPTH (configMINIMAL_STACK_SIZE * 2)
+
+#define INCLUDE_vTaskPrioritySet 1
+#define INCLUDE_uxTaskPriorityGet 1
+#define INCLUDE_vTaskDelete 1
+#define INCLUDE_vTaskSuspend 1
+#define INCLUDE_vTaskDelayUntil 1
+#define INCLUDE_xTaskDelayUntil 1
+#define INCLUDE_vTaskDelay 1
+#define INCLUDE_xTaskGetCurrentTaskHandle 1
+#define INCLUDE_xTaskGetSchedulerState 1
+#define INCLUDE_uxTaskGetStackHighWaterMark 1
+#define INCLUDE_xTimerPendFunctionCall 1
+
+#define configASSERT(x) if ((x) == 0) vAssertCalled(__FILE__, __LINE__)
+void vAssertCalled(const char* file, unsigned long line);
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef BMX280_H
+#define BMX280_H
+#include <stdbool.h>
+#include "esp_err.h"
+#include "driver/i2c.h"
+
+/* esp-idf-bmx280 API, backed by a simulated BME280: the temperature,
+ * pressure and humidity follow a slow daily cycle plus some noise.
+ * Oversampling and IIR settings only change the conversion time.
+ */
+
+typedef struct bmx280_t bmx280_t;
+
+typedef enum bmx280_tsmpl_t {
+    BMX280_TEMPERATURE_OVERSAMPLING_NONE = 0x0,
+    BMX280_TEMPERATURE_OVERSAMPLING_X1,
+    BMX280_TEMPERATURE_OVERSAMPLING_X2,
+    BMX280_TEMPERATURE_OVERSAMPLING_X4,
+    BMX280_TEMPERATURE_OVERSAMPLING_X8,
+    BMX280_TEMPERATURE_OVERSAMPLING_X16,
+} bmx280_tsmpl_t;
+
+typedef enum bmx280_psmpl_t {
+    BMX280_PRESSURE_OVERSAMPLING_NONE = 0x0,
+    BMX280_PRESSURE_OVERSAMPLING_X1,
+    BMX280_PRESSURE_OVERSAMPLING_X2,
+    BMX280_PRESSURE_OVERSAMPLING_X4,
+    BMX280_PRESSURE_OVERSAMPLING_X8,
+    BMX280_PRESSURE_OVERSAMPLING_X16,
+} bmx280_psmpl_t;
+
+typedef enum bmx280_hsmpl_t {
+    BMX280_HUMIDITY_OVERSAMPLING_NONE = 0x0,
+    BMX280_HUMIDITY_OVERSAMPLING_X1,
+    BMX280_HUMIDITY_OVERSAMPLING_X2,
+    BMX280_HUMIDITY_OVERSAMPLING_X4,
+    BMX280_HUMIDITY_OVERSAMPLING_X8,
+    BMX280_HUMIDITY_OVERSAMPLING_X16,
+} bmx280_hsmpl_t;
+
+typedef enum bmx280_tstby_t {
+    BMX280_STANDBY_0M5 = 0x0,
+    BMX280_STANDBY_62M5,
+    BMX280_STANDBY_125M,
+    BMX280_STANDBY_250M,
+    BMX280_STANDBY_500M,
+    BMX280_STANDBY_1000M,
+    BMX280_STANDBY_10M,
+    BMX280_STANDBY_20M,
+} bmx280_tstby_t;
+
+typedef enum bmx280_iirf_t {
+    BMX280_IIR_NONE = 0x0,
+    BMX280_IIR_X1,
+    BMX280_IIR_X2,
+    BMX280_IIR_X4,
+    BMX280_IIR_X8,
+    BMX280_IIR_X16,
+} bmx280_iirf_t;
+
+typedef enum bmx280_mode_t {
+    BMX280_MODE_SLEEP = 0,
+    BMX280_MODE_FORCE = 1,
+    BMX280_MODE_CYCLE = 3,
+} bmx280_mode_t;
+
+typedef struct bmx280_config_t {
+    bmx280_tsmpl_t t_sampling;
+    bmx280_psmpl_t p_sampling;
+    bmx280_tstby_t t_standby;
+    bmx280_iirf_t iir_filter;
+    bmx280_hsmpl_t h_sampling;
+} bmx280_config_t;
+
+#define BMX280_DEFAULT_CONFIG ((bmx280_config_t) { \
+        BMX280_TEMPERATURE_OVERSAMPLING_X2, BMX280_PRESSURE_OVERSAMPLING_X16, \
+        BMX280_STANDBY_0M5, BMX280_IIR_X16, BMX280_HUMIDITY_OVERSAMPLING_X1 })
+
+bmx280_t* bmx280_create(i2c_port_t port);
+void bmx280_close(bmx280_t* bmx280);
+esp_err_t bmx280_init(bmx280_t* bmx280);
+esp_err_t bmx280_configure(bmx280_t* bmx280, bmx280_config_t* cfg);
+esp_err_t bmx280_setMode(bmx280_t* bmx280, bmx280_mode_t mode);
+esp_err_t bmx280_getMode(bmx280_t* bmx280, bmx280_mode_t* mode);
+bool bmx280_isSampling(bmx280_t* bmx280);
+esp_err_t bmx280_readoutFloat(bmx280_t* bmx280, float* temperature, float* pressure, float* humidity);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef DRIVER_I2C_H
+#define DRIVER_I2C_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "driver/gpio.h"
+
+/* Only what bmx280.h needs: the bus is not emulated */
+
+typedef enum {
+    I2C_NUM_0,
+    I2C_NUM_1,
+    I2C_NUM_MAX
+} i2c_port_t;
+
+typedef enum {
+    I2C_MODE_SLAVE,
+    I2C_MODE_MASTER,
+} i2c_mode_t;
+
+typedef struct {
+    i2c_mode_t mode;
+    int sda_io_num;
+    int scl_io_num;
+    bool sda_pullup_en;
+    bool scl_pullup_en;
+    union {
+        struct {
+            uint32_t clk_speed;
+        } master;
+    };
+    uint32_t clk_flags;
+} i2c_config_t;
+
+esp_err_t i2c_param_config(i2c_port_t i2c_num, const i2c_config_t* i2c_conf);
+esp_err_t i2c_driver_install(i2c_port_t i2c_num, i2c_mode_t mode, size_t slv_rx_buf_len,
+        size_t slv_tx_buf_len, int intr_alloc_flags);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef ESP_APP_DESC_H
+#define ESP_APP_DESC_H
+#include <stdint.h>
+
+typedef struct {
+    char version[32];
+    char project_name[32];
+    char time[16];
+    char date[16];
+    char idf_ver[32];
+} esp_app_desc_t;
+
+// the version is HOST_APP_VERSION, from git describe as in ESP-IDF
+const esp_app_desc_t* esp_app_get_description(void);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef ESP_ATTR_H
+#define ESP_ATTR_H
+
+/* RTC memory of the host build: a section of its own, saved to a file by
+ * esp_deep_sleep_start() and loaded back at the timer wakeup (see sleep.c).
+ */
+#define RTC_DATA_ATTR __attribute__((section("rtc_data")))
+#define RTC_NOINIT_ATTR __attribute__((section("rtc_data")))
+
+#endif
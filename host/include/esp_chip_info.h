@@ -0,0 +1,3 @@
+#ifndef ESP_CHIP_INFO_H
+#define ESP_CHIP_INFO_H
+#endif
@@ -0,0 +1,3 @@
+#ifndef ESP_FLASH_H
+#define ESP_FLASH_H
+#endif
@@ -0,0 +1,32 @@
+#ifndef ESP_HEAP_TRACE_H
+#define ESP_HEAP_TRACE_H
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/* Standalone heap tracing of the host build. The firmware is linked with
+ * --wrap=malloc,calloc,realloc, so the calls made by the firmware, the
+ * stand-ins and the kernel are recorded, not those made inside the C library.
+ */
+
+typedef enum {
+    HEAP_TRACE_ALL,
+    HEAP_TRACE_LEAKS,
+} heap_trace_mode_t;
+
+typedef struct {
+    uint32_t ccount;
+    void* address;
+    size_t size;
+    void* alloced_by[1];
+} heap_trace_record_t;
+
+esp_err_t heap_trace_init_standalone(heap_trace_record_t* record_buffer, size_t num_records);
+// HEAP_TRACE_LEAKS is traced as HEAP_TRACE_ALL: the frees are not tracked
+esp_err_t heap_trace_start(heap_trace_mode_t mode);
+esp_err_t heap_trace_stop(void);
+// allocations recorded, at most num_records
+size_t heap_trace_get_count(void);
+void heap_trace_dump(void);
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef ESP_HTTP_CLIENT_H
+#define ESP_HTTP_CLIENT_H
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/* HTTP/1.1 client of the host build, on BSD sockets: plain http only,
+ * the connection is kept open between two requests as with ESP-IDF.
+ */
+
+typedef struct esp_http_client* esp_http_client_handle_t;
+
+typedef enum {
+    HTTP_EVENT_ERROR = 0,
+    HTTP_EVENT_ON_CONNECTED,
+    HTTP_EVENT_HEADERS_SENT,
+    HTTP_EVENT_HEADER_SENT = HTTP_EVENT_HEADERS_SENT,
+    HTTP_EVENT_ON_HEADER,
+    HTTP_EVENT_ON_DATA,
+    HTTP_EVENT_ON_FINISH,
+    HTTP_EVENT_DISCONNECTED,
+    HTTP_EVENT_REDIRECT,
+} esp_http_client_event_id_t;
+
+typedef struct esp_http_client_event {
+    esp_http_client_event_id_t event_id;
+    esp_http_client_handle_t client;
+    void* data;
+    int data_len;
+    void* user_data;
+    char* header_key;
+    char* header_value;
+} esp_http_client_event_t;
+
+typedef esp_err_t (*http_event_handle_cb)(esp_http_client_event_t* evt);
+
+typedef enum {
+    HTTP_METHOD_GET = 0,
+    HTTP_METHOD_POST,
+    HTTP_METHOD_PUT,
+} esp_http_client_method_t;
+
+typedef struct {
+    const char* url;
+    const char* host;
+    int port;
+    const char* path;
+    esp_http_client_method_t method;
+    int timeout_ms;
+    http_event_handle_cb event_handler;
+    int buffer_size;
+    int buffer_size_tx;
+    void* user_data;
+    bool keep_alive_enable;
+} esp_http_client_config_t;
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t* config);
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client);
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char* url);
+esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t client, const char* data, int len);
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char* key, const char* value);
+esp_err_t esp_http_client_set_method(esp_http_client_handle_t client, esp_http_client_method_t method);
+int esp_http_client_get_status_code(esp_http_client_handle_t client);
+int64_t esp_http_client_get_content_length(esp_http_client_handle_t client);
+bool esp_http_client_is_chunked_response(esp_http_client_handle_t client);
+esp_err_t esp_http_client_close(esp_http_client_handle_t client);
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client);
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+#include <stdint.h>
+#include <inttypes.h>
+#include "esp_err.h"
+
+/* Same line format as ESP-IDF, on stdout */
+void host_log(char level, const char* tag, const char* format, ...) __attribute__((format(printf, 3, 4)));
+
+#define ESP_LOGE(tag, format, ...) host_log('E', tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) host_log('W', tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) host_log('I', tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) host_log('D', tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) host_log('V', tag, format, ##__VA_ARGS__)
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef ESP_MAC_H
+#define ESP_MAC_H
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef enum {
+    ESP_MAC_WIFI_STA,
+    ESP_MAC_WIFI_SOFTAP,
+    ESP_MAC_BT,
+    ESP_MAC_ETH,
+} esp_mac_type_t;
+
+#define MAC2STR(a) (a)[0], (a)[1], (a)[2], (a)[3], (a)[4], (a)[5]
+#define MACSTR "%02x:%02x:%02x:%02x:%02x:%02x"
+
+/* Locally administered address 02:42:00:00 followed by CONFIG_BME_ID,
+ * plus type as the derived addresses of the chip. */
+esp_err_t esp_read_mac(uint8_t* mac, esp_mac_type_t type);
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef ESP_NETIF_H
+#define ESP_NETIF_H
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef struct esp_netif_obj esp_netif_t;
+
+typedef struct {
+    uint32_t addr;
+} esp_ip4_addr_t;
+
+typedef struct {
+    esp_ip4_addr_t ip;
+    esp_ip4_addr_t netmask;
+    esp_ip4_addr_t gw;
+} esp_netif_ip_info_t;
+
+typedef enum {
+    ESP_IPADDR_TYPE_V4 = 0,
+    ESP_IPADDR_TYPE_V6 = 6,
+} esp_ip_addr_type_t;
+
+typedef struct {
+    union {
+        esp_ip4_addr_t ip4;
+    } u_addr;
+    uint8_t type;
+} esp_ip_addr_t;
+
+typedef struct {
+    esp_ip_addr_t ip;
+} esp_netif_dns_info_t;
+
+typedef enum {
+    ESP_NETIF_DNS_MAIN = 0,
+    ESP_NETIF_DNS_BACKUP,
+    ESP_NETIF_DNS_FALLBACK,
+} esp_netif_dns_type_t;
+
+typedef struct {
+    int if_index;
+    esp_netif_t* esp_netif;
+    esp_netif_ip_info_t ip_info;
+    bool ip_changed;
+} ip_event_got_ip_t;
+
+typedef enum {
+    IP_EVENT_STA_GOT_IP,
+    IP_EVENT_STA_LOST_IP,
+} ip_event_t;
+
+// addr is in network order
+#define esp_ip4_addr_get_byte(ipaddr, idx) (((const uint8_t*)(&(ipaddr)->addr))[idx])
+#define IP2STR(ipaddr) esp_ip4_addr_get_byte(ipaddr, 0), esp_ip4_addr_get_byte(ipaddr, 1), \
+        esp_ip4_addr_get_byte(ipaddr, 2), esp_ip4_addr_get_byte(ipaddr, 3)
+#define IPSTR "%d.%d.%d.%d"
+
+esp_err_t esp_netif_init(void);
+esp_netif_t* esp_netif_create_default_wifi_sta(void);
+// in network order, 0 if invalid
+uint32_t esp_ip4addr_aton(const char* addr);
+/* A static address replaces the one of BME_HOST_IP (see esp_wifi.h).
+ * The DNS server is not used: the host resolver is. */
+esp_err_t esp_netif_dhcpc_stop(esp_netif_t* netif);
+esp_err_t esp_netif_set_ip_info(esp_netif_t* netif, const esp_netif_ip_info_t* ip_info);
+esp_err_t esp_netif_set_dns_info(esp_netif_t* netif, esp_netif_dns_type_t type, esp_netif_dns_info_t* dns);
+
+#endif
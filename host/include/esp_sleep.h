@@ -0,0 +1,19 @@
+#ifndef ESP_SLEEP_H
+#define ESP_SLEEP_H
+#include <stdint.h>
+#include "esp_err.h"
+
+/* Deep sleep of the host build: the process sleeps, then runs the firmware
+ * again from the start with the RTC memory of esp_attr.h restored.
+ */
+
+typedef enum {
+    ESP_SLEEP_WAKEUP_UNDEFINED = 0,
+    ESP_SLEEP_WAKEUP_TIMER = 4,
+} esp_sleep_wakeup_cause_t;
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us);
+void esp_deep_sleep_start(void) __attribute__((noreturn));
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause(void);
+
+#endif
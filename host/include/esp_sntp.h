@@ -0,0 +1,20 @@
+#ifndef ESP_SNTP_H
+#define ESP_SNTP_H
+#include <stdint.h>
+#include <sys/time.h>
+
+/* The clock of the host is already set: sntp_init() only calls the
+ * notification callback, from a task of its own as the SNTP client would.
+ */
+
+#define SNTP_OPMODE_POLL 0
+
+typedef void (*sntp_sync_time_cb_t)(struct timeval* tv);
+
+void sntp_setoperatingmode(uint8_t operating_mode);
+void sntp_setservername(uint8_t idx, const char* server);
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback);
+void sntp_init(void);
+void sntp_stop(void);
+
+#endif
@@ -0,0 +1,30 @@
+#ifndef ESP_SYSTEM_H
+#define ESP_SYSTEM_H
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_bit_defs.h"
+
+typedef enum {
+    ESP_RST_UNKNOWN,
+    ESP_RST_POWERON,
+    ESP_RST_EXT,
+    ESP_RST_SW,
+    ESP_RST_PANIC,
+    ESP_RST_INT_WDT,
+    ESP_RST_TASK_WDT,
+    ESP_RST_WDT,
+    ESP_RST_DEEPSLEEP,
+    ESP_RST_BROWNOUT,
+    ESP_RST_SDIO,
+} esp_reset_reason_t;
+
+// runs the firmware again from the start, keeping the NVS and flash files
+void esp_restart(void) __attribute__((noreturn));
+// malloc arena of the process (mallinfo2)
+uint32_t esp_get_free_heap_size(void);
+// lowest esp_get_free_heap_size() returned so far
+uint32_t esp_get_minimum_free_heap_size(void);
+// ESP_RST_SW after esp_restart(), ESP_RST_DEEPSLEEP after a deep sleep
+esp_reset_reason_t esp_reset_reason(void);
+
+#endif
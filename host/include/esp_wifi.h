@@ -0,0 +1,97 @@
+#ifndef ESP_WIFI_H
+#define ESP_WIFI_H
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+
+/* Wi-Fi of the host build: the station is always connected, to the
+ * network of the host, and its address is 127.0.0.1 unless BME_HOST_IP
+ * gives another. Each step posts its events as the driver would.
+ * The AP is HOST_AP_BSSID on channel HOST_AP_CHANNEL: a connection to
+ * another BSSID or channel fails, as when the AP of the cache is gone.
+ */
+
+#define HOST_AP_BSSID { 0x02, 0x00, 0x5e, 0x10, 0x00, 0x01 }
+#define HOST_AP_CHANNEL 6
+
+typedef enum {
+    WIFI_MODE_NULL = 0,
+    WIFI_MODE_STA,
+    WIFI_MODE_AP,
+    WIFI_MODE_APSTA,
+} wifi_mode_t;
+
+typedef enum {
+    WIFI_IF_STA = 0,
+    WIFI_IF_AP,
+} wifi_interface_t;
+#define ESP_IF_WIFI_STA WIFI_IF_STA
+
+typedef enum {
+    WIFI_AUTH_OPEN = 0,
+    WIFI_AUTH_WEP,
+    WIFI_AUTH_WPA_PSK,
+    WIFI_AUTH_WPA2_PSK,
+    WIFI_AUTH_WPA_WPA2_PSK,
+    WIFI_AUTH_WPA3_PSK = 6,
+} wifi_auth_mode_t;
+
+typedef enum {
+    WIFI_EVENT_STA_START = 2,
+    WIFI_EVENT_STA_STOP,
+    WIFI_EVENT_STA_CONNECTED,
+    WIFI_EVENT_STA_DISCONNECTED,
+} wifi_event_t;
+
+typedef struct {
+    int8_t rssi;
+    wifi_auth_mode_t authmode;
+} wifi_scan_threshold_t;
+
+typedef struct {
+    bool capable;
+    bool required;
+} wifi_pmf_config_t;
+
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t password[64];
+    bool bssid_set;
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint16_t listen_interval;
+    wifi_scan_threshold_t threshold;
+    wifi_pmf_config_t pmf_cfg;
+    uint8_t failure_retry_cnt;
+} wifi_sta_config_t;
+
+typedef union {
+    wifi_sta_config_t sta;
+} wifi_config_t;
+
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t ssid_len;
+    uint8_t bssid[6];
+    uint8_t channel;
+    wifi_auth_mode_t authmode;
+    uint16_t aid;
+} wifi_event_sta_connected_t;
+
+typedef struct {
+    int magic;
+} wifi_init_config_t;
+#define WIFI_INIT_CONFIG_DEFAULT() { .magic = 0x1F2F3F4F }
+
+esp_err_t esp_wifi_init(const wifi_init_config_t* config);
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode);
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t* conf);
+esp_err_t esp_wifi_get_config(wifi_interface_t interface, wifi_config_t* conf);
+esp_err_t esp_wifi_start(void);
+esp_err_t esp_wifi_stop(void);
+esp_err_t esp_wifi_connect(void);
+esp_err_t esp_wifi_disconnect(void);
+
+#endif
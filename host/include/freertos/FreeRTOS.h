@@ -0,0 +1,30 @@
+#ifndef HOST_FREERTOS_H
+#define HOST_FREERTOS_H
+
+/* ESP-IDF includes the kernel headers as "freertos/xxx.h" and adds a few
+ * SMP macros; this maps them onto the vanilla kernel and its POSIX port.
+ */
+#include <FreeRTOS.h>
+#include "sdkconfig.h"
+#include "esp_bit_defs.h"
+
+// one lock for every critical section: the POSIX port runs one task at a time
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#undef portENTER_CRITICAL
+#undef portEXIT_CRITICAL
+static inline void host_enter_critical(portMUX_TYPE* mux) {
+    (void)mux;
+    vPortEnterCritical();
+}
+static inline void host_exit_critical(portMUX_TYPE* mux) {
+    (void)mux;
+    vPortExitCritical();
+}
+#define portENTER_CRITICAL(mux) host_enter_critical(mux)
+#define portEXIT_CRITICAL(mux) host_exit_critical(mux)
+#define portENTER_CRITICAL_ISR(mux) host_enter_critical(mux)
+#define portEXIT_CRITICAL_ISR(mux) host_exit_critical(mux)
+#define tskNO_AFFINITY 0x7FFFFFFF
+
+#endif
@@ -0,0 +1,5 @@
+#ifndef HOST_FREERTOS_QUEUE_H
+#define HOST_FREERTOS_QUEUE_H
+#include "freertos/FreeRTOS.h"
+#include <queue.h>
+#endif
@@ -0,0 +1,5 @@
+#ifndef HOST_FREERTOS_SEMPHR_H
+#define HOST_FREERTOS_SEMPHR_H
+#include "freertos/FreeRTOS.h"
+#include <semphr.h>
+#endif
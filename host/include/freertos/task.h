@@ -0,0 +1,5 @@
+#ifndef HOST_FREERTOS_TASK_H
+#define HOST_FREERTOS_TASK_H
+#include "freertos/FreeRTOS.h"
+#include <task.h>
+#endif
@@ -0,0 +1,5 @@
+#ifndef HOST_FREERTOS_TIMERS_H
+#define HOST_FREERTOS_TIMERS_H
+#include "freertos/FreeRTOS.h"
+#include <timers.h>
+#endif
@@ -0,0 +1,3 @@
+#ifndef LWIP_ERR_H
+#define LWIP_ERR_H
+#endif
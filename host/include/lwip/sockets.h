@@ -0,0 +1,29 @@
+#ifndef LWIP_SOCKETS_H
+#define LWIP_SOCKETS_H
+
+/* The sockets of the host build are those of the host. A call blocking in
+ * the kernel would stop every task of the POSIX port, so the two blocking
+ * receives of the firmware wait in short steps with vTaskDelay().
+ */
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+typedef uint8_t u8_t;
+
+#define lwip_setsockopt setsockopt
+#define inet_ntoa_r(addr, buf, buflen) inet_ntop(AF_INET, &(addr), (buf), (buflen))
+#define inet6_ntoa_r(addr, buf, buflen) inet_ntop(AF_INET6, &(addr), (buf), (buflen))
+
+ssize_t host_recvfrom(int sock, void* buf, size_t len, int flags, struct sockaddr* from, socklen_t* fromlen);
+ssize_t host_recv(int sock, void* buf, size_t len, int flags);
+
+#define recvfrom(sock, buf, len, flags, from, fromlen) host_recvfrom(sock, buf, len, flags, from, fromlen)
+#define recv(sock, buf, len, flags) host_recv(sock, buf, len, flags)
+
+#endif
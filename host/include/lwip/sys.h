@@ -0,0 +1,3 @@
+#ifndef LWIP_SYS_H
+#define LWIP_SYS_H
+#endif
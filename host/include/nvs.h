@@ -0,0 +1,32 @@
+#ifndef NVS_H
+#define NVS_H
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/* NVS of the host build: one file per key, <BME_HOST_DIR>/nvs/<namespace>.<key>
+ * (BME_HOST_DIR defaults to the current directory). Writes go to the file
+ * at once; nvs_commit() has nothing left to do.
+ */
+
+typedef uint32_t nvs_handle_t;
+
+typedef enum {
+    NVS_READONLY,
+    NVS_READWRITE
+} nvs_open_mode_t;
+
+esp_err_t nvs_open(const char* name, nvs_open_mode_t open_mode, nvs_handle_t* out_handle);
+void nvs_close(nvs_handle_t handle);
+esp_err_t nvs_commit(nvs_handle_t handle);
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key);
+esp_err_t nvs_get_str(nvs_handle_t handle, const char* key, char* out_value, size_t* length);
+esp_err_t nvs_set_str(nvs_handle_t handle, const char* key, const char* value);
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, size_t* length);
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length);
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char* key, uint8_t* out_value);
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char* key, uint8_t value);
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char* key, uint32_t* out_value);
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char* key, uint32_t value);
+
+#endif
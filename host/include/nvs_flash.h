@@ -0,0 +1,10 @@
+#ifndef NVS_FLASH_H
+#define NVS_FLASH_H
+#include "esp_err.h"
+#include "nvs.h"
+
+esp_err_t nvs_flash_init(void);
+// removes every key file
+esp_err_t nvs_flash_erase(void);
+
+#endif
@@ -0,0 +1,3 @@
+#ifndef ETS_SYS_H
+#define ETS_SYS_H
+#endif
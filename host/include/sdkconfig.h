@@ -0,0 +1,84 @@
+#ifndef SDKCONFIG_H
+#define SDKCONFIG_H
+
+/* Defaults of main/Kconfig.projbuild for the host build. Each one can be
+ * changed from the command line, e.g.
+ *   cmake -DCMAKE_C_FLAGS="-DCONFIG_BME_SAMPLE_PERIOD=10" ...
+ * Bool options are defined to 1 when set, as in the ESP-IDF sdkconfig.h.
+ */
+
+#ifndef CONFIG_ESP_WIFI_SSID
+#define CONFIG_ESP_WIFI_SSID "myssid"
+#endif
+#ifndef CONFIG_ESP_WIFI_PASSWORD
+#define CONFIG_ESP_WIFI_PASSWORD "mypassword"
+#endif
+#ifndef CONFIG_ESP_MAXIMUM_RETRY
+#define CONFIG_ESP_MAXIMUM_RETRY 5
+#endif
+#if defined(CONFIG_BME_STATIC_IP)
+#ifndef CONFIG_BME_STATIC_IP_ADDR
+#define CONFIG_BME_STATIC_IP_ADDR "127.0.0.1"
+#endif
+#ifndef CONFIG_BME_STATIC_NETMASK
+#define CONFIG_BME_STATIC_NETMASK "255.0.0.0"
+#endif
+#ifndef CONFIG_BME_STATIC_GW
+#define CONFIG_BME_STATIC_GW "127.0.0.1"
+#endif
+#ifndef CONFIG_BME_STATIC_DNS
+#define CONFIG_BME_STATIC_DNS "127.0.0.1"
+#endif
+#endif
+#ifndef CONFIG_BME_ID
+#define CONFIG_BME_ID 1
+#endif
+#ifndef CONFIG_BME_TZ
+#define CONFIG_BME_TZ "CET-1CEST,M3.5.0,M10.5.0/3"
+#endif
+#ifndef CONFIG_BME_SAMPLE_PERIOD
+#define CONFIG_BME_SAMPLE_PERIOD 600
+#endif
+#if defined(CONFIG_BME_HEAP_TRACE) && !defined(CONFIG_BME_HEAP_TRACE_CYCLES)
+#define CONFIG_BME_HEAP_TRACE_CYCLES 2000
+#endif
+#ifndef CONFIG_BME_CONVERSIONS
+#define CONFIG_BME_CONVERSIONS 1
+#endif
+#ifndef CONFIG_BME_TEMP_OVERSAMPLING
+#define CONFIG_BME_TEMP_OVERSAMPLING 2
+#endif
+#ifndef CONFIG_BME_PRESS_OVERSAMPLING
+#define CONFIG_BME_PRESS_OVERSAMPLING 5
+#endif
+#ifndef CONFIG_BME_HUM_OVERSAMPLING
+#define CONFIG_BME_HUM_OVERSAMPLING 1
+#endif
+#ifndef CONFIG_BME_IIR_FILTER
+#define CONFIG_BME_IIR_FILTER 0
+#endif
+#ifndef CONFIG_UPLOAD_BATCH_SIZE
+#define CONFIG_UPLOAD_BATCH_SIZE 1
+#endif
+#if defined(CONFIG_TELEMETRY_TRANSPORT_UDP)
+#define CONFIG_TELEMETRY_BINARY 1
+#ifndef CONFIG_TELEMETRY_UDP_PORT
+#define CONFIG_TELEMETRY_UDP_PORT 3334
+#endif
+#if defined(CONFIG_TELEMETRY_UDP_ACK) && !defined(CONFIG_TELEMETRY_UDP_ACK_TIMEOUT_MS)
+#define CONFIG_TELEMETRY_UDP_ACK_TIMEOUT_MS 300
+#endif
+#else
+#define CONFIG_TELEMETRY_TRANSPORT_HTTP 1
+#endif
+#if !defined(CONFIG_EXAMPLE_IPV6)
+#define CONFIG_EXAMPLE_IPV4 1
+#endif
+#ifndef CONFIG_EXAMPLE_PORT
+#define CONFIG_EXAMPLE_PORT 3333
+#endif
+#ifndef CONFIG_BMX280_I2C_CLK_SPEED_HZ
+#define CONFIG_BMX280_I2C_CLK_SPEED_HZ 100000
+#endif
+
+#endif
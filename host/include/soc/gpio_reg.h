@@ -0,0 +1,20 @@
+#ifndef SOC_GPIO_REG_H
+#define SOC_GPIO_REG_H
+#include <stdint.h>
+
+/* The GPIO registers of the first bank, written through the host GPIO */
+
+#define GPIO_OUT_REG 0x3FF44004
+#define GPIO_OUT_W1TS_REG 0x3FF44008
+#define GPIO_OUT_W1TC_REG 0x3FF4400C
+#define GPIO_ENABLE_REG 0x3FF44020
+#define GPIO_ENABLE_W1TS_REG 0x3FF44024
+#define GPIO_ENABLE_W1TC_REG 0x3FF44028
+
+void host_reg_write(uint32_t reg, uint32_t value);
+uint32_t host_reg_read(uint32_t reg);
+
+#define REG_WRITE(reg, value) host_reg_write((reg), (value))
+#define REG_READ(reg) host_reg_read(reg)
+
+#endif
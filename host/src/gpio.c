@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "driver/gpio.h"
+#include "soc/gpio_reg.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define TAG "gpio"
+
+// registers of the pins 0..31, and of the pins 32..39
+static uint32_t s_out[2];
+static uint32_t s_enable[2];
+
+static bool valid(gpio_num_t pin) {
+    return pin >= 0 && pin < GPIO_NUM_MAX;
+}
+
+int host_gpio_output(gpio_num_t pin) {
+    if (!valid(pin)) {
+        return 0;
+    }
+    uint32_t bit = 1u << (pin % 32);
+    return (s_out[pin / 32] & s_enable[pin / 32] & bit) != 0;
+}
+
+static void log_changes(int bank, uint32_t before) {
+    uint32_t after = s_out[bank] & s_enable[bank];
+    uint32_t changed = before ^ after;
+    if (changed == 0) {
+        return;
+    }
+    const char* path = getenv("BME_GPIO_LOG");
+    FILE* f = path != NULL ? fopen(path, "a") : NULL;
+    for (int i = 0; i < 32; i++) {
+        if (changed & (1u << i)) {
+            int level = (after >> i) & 1;
+            ESP_LOGI(TAG, "GPIO%d: %d", bank * 32 + i, level);
+            if (f != NULL) {
+                fprintf(f, "%lld %d %d\n", (long long)esp_timer_get_time(), bank * 32 + i, level);
+            }
+        }
+    }
+    if (f != NULL) {
+        fclose(f);
+    }
+}
+
+static void update(int bank, uint32_t* reg, uint32_t set, uint32_t clear) {
+    uint32_t before = s_out[bank] & s_enable[bank];
+    *reg = (*reg | set) & ~clear;
+    log_changes(bank, before);
+}
+
+esp_err_t gpio_reset_pin(gpio_num_t pin) {
+    if (!valid(pin)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    update(pin / 32, &s_enable[pin / 32], 0, 1u << (pin % 32));
+    update(pin / 32, &s_out[pin / 32], 0, 1u << (pin % 32));
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_direction(gpio_num_t pin, gpio_mode_t mode) {
+    if (!valid(pin)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint32_t bit = 1u << (pin % 32);
+    bool output = mode & GPIO_MODE_OUTPUT;
+    update(pin / 32, &s_enable[pin / 32], output ? bit : 0, output ? 0 : bit);
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t pin, uint32_t level) {
+    if (!valid(pin)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint32_t bit = 1u << (pin % 32);
+    update(pin / 32, &s_out[pin / 32], level ? bit : 0, level ? 0 : bit);
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t pin) {
+    return valid(pin) && (s_out[pin / 32] & (1u << (pin % 32))) != 0;
+}
+
+void esp_rom_gpio_pad_select_gpio(uint32_t pin) {
+}
+
+void host_reg_write(uint32_t reg, uint32_t value) {
+    switch (reg) {
+        case GPIO_OUT_REG: update(0, &s_out[0], value, ~value); break;
+        case GPIO_OUT_W1TS_REG: update(0, &s_out[0], value, 0); break;
+        case GPIO_OUT_W1TC_REG: update(0, &s_out[0], 0, value); break;
+        case GPIO_ENABLE_REG: update(0, &s_enable[0], value, ~value); break;
+        case GPIO_ENABLE_W1TS_REG: update(0, &s_enable[0], value, 0); break;
+        case GPIO_ENABLE_W1TC_REG: update(0, &s_enable[0], 0, value); break;
+        default: ESP_LOGE(TAG, "write to unknown register 0x%08x", (unsigned)reg);
+    }
+}
+
+uint32_t host_reg_read(uint32_t reg) {
+    switch (reg) {
+        case GPIO_OUT_REG: return s_out[0];
+        case GPIO_ENABLE_REG: return s_enable[0];
+        default: return 0;
+    }
+}
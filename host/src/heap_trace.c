@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "esp_heap_trace.h"
+
+/* The linker sends the firmware's calls of malloc() to __wrap_malloc(),
+ * and __real_malloc() to the C library. */
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* p, size_t size);
+
+static heap_trace_record_t* s_records = NULL;
+static size_t s_size = 0;
+static atomic_size_t s_count;
+static atomic_bool s_tracing;
+
+static void record(void* address, size_t size, void* caller) {
+    if (!atomic_load(&s_tracing)) {
+        return;
+    }
+    size_t i = atomic_fetch_add(&s_count, 1);
+    if (i < s_size) {
+        s_records[i] = (heap_trace_record_t) { (uint32_t)i, address, size, { caller } };
+    }
+}
+
+void* __wrap_malloc(size_t size) {
+    void* p = __real_malloc(size);
+    record(p, size, __builtin_return_address(0));
+    return p;
+}
+
+void* __wrap_calloc(size_t n, size_t size) {
+    void* p = __real_calloc(n, size);
+    record(p, n * size, __builtin_return_address(0));
+    return p;
+}
+
+void* __wrap_realloc(void* old, size_t size) {
+    void* p = __real_realloc(old, size);
+    record(p, size, __builtin_return_address(0));
+    return p;
+}
+
+esp_err_t heap_trace_init_standalone(heap_trace_record_t* record_buffer, size_t num_records) {
+    if (atomic_load(&s_tracing)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    s_records = record_buffer;
+    s_size = num_records;
+    return ESP_OK;
+}
+
+esp_err_t heap_trace_start(heap_trace_mode_t mode) {
+    if (s_records == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    atomic_store(&s_count, 0);
+    atomic_store(&s_tracing, true);
+    return ESP_OK;
+}
+
+esp_err_t heap_trace_stop(void) {
+    atomic_store(&s_tracing, false);
+    return ESP_OK;
+}
+
+size_t heap_trace_get_count(void) {
+    size_t count = atomic_load(&s_count);
+    return count < s_size ? count : s_size;
+}
+
+void heap_trace_dump(void) {
+    // addr2line -e firmware gives the caller
+    for (size_t i = 0; i < heap_trace_get_count(); i++) {
+        printf("%zu bytes at %p, allocated by %p\n", s_records[i].size, s_records[i].address, s_records[i].alloced_by[0]);
+    }
+}
@@ -0,0 +1,19 @@
+#ifndef HOST_H
+#define HOST_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Shared by the stand-ins of the host build */
+
+// path of name in $BME_HOST_DIR (default: current directory)
+const char* host_path(char* buf, size_t size, const char* name);
+// waits until sock is readable (POLLIN) or writable (POLLOUT), letting the
+// other tasks run; timeout_ms 0 waits forever. false on timeout
+bool host_wait(int sock, short events, int timeout_ms);
+// runs the firmware again from the start, as after a reset
+void host_exec(void) __attribute__((noreturn));
+// restores the RTC memory after a deep sleep, before the scheduler starts
+void host_sleep_init(void);
+
+#endif
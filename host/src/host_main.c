@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <time.h>
+#include <stdarg.h>
+#include <poll.h>
+#include <malloc.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_rom_crc.h"
+#include "esp_app_desc.h"
+#include "esp_sleep.h"
+#include "host.h"
+
+/* Entry point of the host build: app_main() runs in a task, as the
+ * ESP-IDF main task does, once the scheduler is started.
+ */
+
+#define MAIN_TASK_STACK 8192
+#define MAIN_TASK_PRIORITY 1
+// tells the next image it was started by esp_restart()
+#define RESTART_ENV "BME_HOST_RESTART"
+
+void app_main(void);
+
+static char** s_argv;
+static bool s_restarted = false;
+
+static void main_task(void* arg) {
+    app_main();
+    vTaskDelete(NULL);
+}
+
+int main(int argc, char** argv) {
+    s_argv = argv;
+    s_restarted = getenv(RESTART_ENV) != NULL;
+    unsetenv(RESTART_ENV);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    esp_timer_get_time(); // time 0 of the logs
+    host_sleep_init();
+    xTaskCreate(main_task, "main", MAIN_TASK_STACK, NULL, MAIN_TASK_PRIORITY, NULL);
+    vTaskStartScheduler();
+    return EXIT_FAILURE;
+}
+
+void esp_restart(void) {
+    ESP_LOGI("host", "Restarting");
+    setenv(RESTART_ENV, "sw", 1);
+    host_exec();
+}
+
+static uint32_t s_min_free_heap = UINT32_MAX;
+
+uint32_t esp_get_free_heap_size(void) {
+    struct mallinfo2 info = mallinfo2();
+    uint32_t free = (uint32_t)info.fordblks;
+    if (free < s_min_free_heap) {
+        s_min_free_heap = free;
+    }
+    return free;
+}
+
+uint32_t esp_get_minimum_free_heap_size(void) {
+    return s_min_free_heap == UINT32_MAX ? esp_get_free_heap_size() : s_min_free_heap;
+}
+
+esp_reset_reason_t esp_reset_reason(void) {
+    if (esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_UNDEFINED) {
+        return ESP_RST_DEEPSLEEP;
+    }
+    return s_restarted ? ESP_RST_SW : ESP_RST_POWERON;
+}
+
+void host_exec(void) {
+    fflush(NULL);
+    // the kernel masks signals in its threads, and a new image inherits the mask
+    sigset_t none;
+    sigemptyset(&none);
+    pthread_sigmask(SIG_SETMASK, &none, NULL);
+    execv("/proc/self/exe", s_argv);
+    perror("execv");
+    _exit(EXIT_FAILURE);
+}
+
+const esp_app_desc_t* esp_app_get_description(void) {
+    static const esp_app_desc_t desc = {
+        .version = HOST_APP_VERSION,
+        .project_name = "BMX",
+        .time = __TIME__,
+        .date = __DATE__,
+        .idf_ver = "host",
+    };
+    return &desc;
+}
+
+void vAssertCalled(const char* file, unsigned long line) {
+    fprintf(stderr, "FreeRTOS assert failed at %s:%lu\n", file, line);
+    abort();
+}
+
+void host_log(char level, const char* tag, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    printf("%c (%lld) %s: ", level, (long long)(esp_timer_get_time() / 1000), tag);
+    vprintf(format, args);
+    printf("\n");
+    va_end(args);
+}
+
+const char* esp_err_to_name(esp_err_t code) {
+    switch (code) {
+        case ESP_OK: return "ESP_OK";
+        case ESP_FAIL: return "ESP_FAIL";
+        case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+        case ESP_ERR_INVALID_RESPONSE: return "ESP_ERR_INVALID_RESPONSE";
+        case ESP_ERR_INVALID_CRC: return "ESP_ERR_INVALID_CRC";
+        case ESP_ERR_NVS_NOT_INITIALIZED: return "ESP_ERR_NVS_NOT_INITIALIZED";
+        case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+        case ESP_ERR_NVS_INVALID_HANDLE: return "ESP_ERR_NVS_INVALID_HANDLE";
+        case ESP_ERR_NVS_INVALID_LENGTH: return "ESP_ERR_NVS_INVALID_LENGTH";
+        case ESP_ERR_NVS_NO_FREE_PAGES: return "ESP_ERR_NVS_NO_FREE_PAGES";
+        case ESP_ERR_NVS_NEW_VERSION_FOUND: return "ESP_ERR_NVS_NEW_VERSION_FOUND";
+        default: return "UNKNOWN ERROR";
+    }
+}
+
+// same as the ROM one: reflected polynomial 0xEDB88320, ~crc in and out
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* buf, uint32_t len) {
+    crc = ~crc;
+    for (uint32_t i = 0; i < len; i++) {
+        crc ^= buf[i];
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+int64_t esp_timer_get_time(void) {
+    static struct timespec start;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (start.tv_sec == 0 && start.tv_nsec == 0) {
+        start = now;
+    }
+    return (int64_t)(now.tv_sec - start.tv_sec) * 1000000 + (now.tv_nsec - start.tv_nsec) / 1000;
+}
+
+const char* host_path(char* buf, size_t size, const char* name) {
+    const char* dir = getenv("BME_HOST_DIR");
+    snprintf(buf, size, "%s/%s", dir != NULL && dir[0] != '\0' ? dir : ".", name);
+    return buf;
+}
+
+bool host_wait(int sock, short events, int timeout_ms) {
+    int64_t deadline = esp_timer_get_time() + (int64_t)timeout_ms * 1000;
+    struct pollfd pfd = { .fd = sock, .events = events };
+    while (poll(&pfd, 1, 0) == 0) {
+        if (timeout_ms > 0 && esp_timer_get_time() >= deadline) {
+            return false;
+        }
+        vTaskDelay(1);
+    }
+    return true;
+}
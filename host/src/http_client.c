@@ -0,0 +1,369 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include "esp_http_client.h"
+#include "esp_log.h"
+#include "host.h"
+
+#define TAG "HTTP_CLIENT"
+#define URL_SIZE 256
+#define MAX_HEADERS 8
+#define HEADER_SIZE 128
+#define RX_SIZE 1024
+#define DEFAULT_TIMEOUT_MS 5000
+
+struct esp_http_client {
+    http_event_handle_cb event_handler;
+    void* user_data;
+    int timeout_ms;
+    esp_http_client_method_t method;
+    char url[URL_SIZE];
+    struct {
+        char key[HEADER_SIZE / 2];
+        char value[HEADER_SIZE];
+    } headers[MAX_HEADERS];
+    int header_count;
+    const char* post_data;
+    int post_len;
+
+    int sock;
+    char connected_to[URL_SIZE + 8]; // host:port of sock
+    int status;
+    int64_t content_length;
+    bool chunked;
+    bool close_after; // "Connection: close" received
+
+    char rx[RX_SIZE];
+    int rx_len;
+    int rx_pos;
+};
+
+static void dispatch(esp_http_client_handle_t client, esp_http_client_event_id_t id,
+        void* data, int len, char* key, char* value) {
+    if (client->event_handler == NULL) {
+        return;
+    }
+    esp_http_client_event_t evt = {
+        .event_id = id,
+        .client = client,
+        .data = data,
+        .data_len = len,
+        .user_data = client->user_data,
+        .header_key = key,
+        .header_value = value,
+    };
+    client->event_handler(&evt);
+}
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t* config) {
+    esp_http_client_handle_t client = calloc(1, sizeof(*client));
+    if (client == NULL) {
+        return NULL;
+    }
+    client->event_handler = config->event_handler;
+    client->user_data = config->user_data;
+    client->timeout_ms = config->timeout_ms > 0 ? config->timeout_ms : DEFAULT_TIMEOUT_MS;
+    client->method = config->method;
+    client->sock = -1;
+    if (config->url != NULL) {
+        esp_http_client_set_url(client, config->url);
+    }
+    return client;
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char* url) {
+    if (strlen(url) >= URL_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    strcpy(client->url, url);
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_post_field(esp_http_client_handle_t client, const char* data, int len) {
+    client->post_data = data;
+    client->post_len = len;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char* key, const char* value) {
+    int i = 0;
+    while (i < client->header_count && strcasecmp(client->headers[i].key, key) != 0) {
+        i++;
+    }
+    if (i == MAX_HEADERS || strlen(key) >= sizeof(client->headers[i].key) || strlen(value) >= sizeof(client->headers[i].value)) {
+        return ESP_ERR_NO_MEM;
+    }
+    strcpy(client->headers[i].key, key);
+    strcpy(client->headers[i].value, value);
+    if (i == client->header_count) {
+        client->header_count++;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_set_method(esp_http_client_handle_t client, esp_http_client_method_t method) {
+    client->method = method;
+    return ESP_OK;
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client) {
+    return client->status;
+}
+
+int64_t esp_http_client_get_content_length(esp_http_client_handle_t client) {
+    return client->content_length;
+}
+
+bool esp_http_client_is_chunked_response(esp_http_client_handle_t client) {
+    return client->chunked;
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client) {
+    if (client->sock >= 0) {
+        close(client->sock);
+        client->sock = -1;
+        client->connected_to[0] = '\0';
+        dispatch(client, HTTP_EVENT_DISCONNECTED, NULL, 0, NULL, NULL);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client) {
+    esp_http_client_close(client);
+    free(client);
+    return ESP_OK;
+}
+
+/* Splits http://host[:port]/path; https is not supported */
+static bool parse_url(const char* url, char* host, size_t host_size, char* port, size_t port_size, const char** path) {
+    if (strncasecmp(url, "http://", 7) != 0) {
+        return false;
+    }
+    const char* p = url + 7;
+    size_t host_len = strcspn(p, ":/");
+    if (host_len == 0 || host_len >= host_size) {
+        return false;
+    }
+    memcpy(host, p, host_len);
+    host[host_len] = '\0';
+    p += host_len;
+    if (*p == ':') {
+        p++;
+        size_t port_len = strcspn(p, "/");
+        if (port_len == 0 || port_len >= port_size) {
+            return false;
+        }
+        memcpy(port, p, port_len);
+        port[port_len] = '\0';
+        p += port_len;
+    } else {
+        snprintf(port, port_size, "80");
+    }
+    *path = *p == '/' ? p : "/";
+    return true;
+}
+
+static esp_err_t connect_to(esp_http_client_handle_t client, const char* host, const char* port) {
+    char target[sizeof(client->connected_to)];
+    snprintf(target, sizeof(target), "%s:%s", host, port);
+    if (client->sock >= 0 && strcmp(target, client->connected_to) == 0) {
+        return ESP_OK;
+    }
+    esp_http_client_close(client);
+
+    const struct addrinfo hints = { .ai_family = AF_INET, .ai_socktype = SOCK_STREAM };
+    struct addrinfo* res = NULL;
+    if (getaddrinfo(host, port, &hints, &res) != 0 || res == NULL) {
+        ESP_LOGE(TAG, "Unable to resolve %s", host);
+        return ESP_FAIL;
+    }
+    int sock = socket(res->ai_family, res->ai_socktype | SOCK_NONBLOCK, 0);
+    int err = sock < 0 ? -1 : connect(sock, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+    if (err != 0 && errno == EINPROGRESS && host_wait(sock, POLLOUT, client->timeout_ms)) {
+        socklen_t len = sizeof(err);
+        getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len);
+    }
+    if (err != 0) {
+        ESP_LOGE(TAG, "Unable to connect to %s", target);
+        if (sock >= 0) {
+            close(sock);
+        }
+        return ESP_FAIL;
+    }
+    client->sock = sock;
+    client->rx_len = client->rx_pos = 0;
+    strcpy(client->connected_to, target);
+    dispatch(client, HTTP_EVENT_ON_CONNECTED, NULL, 0, NULL, NULL);
+    return ESP_OK;
+}
+
+static bool send_all(esp_http_client_handle_t client, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(client->sock, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EAGAIN && host_wait(client->sock, POLLOUT, client->timeout_ms)) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+// next byte of the response, -1 on timeout or end of connection
+static int read_byte(esp_http_client_handle_t client) {
+    if (client->rx_pos == client->rx_len) {
+        if (!host_wait(client->sock, POLLIN, client->timeout_ms)) {
+            return -1;
+        }
+        ssize_t n = recv(client->sock, client->rx, sizeof(client->rx), 0);
+        if (n <= 0) {
+            return -1;
+        }
+        client->rx_len = (int)n;
+        client->rx_pos = 0;
+    }
+    return (unsigned char)client->rx[client->rx_pos++];
+}
+
+// one line without its CRLF
+static bool read_line(esp_http_client_handle_t client, char* line, size_t size) {
+    size_t len = 0;
+    int c;
+    while ((c = read_byte(client)) >= 0 && c != '\n') {
+        if (c != '\r' && len + 1 < size) {
+            line[len++] = (char)c;
+        }
+    }
+    line[len] = '\0';
+    return c == '\n';
+}
+
+// passes len bytes of body to the event handler
+static bool read_body(esp_http_client_handle_t client, int64_t len) {
+    char buf[256];
+    while (len > 0) {
+        int n = 0;
+        int c = 0;
+        while (n < (int)sizeof(buf) && n < len && (c = read_byte(client)) >= 0) {
+            buf[n++] = (char)c;
+        }
+        if (n > 0) {
+            dispatch(client, HTTP_EVENT_ON_DATA, buf, n, NULL, NULL);
+        }
+        if (c < 0) {
+            return false;
+        }
+        len -= n;
+    }
+    return true;
+}
+
+static bool read_response(esp_http_client_handle_t client) {
+    char line[HEADER_SIZE * 2];
+    if (!read_line(client, line, sizeof(line)) || sscanf(line, "HTTP/%*d.%*d %d", &client->status) != 1) {
+        return false;
+    }
+    client->content_length = -1;
+    client->chunked = false;
+    client->close_after = strncmp(line, "HTTP/1.0", 8) == 0;
+    while (true) {
+        if (!read_line(client, line, sizeof(line))) {
+            return false;
+        }
+        if (line[0] == '\0') {
+            break;
+        }
+        char* value = strchr(line, ':');
+        if (value == NULL) {
+            continue;
+        }
+        *value++ = '\0';
+        value += strspn(value, " \t");
+        dispatch(client, HTTP_EVENT_ON_HEADER, NULL, 0, line, value);
+        if (strcasecmp(line, "Content-Length") == 0) {
+            client->content_length = strtoll(value, NULL, 10);
+        } else if (strcasecmp(line, "Transfer-Encoding") == 0) {
+            client->chunked = strcasecmp(value, "chunked") == 0;
+        } else if (strcasecmp(line, "Connection") == 0) {
+            client->close_after = strcasecmp(value, "close") == 0;
+        }
+    }
+    if (client->chunked) {
+        int64_t size;
+        do {
+            if (!read_line(client, line, sizeof(line))) {
+                return false;
+            }
+            size = strtoll(line, NULL, 16);
+            if (!read_body(client, size) || !read_line(client, line, sizeof(line))) {
+                return false;
+            }
+        } while (size > 0);
+        return true;
+    }
+    if (client->content_length < 0) {
+        // body up to the end of the connection
+        client->close_after = true;
+        read_body(client, INT64_MAX);
+        return true;
+    }
+    return read_body(client, client->content_length);
+}
+
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client) {
+    char host[URL_SIZE], port[8];
+    const char* path;
+    if (!parse_url(client->url, host, sizeof(host), port, sizeof(port), &path)) {
+        ESP_LOGE(TAG, "Unsupported URL %s", client->url);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    esp_err_t err = connect_to(client, host, port);
+    if (err != ESP_OK) {
+        dispatch(client, HTTP_EVENT_ERROR, NULL, 0, NULL, NULL);
+        return err;
+    }
+
+    static const char* const methods[] = { "GET", "POST", "PUT" };
+    char head[URL_SIZE + (MAX_HEADERS + 2) * HEADER_SIZE * 2];
+    int len = snprintf(head, sizeof(head), "%s %s HTTP/1.1\r\n", methods[client->method], path);
+    bool has_host = false;
+    for (int i = 0; i < client->header_count; i++) {
+        has_host |= strcasecmp(client->headers[i].key, "Host") == 0;
+        len += snprintf(head + len, sizeof(head) - len, "%s: %s\r\n", client->headers[i].key, client->headers[i].value);
+    }
+    if (!has_host) {
+        len += snprintf(head + len, sizeof(head) - len, "Host: %s\r\n", host);
+    }
+    if (client->method != HTTP_METHOD_GET) {
+        len += snprintf(head + len, sizeof(head) - len, "Content-Length: %d\r\n", client->post_len);
+    }
+    len += snprintf(head + len, sizeof(head) - len, "\r\n");
+
+    bool ok = send_all(client, head, len)
+            && (client->method == HTTP_METHOD_GET || send_all(client, client->post_data, client->post_len));
+    if (ok) {
+        dispatch(client, HTTP_EVENT_HEADERS_SENT, NULL, 0, NULL, NULL);
+        ok = read_response(client);
+    }
+    if (!ok) {
+        dispatch(client, HTTP_EVENT_ERROR, NULL, 0, NULL, NULL);
+        esp_http_client_close(client);
+        return ESP_FAIL;
+    }
+    dispatch(client, HTTP_EVENT_ON_FINISH, NULL, 0, NULL, NULL);
+    if (client->close_after) {
+        esp_http_client_close(client);
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,203 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_wifi.h"
+#include "esp_mac.h"
+#include "esp_sntp.h"
+
+/* Event loop, Wi-Fi station and SNTP client of the host build */
+
+#define TAG "wifi"
+#define MAX_HANDLERS 8
+
+esp_event_base_t const WIFI_EVENT = "WIFI_EVENT";
+esp_event_base_t const IP_EVENT = "IP_EVENT";
+
+static struct {
+    esp_event_base_t base;
+    int32_t id;
+    esp_event_handler_t handler;
+    void* arg;
+} s_handlers[MAX_HANDLERS];
+static int s_handler_count = 0;
+
+static wifi_config_t s_config;
+static bool s_started = false;
+static struct esp_netif_obj {
+    bool dhcp;
+    esp_netif_ip_info_t ip_info;
+} s_netif = { .dhcp = true };
+static sntp_sync_time_cb_t s_sntp_cb = NULL;
+
+esp_err_t esp_event_loop_create_default(void) {
+    return ESP_OK;
+}
+
+esp_err_t esp_event_handler_instance_register(esp_event_base_t event_base, int32_t event_id,
+        esp_event_handler_t event_handler, void* event_handler_arg,
+        esp_event_handler_instance_t* instance) {
+    if (s_handler_count == MAX_HANDLERS) {
+        return ESP_ERR_NO_MEM;
+    }
+    s_handlers[s_handler_count].base = event_base;
+    s_handlers[s_handler_count].id = event_id;
+    s_handlers[s_handler_count].handler = event_handler;
+    s_handlers[s_handler_count].arg = event_handler_arg;
+    if (instance != NULL) {
+        *instance = &s_handlers[s_handler_count];
+    }
+    s_handler_count++;
+    return ESP_OK;
+}
+
+esp_err_t esp_event_post(esp_event_base_t event_base, int32_t event_id,
+        const void* event_data, size_t event_data_size, uint32_t ticks_to_wait) {
+    for (int i = 0; i < s_handler_count; i++) {
+        if (s_handlers[i].base == event_base && (s_handlers[i].id == ESP_EVENT_ANY_ID || s_handlers[i].id == event_id)) {
+            s_handlers[i].handler(s_handlers[i].arg, event_base, event_id, (void*)event_data);
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_init(void) {
+    return ESP_OK;
+}
+
+esp_netif_t* esp_netif_create_default_wifi_sta(void) {
+    return &s_netif;
+}
+
+uint32_t esp_ip4addr_aton(const char* addr) {
+    struct in_addr in;
+    return inet_pton(AF_INET, addr, &in) == 1 ? in.s_addr : 0;
+}
+
+esp_err_t esp_netif_dhcpc_stop(esp_netif_t* netif) {
+    netif->dhcp = false;
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_set_ip_info(esp_netif_t* netif, const esp_netif_ip_info_t* ip_info) {
+    if (netif->dhcp) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    netif->ip_info = *ip_info;
+    return ESP_OK;
+}
+
+esp_err_t esp_netif_set_dns_info(esp_netif_t* netif, esp_netif_dns_type_t type, esp_netif_dns_info_t* dns) {
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_init(const wifi_init_config_t* config) {
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode) {
+    return mode == WIFI_MODE_STA ? ESP_OK : ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t* conf) {
+    if (interface != WIFI_IF_STA || conf == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s_config = *conf;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_config(wifi_interface_t interface, wifi_config_t* conf) {
+    if (interface != WIFI_IF_STA || conf == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *conf = s_config;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_start(void) {
+    s_started = true;
+    return esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_START, NULL, 0, portMAX_DELAY);
+}
+
+esp_err_t esp_wifi_stop(void) {
+    s_started = false;
+    return esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_STOP, NULL, 0, portMAX_DELAY);
+}
+
+esp_err_t esp_wifi_connect(void) {
+    if (!s_started) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    const uint8_t bssid[6] = HOST_AP_BSSID;
+    const wifi_sta_config_t* sta = &s_config.sta;
+    if ((sta->bssid_set && memcmp(sta->bssid, bssid, sizeof(bssid)) != 0)
+            || (sta->channel != 0 && sta->channel != HOST_AP_CHANNEL)) {
+        ESP_LOGI(TAG, "no AP " MACSTR " on channel %d", MAC2STR(sta->bssid), sta->channel);
+        return esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, NULL, 0, portMAX_DELAY);
+    }
+    ESP_LOGI(TAG, "connected to \"%.32s\"", (const char*)s_config.sta.ssid);
+    wifi_event_sta_connected_t connected = { .channel = HOST_AP_CHANNEL, .authmode = WIFI_AUTH_WPA2_PSK };
+    memcpy(connected.bssid, bssid, sizeof(bssid));
+    esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, &connected, sizeof(connected), portMAX_DELAY);
+
+    ip_event_got_ip_t got_ip = { 0 };
+    if (s_netif.dhcp) {
+        const char* ip = getenv("BME_HOST_IP");
+        struct in_addr addr;
+        if (inet_pton(AF_INET, ip != NULL ? ip : "127.0.0.1", &addr) != 1) {
+            addr.s_addr = htonl(INADDR_LOOPBACK);
+        }
+        got_ip.ip_info.ip.addr = addr.s_addr;
+    } else {
+        got_ip.ip_info = s_netif.ip_info;
+    }
+    got_ip.ip_changed = true;
+    return esp_event_post(IP_EVENT, IP_EVENT_STA_GOT_IP, &got_ip, sizeof(got_ip), portMAX_DELAY);
+}
+
+esp_err_t esp_read_mac(uint8_t* mac, esp_mac_type_t type) {
+    if (mac == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const uint8_t base[6] = { 0x02, 0x42, 0, 0, (uint8_t)(CONFIG_BME_ID >> 8), (uint8_t)CONFIG_BME_ID };
+    memcpy(mac, base, sizeof(base));
+    mac[5] += type;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_disconnect(void) {
+    return ESP_OK;
+}
+
+void sntp_setoperatingmode(uint8_t operating_mode) {
+}
+
+void sntp_setservername(uint8_t idx, const char* server) {
+}
+
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback) {
+    s_sntp_cb = callback;
+}
+
+static void sntp_task(void* arg) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    ESP_LOGI("sntp", "time synchronized");
+    if (s_sntp_cb != NULL) {
+        s_sntp_cb(&tv);
+    }
+    vTaskDelete(NULL);
+}
+
+void sntp_init(void) {
+    xTaskCreate(sntp_task, "sntp", configMINIMAL_STACK_SIZE, NULL, 5, NULL);
+}
+
+void sntp_stop(void) {
+}
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "host.h"
+
+#define NVS_DIR "nvs"
+#define MAX_HANDLES 8
+#define NAME_SIZE 16
+
+static bool s_init = false;
+static struct {
+    bool used;
+    bool writable;
+    char ns[NAME_SIZE];
+} s_handles[MAX_HANDLES];
+
+static const char* key_path(char* buf, size_t size, const char* ns, const char* key) {
+    char name[2 * NAME_SIZE + 8];
+    snprintf(name, sizeof(name), NVS_DIR "/%s.%s", ns, key);
+    return host_path(buf, size, name);
+}
+
+// true if a key of namespace ns is stored
+static bool ns_exists(const char* ns) {
+    char path[256];
+    DIR* dir = opendir(host_path(path, sizeof(path), NVS_DIR));
+    if (dir == NULL) {
+        return false;
+    }
+    size_t len = strlen(ns);
+    bool found = false;
+    struct dirent* ent;
+    while (!found && (ent = readdir(dir)) != NULL) {
+        found = strncmp(ent->d_name, ns, len) == 0 && ent->d_name[len] == '.';
+    }
+    closedir(dir);
+    return found;
+}
+
+esp_err_t nvs_flash_init(void) {
+    char path[256];
+    if (mkdir(host_path(path, sizeof(path), NVS_DIR), 0755) != 0 && errno != EEXIST) {
+        return ESP_FAIL;
+    }
+    s_init = true;
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void) {
+    char path[256];
+    DIR* dir = opendir(host_path(path, sizeof(path), NVS_DIR));
+    if (dir == NULL) {
+        return ESP_OK;
+    }
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != NULL) {
+        if (ent->d_name[0] != '.') {
+            char name[300];
+            snprintf(name, sizeof(name), NVS_DIR "/%s", ent->d_name);
+            remove(host_path(path, sizeof(path), name));
+        }
+    }
+    closedir(dir);
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char* name, nvs_open_mode_t open_mode, nvs_handle_t* out_handle) {
+    if (!s_init) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    if (strlen(name) >= NAME_SIZE) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (open_mode == NVS_READONLY && !ns_exists(name)) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    for (int i = 0; i < MAX_HANDLES; i++) {
+        if (!s_handles[i].used) {
+            s_handles[i].used = true;
+            s_handles[i].writable = open_mode == NVS_READWRITE;
+            strcpy(s_handles[i].ns, name);
+            *out_handle = i + 1;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+}
+
+static bool valid(nvs_handle_t handle) {
+    return handle >= 1 && handle <= MAX_HANDLES && s_handles[handle - 1].used;
+}
+
+void nvs_close(nvs_handle_t handle) {
+    if (valid(handle)) {
+        s_handles[handle - 1].used = false;
+    }
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle) {
+    return valid(handle) ? ESP_OK : ESP_ERR_NVS_INVALID_HANDLE;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key) {
+    if (!valid(handle) || !s_handles[handle - 1].writable) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    char path[256];
+    if (remove(key_path(path, sizeof(path), s_handles[handle - 1].ns, key)) != 0) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    return ESP_OK;
+}
+
+/* *length is the size of out (which may be NULL to ask for the size),
+ * and is set to the size of the value */
+static esp_err_t get(nvs_handle_t handle, const char* key, void* out, size_t* length) {
+    if (!valid(handle)) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    char path[256];
+    FILE* f = fopen(key_path(path, sizeof(path), s_handles[handle - 1].ns, key), "rb");
+    if (f == NULL) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    fseek(f, 0, SEEK_END);
+    size_t size = (size_t)ftell(f);
+    rewind(f);
+    esp_err_t err = ESP_OK;
+    if (out != NULL) {
+        if (*length < size) {
+            err = ESP_ERR_NVS_INVALID_LENGTH;
+        } else if (fread(out, 1, size, f) != size) {
+            err = ESP_FAIL;
+        }
+    }
+    fclose(f);
+    *length = size;
+    return err;
+}
+
+static esp_err_t set(nvs_handle_t handle, const char* key, const void* value, size_t length) {
+    if (!valid(handle) || !s_handles[handle - 1].writable) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    char path[256];
+    FILE* f = fopen(key_path(path, sizeof(path), s_handles[handle - 1].ns, key), "wb");
+    if (f == NULL) {
+        return ESP_FAIL;
+    }
+    bool ok = fwrite(value, 1, length, f) == length;
+    return fclose(f) == 0 && ok ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char* key, char* out_value, size_t* length) {
+    return get(handle, key, out_value, length);
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char* key, const char* value) {
+    return set(handle, key, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, size_t* length) {
+    return get(handle, key, out_value, length);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length) {
+    return set(handle, key, value, length);
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char* key, uint8_t* out_value) {
+    size_t length = sizeof(*out_value);
+    return get(handle, key, out_value, &length);
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char* key, uint8_t value) {
+    return set(handle, key, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char* key, uint32_t* out_value) {
+    size_t length = sizeof(*out_value);
+    return get(handle, key, out_value, &length);
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char* key, uint32_t value) {
+    return set(handle, key, &value, sizeof(value));
+}
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "esp_partition.h"
+#include "host.h"
+
+#define SECTOR_SIZE 4096
+
+// the data partitions of partitions.csv that the firmware opens
+static const esp_partition_t s_partitions[] = {
+    {
+        .type = ESP_PARTITION_TYPE_DATA,
+        .subtype = ESP_PARTITION_SUBTYPE_DATA_UNDEFINED,
+        .address = 0x110000,
+        .size = 64 * 1024,
+        .erase_size = SECTOR_SIZE,
+        .label = "readings",
+    },
+};
+#define PARTITION_COUNT (sizeof(s_partitions) / sizeof(s_partitions[0]))
+
+static int s_fd[PARTITION_COUNT] = { -1 };
+
+static int part_fd(const esp_partition_t* part) {
+    size_t i = part - s_partitions;
+    if (i >= PARTITION_COUNT) {
+        return -1;
+    }
+    if (s_fd[i] >= 0) {
+        return s_fd[i];
+    }
+    char name[32], path[256];
+    snprintf(name, sizeof(name), "%s.bin", part->label);
+    int fd = open(host_path(path, sizeof(path), name), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    // a new file is an erased partition
+    off_t size = lseek(fd, 0, SEEK_END);
+    uint8_t erased[SECTOR_SIZE];
+    memset(erased, 0xff, sizeof(erased));
+    for (; size < part->size; size += SECTOR_SIZE) {
+        if (pwrite(fd, erased, SECTOR_SIZE, size) != SECTOR_SIZE) {
+            close(fd);
+            return -1;
+        }
+    }
+    s_fd[i] = fd;
+    return fd;
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char* label) {
+    for (size_t i = 0; i < PARTITION_COUNT; i++) {
+        const esp_partition_t* part = &s_partitions[i];
+        if (part->type == type && (subtype == ESP_PARTITION_SUBTYPE_ANY || part->subtype == subtype)
+                && (label == NULL || strcmp(part->label, label) == 0)) {
+            return part_fd(part) < 0 ? NULL : part;
+        }
+    }
+    return NULL;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size) {
+    if (src_offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    return pread(part_fd(partition), dst, size, src_offset) == (ssize_t)size ? ESP_OK : ESP_FAIL;
+}
+
+// bits can only go from 1 to 0
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t dst_offset, const void* src, size_t size) {
+    if (dst_offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    int fd = part_fd(partition);
+    const uint8_t* in = src;
+    uint8_t buf[256];
+    for (size_t done = 0; done < size; ) {
+        size_t n = size - done < sizeof(buf) ? size - done : sizeof(buf);
+        if (pread(fd, buf, n, dst_offset + done) != (ssize_t)n) {
+            return ESP_FAIL;
+        }
+        for (size_t i = 0; i < n; i++) {
+            buf[i] &= in[done + i];
+        }
+        if (pwrite(fd, buf, n, dst_offset + done) != (ssize_t)n) {
+            return ESP_FAIL;
+        }
+        done += n;
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size) {
+    if (offset % SECTOR_SIZE != 0 || size % SECTOR_SIZE != 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (offset + size > partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    int fd = part_fd(partition);
+    uint8_t erased[SECTOR_SIZE];
+    memset(erased, 0xff, sizeof(erased));
+    for (size_t done = 0; done < size; done += SECTOR_SIZE) {
+        if (pwrite(fd, erased, SECTOR_SIZE, offset + done) != SECTOR_SIZE) {
+            return ESP_FAIL;
+        }
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "esp_log.h"
+#include "esp_sleep.h"
+#include "host.h"
+
+/* Deep sleep: the RTC_DATA_ATTR variables are in the rtc_data section,
+ * written to rtc.bin before sleeping and read back by the next image.
+ * BME_HOST_WAKEUP tells that image it was woken up by the timer.
+ */
+
+#define RTC_FILE "rtc.bin"
+#define WAKEUP_ENV "BME_HOST_WAKEUP"
+
+// defined by the linker when the section is not empty
+extern uint8_t __start_rtc_data[] __attribute__((weak));
+extern uint8_t __stop_rtc_data[] __attribute__((weak));
+
+static uint64_t s_sleep_us = 0;
+static esp_sleep_wakeup_cause_t s_cause = ESP_SLEEP_WAKEUP_UNDEFINED;
+
+static size_t rtc_size(void) {
+    return __start_rtc_data != NULL ? (size_t)(__stop_rtc_data - __start_rtc_data) : 0;
+}
+
+void host_sleep_init(void) {
+    if (getenv(WAKEUP_ENV) == NULL) {
+        return;
+    }
+    unsetenv(WAKEUP_ENV);
+    s_cause = ESP_SLEEP_WAKEUP_TIMER;
+    char path[256];
+    FILE* f = fopen(host_path(path, sizeof(path), RTC_FILE), "rb");
+    if (f == NULL) {
+        return;
+    }
+    if (rtc_size() > 0 && fread(__start_rtc_data, 1, rtc_size(), f) != rtc_size()) {
+        fprintf(stderr, "%s: truncated, RTC memory not restored\n", path);
+    }
+    fclose(f);
+}
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us) {
+    s_sleep_us = time_in_us;
+    return ESP_OK;
+}
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause(void) {
+    return s_cause;
+}
+
+void esp_deep_sleep_start(void) {
+    char path[256];
+    FILE* f = fopen(host_path(path, sizeof(path), RTC_FILE), "wb");
+    if (f != NULL) {
+        fwrite(__start_rtc_data, 1, rtc_size(), f);
+        fclose(f);
+    }
+    ESP_LOGI("host", "Deep sleep for %llu ms", (unsigned long long)(s_sleep_us / 1000));
+    fflush(NULL);
+    usleep(s_sleep_us);
+    setenv(WAKEUP_ENV, "timer", 1);
+    host_exec();
+}
@@ -0,0 +1,28 @@
+#include <errno.h>
+#include <poll.h>
+#include "lwip/sockets.h"
+#include "host.h"
+
+#undef recvfrom
+#undef recv
+
+static int recv_timeout_ms(int sock) {
+    struct timeval tv = { 0 };
+    socklen_t len = sizeof(tv);
+    if (getsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, &len) != 0) {
+        return 0;
+    }
+    return (int)(tv.tv_sec * 1000 + tv.tv_usec / 1000);
+}
+
+ssize_t host_recvfrom(int sock, void* buf, size_t len, int flags, struct sockaddr* from, socklen_t* fromlen) {
+    if (!(flags & MSG_DONTWAIT) && !host_wait(sock, POLLIN, recv_timeout_ms(sock))) {
+        errno = EAGAIN;
+        return -1;
+    }
+    return recvfrom(sock, buf, len, flags | MSG_DONTWAIT, from, fromlen);
+}
+
+ssize_t host_recv(int sock, void* buf, size_t len, int flags) {
+    return host_recvfrom(sock, buf, len, flags, NULL, NULL);
+}
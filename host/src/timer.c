@@ -0,0 +1,78 @@
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/timers.h"
+#include "esp_timer.h"
+
+struct esp_timer {
+    TimerHandle_t timer;
+    esp_timer_cb_t callback;
+    void* arg;
+};
+
+static void timer_cb(TimerHandle_t timer) {
+    esp_timer_handle_t t = pvTimerGetTimerID(timer);
+    t->callback(t->arg);
+}
+
+static TickType_t us_to_ticks(uint64_t us) {
+    static long s_speedup = 0;
+    if (s_speedup == 0) {
+        const char* env = getenv("BME_HOST_SPEEDUP");
+        s_speedup = env != NULL && atol(env) > 0 ? atol(env) : 1;
+    }
+    us /= s_speedup;
+    TickType_t ticks = (TickType_t)(us / 1000 / portTICK_PERIOD_MS);
+    return ticks == 0 ? 1 : ticks;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* out_handle) {
+    if (args == NULL || args->callback == NULL || out_handle == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_timer_handle_t t = malloc(sizeof(*t));
+    if (t == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    t->callback = args->callback;
+    t->arg = args->arg;
+    t->timer = xTimerCreate(args->name != NULL ? args->name : "esp_timer", 1, pdFALSE, t, timer_cb);
+    if (t->timer == NULL) {
+        free(t);
+        return ESP_ERR_NO_MEM;
+    }
+    *out_handle = t;
+    return ESP_OK;
+}
+
+static esp_err_t start(esp_timer_handle_t timer, uint64_t us, UBaseType_t reload) {
+    if (xTimerIsTimerActive(timer->timer)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    vTimerSetReloadMode(timer->timer, reload);
+    // also starts the timer
+    return xTimerChangePeriod(timer->timer, us_to_ticks(us), portMAX_DELAY) == pdPASS ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+    return start(timer, timeout_us, pdFALSE);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period) {
+    return start(timer, period, pdTRUE);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+    if (!xTimerIsTimerActive(timer->timer)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return xTimerStop(timer->timer, portMAX_DELAY) == pdPASS ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+    if (xTimerIsTimerActive(timer->timer)) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xTimerDelete(timer->timer, portMAX_DELAY);
+    free(timer);
+    return ESP_OK;
+}
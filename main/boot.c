@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <sys/param.h>
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#include "boot.h"
+
+#define TAG "Boot"
+
+_Static_assert(BOOT_PHASES <= CONTROL_MAX_PHASES, "too many boot phases for the profile");
+
+// ms since boot, 0 until reached; 32 bits, so that other tasks read it whole
+static volatile uint32_t s_time_ms[BOOT_PHASES];
+static volatile uint32_t s_flags = 0;
+
+bool boot_mark(boot_phase_t phase) {
+    if (phase >= BOOT_PHASES || s_time_ms[phase] != 0) {
+        return false;
+    }
+    uint32_t ms = (uint32_t)(esp_timer_get_time() / 1000);
+    s_time_ms[phase] = ms > 0 ? ms : 1;
+    return true;
+}
+
+bool boot_reached(boot_phase_t phase) {
+    return phase < BOOT_PHASES && s_time_ms[phase] != 0;
+}
+
+void boot_flag(uint32_t flag) {
+    s_flags |= flag;
+}
+
+void boot_log(void) {
+    char line[256];
+    size_t len = 0;
+    for (int i = 0; i < BOOT_PHASES && len < sizeof(line) - 1; i++) {
+        if (s_time_ms[i] != 0) {
+            int n = snprintf(line + len, sizeof(line) - len, "%s%s %u ms",
+                    len ? ", " : "", control_phase_name(i), (unsigned)s_time_ms[i]);
+            // truncated: len stops at the terminating null
+            len = n < 0 ? len : MIN(len + n, sizeof(line) - 1);
+        }
+    }
+    if (s_time_ms[BOOT_WIFI_START] == 0) {
+        ESP_LOGI(TAG, "%s (no wifi)", len ? line : "no phase");
+        return;
+    }
+    ESP_LOGI(TAG, "%s (%s%s%s)", len ? line : "no phase",
+            s_flags & BOOT_FAST_CONNECT ? "cached AP" : "no cached AP",
+            s_flags & BOOT_FULL_SCAN ? ", full scan" : "",
+            s_flags & BOOT_STATIC_IP ? ", static IP" : ", DHCP");
+}
+
+void boot_profile(control_profile_t* profile) {
+    profile->reset_reason = (uint8_t)esp_reset_reason();
+    profile->flags = (uint8_t)s_flags;
+    profile->count = BOOT_PHASES;
+    for (int i = 0; i < BOOT_PHASES; i++) {
+        profile->ms[i] = s_time_ms[i] != 0 ? s_time_ms[i] : CONTROL_PHASE_NONE;
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef BOOT_H
+#define BOOT_H
+#include <stdbool.h>
+#include <stdint.h>
+#include "control.h"
+
+/* Time of the boot phases, since the chip started (esp_timer), so that
+ * the gain of a faster boot path can be measured. The profile is logged
+ * once the first reading is taken, and served on the control port
+ * (CONTROL_QUERY_PROFILE).
+ */
+
+// same order as control_phase_name()
+typedef enum boot_phase_t {
+    BOOT_NVS,            // nvs_flash_init() returned
+    BOOT_CONFIG,         // settings loaded
+    BOOT_WIFI_START,     // esp_wifi_start() returned
+    BOOT_WIFI_CONNECTED, // associated with the AP
+    BOOT_GOT_IP,
+    BOOT_TIME_SYNC,      // first SNTP update
+    BOOT_FIRST_READING,  // first conversion of the sensor returned
+    BOOT_FIRST_UPLOAD,   // first batch accepted by the server
+    BOOT_FIRST_RELAY,    // relays first set from the schedule
+    BOOT_PHASES
+} boot_phase_t;
+
+// how the boot went
+#define BOOT_FAST_CONNECT CONTROL_BOOT_CACHED_AP // tried the cached AP and channel
+#define BOOT_FULL_SCAN    CONTROL_BOOT_FULL_SCAN // the cached AP failed, or there was none
+#define BOOT_STATIC_IP    CONTROL_BOOT_STATIC_IP // no DHCP
+
+// records the first time phase is reached; true that time
+bool boot_mark(boot_phase_t phase);
+bool boot_reached(boot_phase_t phase);
+void boot_flag(uint32_t flag);
+// one line with every phase reached
+void boot_log(void);
+// the phases and flags so far, with the reason of the last reset
+void boot_profile(control_profile_t* profile);
+
+#endif
@@ -0,0 +1,93 @@
+#include <inttypes.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+
+#include "clock.h"
+#include "tz.h"
+
+#define TAG "Clock"
+#define US INT64_C(1000000)
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static tz_rule_t s_rule;
+static tz_year_t s_year; // of the last time asked
+// UTC time at the esp_timer time s_sync_us, 0 until synced
+static int64_t s_utc_us = 0;
+static int64_t s_sync_us;
+static int32_t s_drift_us = 0;
+
+static int64_t floor_div(int64_t a, int64_t b) {
+    return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+esp_err_t clock_init(const char* tz) {
+    if (!tz_parse(tz, &s_rule)) {
+        ESP_LOGE(TAG, "Invalid TZ rule %s, using UTC", tz);
+        s_rule = (tz_rule_t) { 0 };
+        return ESP_ERR_INVALID_ARG;
+    }
+    ESP_LOGI(TAG, "TZ %s: UTC%+" PRId32 " s%s", tz, s_rule.std_offset, s_rule.has_dst ? " with DST" : "");
+    return ESP_OK;
+}
+
+void clock_synced(const struct timeval* tv) {
+    int64_t mono = esp_timer_get_time();
+    int64_t utc = (int64_t)tv->tv_sec * US + tv->tv_usec;
+    int64_t interval = 0;
+    int64_t drift = 0;
+    portENTER_CRITICAL(&s_lock);
+    if (s_utc_us != 0) {
+        interval = mono - s_sync_us;
+        drift = utc - (s_utc_us + interval);
+    }
+    s_utc_us = utc;
+    s_sync_us = mono;
+    s_drift_us = drift < INT32_MIN ? INT32_MIN : drift > INT32_MAX ? INT32_MAX : (int32_t)drift;
+    portEXIT_CRITICAL(&s_lock);
+    if (interval > 0) {
+        ESP_LOGI(TAG, "Drift of %" PRId64 " us in %" PRId64 " s (%" PRId64 " ppm)",
+                drift, interval / US, drift * US / interval);
+    }
+}
+
+int clock_minute_of_week(int64_t* now) {
+    portENTER_CRITICAL(&s_lock);
+    if (s_utc_us == 0) {
+        portEXIT_CRITICAL(&s_lock);
+        return -1;
+    }
+    *now = s_utc_us + esp_timer_get_time() - s_sync_us;
+    int64_t local = floor_div(*now, US) + tz_offset(&s_rule, &s_year, floor_div(*now, US));
+    portEXIT_CRITICAL(&s_lock);
+
+    int64_t days = floor_div(local, 86400);
+    // the epoch was a Thursday
+    int wday = (int)((days % 7 + 11) % 7);
+    return wday * 24 * 60 + (int)((local - days * 86400) / 60);
+}
+
+uint32_t clock_next_boundary(int64_t now, int minutes) {
+    int64_t now_s = floor_div(now, US);
+    portENTER_CRITICAL(&s_lock);
+    int32_t offset = tz_offset(&s_rule, &s_year, now_s);
+    int64_t change = tz_next_change(&s_rule, &s_year, now_s);
+    portEXIT_CRITICAL(&s_lock);
+
+    // start of the current minute, in the current offset
+    int64_t next = (floor_div(now_s + offset, 60) + minutes) * 60 - offset;
+    if (change < next) {
+        next = change;
+    }
+    int64_t ms = (next * US - now + 999) / 1000;
+    return ms > UINT32_MAX ? UINT32_MAX : (uint32_t)ms;
+}
+
+bool clock_status(uint32_t* age_s, int32_t* drift_us) {
+    portENTER_CRITICAL(&s_lock);
+    bool synced = s_utc_us != 0;
+    *age_s = (uint32_t)((esp_timer_get_time() - s_sync_us) / US);
+    *drift_us = s_drift_us;
+    portEXIT_CRITICAL(&s_lock);
+    return synced;
+}
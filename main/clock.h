@@ -0,0 +1,28 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/time.h>
+#include "esp_err.h"
+
+/* Local time of the schedule, without newlib's localtime(): the UTC time of
+ * the last SNTP sync plus the esp_timer time elapsed since, and the UTC
+ * offsets of the year precomputed from the POSIX TZ rule (see tz.h).
+ *
+ * Times are in µs since the epoch, UTC.
+ */
+
+// tz is a POSIX TZ rule; an invalid one falls back to UTC
+esp_err_t clock_init(const char* tz);
+// SNTP callback: tv is the time just set
+void clock_synced(const struct timeval* tv);
+// minute of the week of the local time (see schedule.h) at *now, which is
+// set to the current time; -1 until the first sync
+int clock_minute_of_week(int64_t* now);
+// ms from now to the start of the minute minutes after the one of now, or
+// to the next change of the UTC offset if it comes first
+uint32_t clock_next_boundary(int64_t now, int minutes);
+// false until the first sync; drift_us is the correction made by the last one
+bool clock_status(uint32_t* age_s, int32_t* drift_us);
+
+#endif
@@ -0,0 +1,279 @@
+#ifndef COMMAND_H
+#define COMMAND_H
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "period.h"
+
+/* Values of the control commands (control_command_type_t): what follows
+ * the command byte of a v1 datagram, and the value of a v2 command.
+ *   CONTROL_PERIOD    u8 start_h, u8 start_m, u8 end_h, u8 end_m
+ *   CONTROL_URL       the url without its '\0', COMMAND_URL_MAX bytes max
+ *   CONTROL_WIFI      ssid padded with '\0' to 32 bytes, password to 64 bytes
+ *   CONTROL_SCHEDULE  u8 count, then per window: days (bit 0 is Sunday),
+ *                     start_h, start_m, end_h, end_m
+ *   CONTROL_OVERRIDE  u8 mode (command_override_mode_t), u32 seconds until
+ *                     the schedule takes over again, 0 for never, little endian
+ *
+ * Header only: C for the firmware, constexpr C++ for client.cpp. Nothing
+ * is allocated, the caller gives the buffers. Encoders return the size of
+ * the value, 0 if it is invalid or does not fit; in C++ the overloads
+ * taking an array check its size at compile time.
+ */
+
+#define COMMAND_PERIOD_SIZE 4
+#define COMMAND_URL_MAX 199
+#define COMMAND_SSID_MAX 32
+#define COMMAND_PASS_MAX 64
+#define COMMAND_WIFI_SIZE (COMMAND_SSID_MAX + COMMAND_PASS_MAX)
+#define COMMAND_MAX_WINDOWS 16
+#define COMMAND_WINDOW_SIZE 5
+#define COMMAND_SCHEDULE_SIZE(n) (1 + (n) * COMMAND_WINDOW_SIZE)
+#define COMMAND_OVERRIDE_SIZE 5
+// largest value, a url
+#define COMMAND_MAX_SIZE COMMAND_URL_MAX
+
+#ifdef __cplusplus
+#define COMMAND_FN constexpr
+#else
+#define COMMAND_FN static inline
+#endif
+
+typedef struct command_window_t {
+    uint8_t days;
+    uint8_t start_h;
+    uint8_t start_m;
+    uint8_t end_h;
+    uint8_t end_m;
+} command_window_t;
+
+typedef struct command_schedule_t {
+    uint8_t count;
+    command_window_t window[COMMAND_MAX_WINDOWS];
+} command_schedule_t;
+
+// manual override of the schedule, not kept in NVS
+typedef enum command_override_mode_t {
+    COMMAND_OVERRIDE_NONE, // back to the schedule
+    COMMAND_OVERRIDE_OFF,
+    COMMAND_OVERRIDE_ON,
+} command_override_mode_t;
+
+typedef struct command_override_t {
+    uint8_t mode;
+    uint32_t duration_s;
+} command_override_t;
+
+typedef struct command_wifi_t {
+    char ssid[COMMAND_SSID_MAX + 1];
+    char pass[COMMAND_PASS_MAX + 1];
+} command_wifi_t;
+
+// length of s, or max + 1 if it is longer than max
+COMMAND_FN size_t command_strlen(const char* s, size_t max) {
+    size_t len = 0;
+    while (len <= max && s[len] != '\0') {
+        len++;
+    }
+    return len;
+}
+
+COMMAND_FN bool command_valid_time(int h, int m) {
+    return h >= 0 && h < 24 && m >= 0 && m < 60;
+}
+
+COMMAND_FN size_t command_encode_period(const struct Period* p, uint8_t* out, size_t size) {
+    if (size < COMMAND_PERIOD_SIZE || !command_valid_time(p->start_h, p->start_m) || !command_valid_time(p->end_h, p->end_m)) {
+        return 0;
+    }
+    out[0] = (uint8_t)p->start_h;
+    out[1] = (uint8_t)p->start_m;
+    out[2] = (uint8_t)p->end_h;
+    out[3] = (uint8_t)p->end_m;
+    return COMMAND_PERIOD_SIZE;
+}
+
+COMMAND_FN bool command_decode_period(const uint8_t* in, size_t len, struct Period* p) {
+    if (len != COMMAND_PERIOD_SIZE || !command_valid_time(in[0], in[1]) || !command_valid_time(in[2], in[3])) {
+        return false;
+    }
+    p->start_h = in[0];
+    p->start_m = in[1];
+    p->end_h = in[2];
+    p->end_m = in[3];
+    return true;
+}
+
+COMMAND_FN size_t command_encode_url(const char* url, uint8_t* out, size_t size) {
+    size_t len = command_strlen(url, COMMAND_URL_MAX);
+    if (len == 0 || len > COMMAND_URL_MAX || len > size) {
+        return 0;
+    }
+    for (size_t i = 0; i < len; i++) {
+        out[i] = (uint8_t)url[i];
+    }
+    return len;
+}
+
+// url gets the '\0' too, so it holds COMMAND_URL_MAX + 1 bytes
+COMMAND_FN bool command_decode_url(const uint8_t* in, size_t len, char* url, size_t size) {
+    if (len == 0 || len > COMMAND_URL_MAX || len >= size) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (in[i] == '\0') {
+            return false;
+        }
+        url[i] = (char)in[i];
+    }
+    url[len] = '\0';
+    return true;
+}
+
+COMMAND_FN size_t command_encode_wifi(const char* ssid, const char* pass, uint8_t* out, size_t size) {
+    size_t ssid_len = command_strlen(ssid, COMMAND_SSID_MAX);
+    size_t pass_len = command_strlen(pass, COMMAND_PASS_MAX);
+    if (size < COMMAND_WIFI_SIZE || ssid_len > COMMAND_SSID_MAX || pass_len > COMMAND_PASS_MAX) {
+        return 0;
+    }
+    for (size_t i = 0; i < COMMAND_SSID_MAX; i++) {
+        out[i] = i < ssid_len ? (uint8_t)ssid[i] : 0;
+    }
+    for (size_t i = 0; i < COMMAND_PASS_MAX; i++) {
+        out[COMMAND_SSID_MAX + i] = i < pass_len ? (uint8_t)pass[i] : 0;
+    }
+    return COMMAND_WIFI_SIZE;
+}
+
+COMMAND_FN bool command_decode_wifi(const uint8_t* in, size_t len, command_wifi_t* wifi) {
+    if (len != COMMAND_WIFI_SIZE) {
+        return false;
+    }
+    for (size_t i = 0; i < COMMAND_SSID_MAX; i++) {
+        wifi->ssid[i] = (char)in[i];
+    }
+    for (size_t i = 0; i < COMMAND_PASS_MAX; i++) {
+        wifi->pass[i] = (char)in[COMMAND_SSID_MAX + i];
+    }
+    wifi->ssid[COMMAND_SSID_MAX] = '\0';
+    wifi->pass[COMMAND_PASS_MAX] = '\0';
+    return true;
+}
+
+COMMAND_FN bool command_valid_window(const command_window_t* w) {
+    return w->days < 0x80 && command_valid_time(w->start_h, w->start_m) && command_valid_time(w->end_h, w->end_m);
+}
+
+COMMAND_FN size_t command_encode_schedule(const command_schedule_t* sched, uint8_t* out, size_t size) {
+    if (sched->count > COMMAND_MAX_WINDOWS || size < (size_t)COMMAND_SCHEDULE_SIZE(sched->count)) {
+        return 0;
+    }
+    out[0] = sched->count;
+    for (int i = 0; i < sched->count; i++) {
+        const command_window_t* w = &sched->window[i];
+        uint8_t* p = out + COMMAND_SCHEDULE_SIZE(i);
+        if (!command_valid_window(w)) {
+            return 0;
+        }
+        p[0] = w->days;
+        p[1] = w->start_h;
+        p[2] = w->start_m;
+        p[3] = w->end_h;
+        p[4] = w->end_m;
+    }
+    return COMMAND_SCHEDULE_SIZE(sched->count);
+}
+
+// the windows past count are cleared, so that equal schedules compare equal
+COMMAND_FN bool command_decode_schedule(const uint8_t* in, size_t len, command_schedule_t* sched) {
+    if (len < 1 || in[0] > COMMAND_MAX_WINDOWS || len != (size_t)COMMAND_SCHEDULE_SIZE(in[0])) {
+        return false;
+    }
+    sched->count = in[0];
+    for (int i = 0; i < COMMAND_MAX_WINDOWS; i++) {
+        command_window_t* w = &sched->window[i];
+        w->days = w->start_h = w->start_m = w->end_h = w->end_m = 0;
+        if (i < sched->count) {
+            const uint8_t* p = in + COMMAND_SCHEDULE_SIZE(i);
+            w->days = p[0];
+            w->start_h = p[1];
+            w->start_m = p[2];
+            w->end_h = p[3];
+            w->end_m = p[4];
+        }
+        if (!command_valid_window(w)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// a duration without a mode to override makes no sense
+COMMAND_FN bool command_valid_override(const command_override_t* o) {
+    return o->mode <= COMMAND_OVERRIDE_ON && (o->mode != COMMAND_OVERRIDE_NONE || o->duration_s == 0);
+}
+
+COMMAND_FN size_t command_encode_override(const command_override_t* o, uint8_t* out, size_t size) {
+    if (size < COMMAND_OVERRIDE_SIZE || !command_valid_override(o)) {
+        return 0;
+    }
+    out[0] = o->mode;
+    for (int i = 0; i < 4; i++) {
+        out[1 + i] = (uint8_t)(o->duration_s >> (8 * i));
+    }
+    return COMMAND_OVERRIDE_SIZE;
+}
+
+COMMAND_FN bool command_decode_override(const uint8_t* in, size_t len, command_override_t* o) {
+    if (len != COMMAND_OVERRIDE_SIZE) {
+        return false;
+    }
+    o->mode = in[0];
+    o->duration_s = 0;
+    for (int i = 0; i < 4; i++) {
+        o->duration_s |= (uint32_t)in[1 + i] << (8 * i);
+    }
+    return command_valid_override(o);
+}
+
+#ifdef __cplusplus
+extern "C++" {
+template <size_t N>
+constexpr size_t command_encode_period(const struct Period* p, uint8_t (&out)[N]) {
+    static_assert(N >= COMMAND_PERIOD_SIZE, "buffer too small for a period");
+    return command_encode_period(p, out, N);
+}
+
+template <size_t N>
+constexpr size_t command_encode_url(const char* url, uint8_t (&out)[N]) {
+    static_assert(N >= COMMAND_URL_MAX, "buffer too small for a url");
+    return command_encode_url(url, out, N);
+}
+
+template <size_t N>
+constexpr size_t command_encode_wifi(const char* ssid, const char* pass, uint8_t (&out)[N]) {
+    static_assert(N >= COMMAND_WIFI_SIZE, "buffer too small for the wifi credentials");
+    return command_encode_wifi(ssid, pass, out, N);
+}
+
+template <size_t N>
+constexpr size_t command_encode_schedule(const command_schedule_t* sched, uint8_t (&out)[N]) {
+    static_assert(N >= COMMAND_SCHEDULE_SIZE(COMMAND_MAX_WINDOWS), "buffer too small for a schedule");
+    return command_encode_schedule(sched, out, N);
+}
+
+template <size_t N>
+constexpr size_t command_encode_override(const command_override_t* o, uint8_t (&out)[N]) {
+    static_assert(N >= COMMAND_OVERRIDE_SIZE, "buffer too small for an override");
+    return command_encode_override(o, out, N);
+}
+
+template <size_t N>
+constexpr bool command_decode_url(const uint8_t* in, size_t len, char (&url)[N]) {
+    static_assert(N > COMMAND_URL_MAX, "buffer too small for a url");
+    return command_decode_url(in, len, url, N);
+}
+}
+#endif
+
+#endif
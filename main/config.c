@@ -0,0 +1,200 @@
+#include <string.h>
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+
+#include "sdkconfig.h"
+#include "config.h"
+#include "static_alloc.h"
+#include "period.h"
+#include "schedule.h"
+#include "wifi.h"
+
+#define TAG "Config"
+#define MAX_LISTENERS 8
+
+typedef enum config_type_t {
+    CFG_TYPE_STR,
+    CFG_TYPE_BLOB
+} config_type_t;
+
+static struct config_values {
+    char ssid[33];
+    char pass[65];
+    char url[200];
+    struct Period period;
+    schedule_spec_t schedule;
+    wifi_ap_t wifi_ap;
+    uint32_t seq;
+} s_values = {
+    // defaults, until loaded from NVS
+    .ssid = CONFIG_ESP_WIFI_SSID,
+    .pass = CONFIG_ESP_WIFI_PASSWORD,
+    .url = "http://palantir/thermo/update-sensor.php",
+    .period = { 7, 0, 22, 0 },
+    .schedule = { 0 }, // use period
+    .wifi_ap = { .channel = 0 }, // scan
+    .seq = 0,
+};
+
+typedef struct config_desc_t {
+    const char* nvs_key;
+    config_type_t type;
+    size_t offset;
+    size_t size;
+} config_desc_t;
+
+#define FIELD(f) offsetof(struct config_values, f), sizeof(((struct config_values*)0)->f)
+
+static const config_desc_t s_desc[CFG_COUNT] = {
+    [CFG_SSID] = { "ssid", CFG_TYPE_STR, FIELD(ssid) },
+    [CFG_PASS] = { "pass", CFG_TYPE_STR, FIELD(pass) },
+    [CFG_URL] = { "adress", CFG_TYPE_STR, FIELD(url) },
+    [CFG_PERIOD] = { "period", CFG_TYPE_BLOB, FIELD(period) },
+    [CFG_SCHEDULE] = { "schedule", CFG_TYPE_BLOB, FIELD(schedule) },
+    [CFG_WIFI_AP] = { "wifi_ap", CFG_TYPE_BLOB, FIELD(wifi_ap) },
+    [CFG_SEQ] = { "seq", CFG_TYPE_BLOB, FIELD(seq) },
+};
+
+typedef struct config_subscription_t {
+    config_key_t key;
+    config_listener_t listener;
+    void* arg;
+} config_subscription_t;
+
+static SemaphoreHandle_t s_mutex = NULL;
+static uint32_t s_dirty = 0; // one bit per key
+static config_subscription_t s_subs[MAX_LISTENERS];
+static int s_sub_count = 0;
+
+static void* value_ptr(config_key_t key) {
+    return (uint8_t*)&s_values + s_desc[key].offset;
+}
+
+esp_err_t config_init(void) {
+    s_mutex = BME_MUTEX_CREATE();
+    if (s_mutex == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open("storage", NVS_READONLY, &handle);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        ESP_LOGI(TAG, "Nothing saved yet. Falling back to default");
+        return ESP_OK;
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error (%s) opening NVS handle. Falling back to default...", esp_err_to_name(err));
+        return err;
+    }
+    for (int key = 0; key < CFG_COUNT; key++) {
+        const config_desc_t* desc = &s_desc[key];
+        size_t len = desc->size;
+        if (desc->type == CFG_TYPE_STR) {
+            err = nvs_get_str(handle, desc->nvs_key, value_ptr(key), &len);
+        } else {
+            err = nvs_get_blob(handle, desc->nvs_key, value_ptr(key), &len);
+        }
+        switch (err) {
+            case ESP_OK:
+                ESP_LOGI(TAG, "Key %s loaded", desc->nvs_key);
+                break;
+            case ESP_ERR_NVS_NOT_FOUND:
+                ESP_LOGI(TAG, "Key %s not set yet. Falling back to default", desc->nvs_key);
+                break;
+            default:
+                ESP_LOGE(TAG, "Error (%s) reading key %s", esp_err_to_name(err), desc->nvs_key);
+        }
+    }
+    nvs_close(handle);
+    return ESP_OK;
+}
+
+esp_err_t config_get(config_key_t key, void* out, size_t size) {
+    if (key >= CFG_COUNT || size < s_desc[key].size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    memcpy(out, value_ptr(key), s_desc[key].size);
+    xSemaphoreGive(s_mutex);
+    return ESP_OK;
+}
+
+esp_err_t config_set(config_key_t key, const void* value, size_t size) {
+    if (key >= CFG_COUNT || size > s_desc[key].size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    const config_desc_t* desc = &s_desc[key];
+    if (desc->type == CFG_TYPE_STR ? memchr(value, '\0', size) == NULL : size != desc->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    memset(value_ptr(key), 0, desc->size);
+    memcpy(value_ptr(key), value, size);
+    s_dirty |= 1 << key;
+    xSemaphoreGive(s_mutex);
+    return ESP_OK;
+}
+
+esp_err_t config_commit(void) {
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    uint32_t dirty = s_dirty;
+    if (dirty == 0) {
+        xSemaphoreGive(s_mutex);
+        return ESP_OK;
+    }
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open("storage", NVS_READWRITE, &handle);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error %s opening NVS", esp_err_to_name(err));
+        xSemaphoreGive(s_mutex);
+        return err;
+    }
+    for (int key = 0; key < CFG_COUNT && err == ESP_OK; key++) {
+        if (!(dirty & (1 << key))) {
+            continue;
+        }
+        const config_desc_t* desc = &s_desc[key];
+        if (desc->type == CFG_TYPE_STR) {
+            err = nvs_set_str(handle, desc->nvs_key, value_ptr(key));
+        } else {
+            err = nvs_set_blob(handle, desc->nvs_key, value_ptr(key), desc->size);
+        }
+        ESP_LOGI(TAG, "NVS set %s: %s", desc->nvs_key, esp_err_to_name(err));
+    }
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+        ESP_LOGI(TAG, "NVS commit: %s", esp_err_to_name(err));
+    }
+    nvs_close(handle);
+    if (err == ESP_OK) {
+        s_dirty = 0;
+    }
+    xSemaphoreGive(s_mutex);
+
+    // the RAM copy is the one read, so listeners are told even if NVS failed
+    for (int i = 0; i < s_sub_count; i++) {
+        if (dirty & (1 << s_subs[i].key)) {
+            s_subs[i].listener(s_subs[i].key, s_subs[i].arg);
+        }
+    }
+    return err;
+}
+
+esp_err_t config_subscribe(config_key_t key, config_listener_t listener, void* arg) {
+    if (key >= CFG_COUNT || listener == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    xSemaphoreTake(s_mutex, portMAX_DELAY);
+    if (s_sub_count == MAX_LISTENERS) {
+        xSemaphoreGive(s_mutex);
+        return ESP_ERR_NO_MEM;
+    }
+    s_subs[s_sub_count++] = (config_subscription_t) { key, listener, arg };
+    xSemaphoreGive(s_mutex);
+    return ESP_OK;
+}
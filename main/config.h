@@ -0,0 +1,33 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+#include <stddef.h>
+#include "esp_err.h"
+
+/* Settings kept in NVS. They are loaded once at boot and read from RAM;
+ * config_set() only changes the RAM copy, and config_commit() writes every
+ * changed key with a single NVS commit, then calls the listeners of those keys.
+ */
+
+typedef enum config_key_t {
+    CFG_SSID,   // string, 32 chars max
+    CFG_PASS,   // string, 64 chars max
+    CFG_URL,    // string, 199 chars max
+    CFG_PERIOD, // struct Period
+    CFG_SCHEDULE, // schedule_spec_t
+    CFG_WIFI_AP,  // wifi_ap_t
+    CFG_SEQ,      // uint32_t, sequence numbers reserved by the uploader
+    CFG_COUNT
+} config_key_t;
+
+typedef void (*config_listener_t)(config_key_t key, void* arg);
+
+// needs nvs_flash_init()
+esp_err_t config_init(void);
+// copies the value of key in out, which holds size bytes
+esp_err_t config_get(config_key_t key, void* out, size_t size);
+// size is the size of the blob, or of the string with its terminating '\0'
+esp_err_t config_set(config_key_t key, const void* value, size_t size);
+esp_err_t config_commit(void);
+esp_err_t config_subscribe(config_key_t key, config_listener_t listener, void* arg);
+
+#endif
@@ -0,0 +1,469 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include "command.h"
+
+/* Control protocol on CONFIG_EXAMPLE_PORT.
+ *
+ * v1: one command per datagram, the first byte being the command, and the
+ * device echoes the datagram when it accepts it, or answers "invalid".
+ *
+ * v2: several commands per datagram. Header only, shared with client.cpp.
+ *   0 u8  CONTROL_MAGIC (never a v1 command)
+ *   1 u8  CONTROL_VERSION
+ *   2 u16 sequence number, little endian, chosen by the client
+ *   4 u8  number of commands
+ * then for each command:
+ *   u8 command, u8 length, value (the payload of the same v1 command)
+ * The response has the same header with one status byte per command.
+ * A count of 0 means the datagram itself was refused (unknown version,
+ * truncated, too many commands). Commands are applied only if they are all
+ * valid, with a single NVS commit; a retry with the same sequence number
+ * gets the same response without applying them again.
+ *
+ * Discovery: a client broadcasts CONTROL_DISCOVER_MAGIC, CONTROL_VERSION
+ * and a u16 sequence number. Every device answers it with:
+ *   0 u8  CONTROL_DISCOVER_MAGIC
+ *   1 u8  CONTROL_VERSION
+ *   2 u16 sequence number of the probe
+ *   4 u16 CONFIG_BME_ID
+ *   6 u8  MAC of the station, 6 bytes
+ *  12 u8  period, as the value of CONTROL_PERIOD
+ *  16 u8  windows of the weekly schedule, 0 if the period is used
+ *  17 u8  length of the firmware version, then the version
+ *
+ * Queries: CONTROL_QUERY_MAGIC, CONTROL_VERSION, a u16 sequence number and
+ * the u8 query. The answer repeats these 5 bytes, followed by:
+ *   CONTROL_QUERY_PROFILE  u8 reset reason (esp_reset_reason_t), u8 boot
+ *                          flags (CONTROL_BOOT_*), u8 number of phases, then
+ *                          per phase (control_phase_name) the u32 ms since
+ *                          boot, CONTROL_PHASE_NONE if not reached yet
+ *   CONTROL_QUERY_METRICS  u8 number of counters, u8 number of gauges,
+ *                          u8 number of latency buckets, then a u32 per
+ *                          counter (control_counter_t), gauge
+ *                          (control_gauge_t) and bucket (uploads of at most
+ *                          control_latency_bound() ms, not cumulative),
+ *                          then the u32 sum of the upload latencies in ms
+ *   CONTROL_QUERY_OVERRIDE u8 mode (command_override_mode_t), u32 seconds
+ *                          until it expires, 0 for never, u32 relay state
+ *                          (bit i set if the load of channel i is powered)
+ * An unknown query gets the 5 bytes alone.
+ * All u16 and u32 are little endian.
+ */
+
+#define CONTROL_MAGIC 0xC2
+#define CONTROL_VERSION 2
+#define CONTROL_HEADER_SIZE 5
+#define CONTROL_TLV_HEADER 2
+#define CONTROL_MAX_COMMANDS 4
+#define CONTROL_RESPONSE_SIZE(n) (CONTROL_HEADER_SIZE + (n))
+#define CONTROL_DISCOVER_MAGIC 0xC3
+#define CONTROL_PROBE_SIZE 4
+#define CONTROL_MAC_SIZE 6
+#define CONTROL_VERSION_MAX 31
+#define CONTROL_DEVICE_HEADER 18
+#define CONTROL_DEVICE_MAX_SIZE (CONTROL_DEVICE_HEADER + CONTROL_VERSION_MAX)
+#define CONTROL_QUERY_MAGIC 0xC4
+#define CONTROL_QUERY_SIZE 5
+#define CONTROL_MAX_PHASES 16
+#define CONTROL_PHASE_NONE 0xFFFFFFFF
+#define CONTROL_CLOCK_NONE 0xFFFFFFFF
+#define CONTROL_PROFILE_SIZE(n) (CONTROL_QUERY_SIZE + 3 + 4 * (n))
+#define CONTROL_MAX_METRICS 16
+#define CONTROL_LATENCY_BUCKETS 8
+#define CONTROL_METRICS_SIZE(counters, gauges, buckets) \
+    (CONTROL_QUERY_SIZE + 3 + 4 * ((counters) + (gauges) + (buckets) + 1))
+#define CONTROL_METRICS_MAX_SIZE CONTROL_METRICS_SIZE(CONTROL_MAX_METRICS, CONTROL_MAX_METRICS, CONTROL_LATENCY_BUCKETS)
+#define CONTROL_OVERRIDE_STATE_SIZE (CONTROL_QUERY_SIZE + 9)
+// largest answer to a query
+#define CONTROL_QUERY_MAX_SIZE CONTROL_METRICS_MAX_SIZE
+
+typedef enum control_query_t {
+    CONTROL_QUERY_PROFILE,
+    CONTROL_QUERY_METRICS,
+    CONTROL_QUERY_OVERRIDE,
+} control_query_t;
+
+// counters of the metrics, since boot; new ones go at the end
+typedef enum control_counter_t {
+    CONTROL_UDP_RECEIVED,     // datagrams on the control port
+    CONTROL_UDP_INVALID,      // commands refused
+    CONTROL_UDP_RESTARTS,     // control socket closed and opened again
+    CONTROL_UPLOADS,          // batches posted
+    CONTROL_UPLOAD_FAILURES,
+    CONTROL_UPLOAD_BYTES,     // bodies posted, failed or not
+    CONTROL_RELAY_SWITCHES,   // channels switched by the schedule
+    CONTROL_SCHEDULE_CHECKS,  // evaluations of the schedule
+    CONTROL_WIFI_RECONNECTS,
+    CONTROL_COUNTERS
+} control_counter_t;
+
+// values of the metrics at the time of the query
+typedef enum control_gauge_t {
+    CONTROL_UPTIME_S,
+    CONTROL_HEAP_FREE,
+    CONTROL_HEAP_MIN_FREE,    // lowest since boot
+    CONTROL_STACK_BMX,        // stack never used by the task, bytes
+    CONTROL_STACK_UDP,
+    CONTROL_STACK_LIGHT,
+    CONTROL_CLOCK_SYNC_AGE_S, // since the last SNTP sync, CONTROL_CLOCK_NONE before
+    CONTROL_CLOCK_DRIFT_US,   // int32_t: correction of the last sync, + if the clock was late
+    CONTROL_GAUGES
+} control_gauge_t;
+
+// boot flags of the profile
+#define CONTROL_BOOT_CACHED_AP 0x01 // tried the AP of the last boot
+#define CONTROL_BOOT_FULL_SCAN 0x02 // scanned every channel
+#define CONTROL_BOOT_STATIC_IP 0x04 // no DHCP
+
+// values: see command.h
+typedef enum control_command_type_t {
+    CONTROL_PERIOD,
+    CONTROL_URL,
+    CONTROL_WIFI,
+    CONTROL_SCHEDULE,
+    CONTROL_OVERRIDE,
+} control_command_type_t;
+
+typedef enum control_status_t {
+    CONTROL_OK,
+    CONTROL_INVALID,     // bad value
+    CONTROL_UNKNOWN,     // unknown command
+    CONTROL_NOT_APPLIED, // valid, but another command of the datagram is not
+    CONTROL_STORAGE,     // valid, but NVS failed
+} control_status_t;
+
+typedef struct control_header_t {
+    uint8_t version;
+    uint16_t seq;
+    uint8_t count;
+} control_header_t;
+
+// answer to a discovery probe
+typedef struct control_device_t {
+    uint16_t seq;
+    uint16_t id;
+    uint8_t mac[CONTROL_MAC_SIZE];
+    struct Period period;
+    uint8_t windows;
+    char version[CONTROL_VERSION_MAX + 1];
+} control_device_t;
+
+// boot profile, times in ms since boot
+typedef struct control_profile_t {
+    uint8_t reset_reason;
+    uint8_t flags;
+    uint8_t count;
+    uint32_t ms[CONTROL_MAX_PHASES];
+} control_profile_t;
+
+typedef struct control_metrics_t {
+    uint8_t counters;
+    uint8_t gauges;
+    uint8_t buckets;
+    uint32_t counter[CONTROL_MAX_METRICS];
+    uint32_t gauge[CONTROL_MAX_METRICS];
+    uint32_t bucket[CONTROL_LATENCY_BUCKETS];
+    uint32_t latency_sum_ms;
+} control_metrics_t;
+
+typedef struct control_override_state_t {
+    uint8_t mode;
+    uint32_t remaining_s;
+    uint32_t relays;
+} control_override_state_t;
+
+typedef struct control_command_t {
+    uint8_t type;
+    uint8_t len;
+    const uint8_t* value;
+} control_command_t;
+
+static inline void control_put16(uint8_t* p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static inline uint16_t control_get16(const uint8_t* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline bool control_is_v2(const uint8_t* in, size_t len) {
+    return len > 0 && in[0] == CONTROL_MAGIC;
+}
+
+static inline void control_put32(uint8_t* p, uint32_t v) {
+    control_put16(p, (uint16_t)v);
+    control_put16(p + 2, (uint16_t)(v >> 16));
+}
+
+static inline uint32_t control_get32(const uint8_t* p) {
+    return control_get16(p) | ((uint32_t)control_get16(p + 2) << 16);
+}
+
+static inline void control_encode_header(uint16_t seq, uint8_t count, uint8_t* out) {
+    out[0] = CONTROL_MAGIC;
+    out[1] = CONTROL_VERSION;
+    control_put16(out + 2, seq);
+    out[4] = count;
+}
+
+static inline bool control_decode_header(const uint8_t* in, size_t len, control_header_t* h) {
+    if (len < CONTROL_HEADER_SIZE || in[0] != CONTROL_MAGIC) {
+        return false;
+    }
+    h->version = in[1];
+    h->seq = control_get16(in + 2);
+    h->count = in[4];
+    return true;
+}
+
+// returns the size of the command, 0 if out is too small
+static inline size_t control_encode_command(uint8_t type, const void* value, uint8_t len, uint8_t* out, size_t size) {
+    if (size < (size_t)CONTROL_TLV_HEADER + len) {
+        return 0;
+    }
+    out[0] = type;
+    out[1] = len;
+    for (uint8_t i = 0; i < len; i++) {
+        out[CONTROL_TLV_HEADER + i] = ((const uint8_t*)value)[i];
+    }
+    return CONTROL_TLV_HEADER + len;
+}
+
+/* Splits the commands following the header of a v2 datagram.
+ * False if they do not fill the datagram exactly or are more than max.
+ */
+static inline bool control_decode_commands(const uint8_t* in, size_t len, const control_header_t* h,
+        control_command_t* cmds, int max) {
+    if (h->count > max) {
+        return false;
+    }
+    size_t pos = CONTROL_HEADER_SIZE;
+    for (int i = 0; i < h->count; i++) {
+        if (pos + CONTROL_TLV_HEADER > len || pos + CONTROL_TLV_HEADER + in[pos + 1] > len) {
+            return false;
+        }
+        cmds[i].type = in[pos];
+        cmds[i].len = in[pos + 1];
+        cmds[i].value = in + pos + CONTROL_TLV_HEADER;
+        pos += CONTROL_TLV_HEADER + cmds[i].len;
+    }
+    return pos == len;
+}
+
+static inline size_t control_encode_response(uint16_t seq, const uint8_t* status, uint8_t count, uint8_t* out) {
+    control_encode_header(seq, count, out);
+    for (uint8_t i = 0; i < count; i++) {
+        out[CONTROL_HEADER_SIZE + i] = status[i];
+    }
+    return CONTROL_RESPONSE_SIZE(count);
+}
+
+// status points into in
+static inline bool control_decode_response(const uint8_t* in, size_t len, control_header_t* h, const uint8_t** status) {
+    if (!control_decode_header(in, len, h) || len != CONTROL_RESPONSE_SIZE((size_t)h->count)) {
+        return false;
+    }
+    *status = in + CONTROL_HEADER_SIZE;
+    return true;
+}
+
+static inline bool control_is_probe(const uint8_t* in, size_t len) {
+    return len == CONTROL_PROBE_SIZE && in[0] == CONTROL_DISCOVER_MAGIC && in[1] == CONTROL_VERSION;
+}
+
+static inline size_t control_encode_probe(uint16_t seq, uint8_t* out) {
+    out[0] = CONTROL_DISCOVER_MAGIC;
+    out[1] = CONTROL_VERSION;
+    control_put16(out + 2, seq);
+    return CONTROL_PROBE_SIZE;
+}
+
+// out holds CONTROL_DEVICE_MAX_SIZE bytes; a longer version is cut
+static inline size_t control_encode_device(const control_device_t* d, uint8_t* out) {
+    size_t len = command_strlen(d->version, CONTROL_VERSION_MAX);
+    if (len > CONTROL_VERSION_MAX) {
+        len = CONTROL_VERSION_MAX;
+    }
+    out[0] = CONTROL_DISCOVER_MAGIC;
+    out[1] = CONTROL_VERSION;
+    control_put16(out + 2, d->seq);
+    control_put16(out + 4, d->id);
+    for (int i = 0; i < CONTROL_MAC_SIZE; i++) {
+        out[6 + i] = d->mac[i];
+    }
+    if (command_encode_period(&d->period, out + 12, COMMAND_PERIOD_SIZE) == 0) {
+        out[12] = out[13] = out[14] = out[15] = 0;
+    }
+    out[16] = d->windows;
+    out[17] = (uint8_t)len;
+    for (size_t i = 0; i < len; i++) {
+        out[CONTROL_DEVICE_HEADER + i] = (uint8_t)d->version[i];
+    }
+    return CONTROL_DEVICE_HEADER + len;
+}
+
+static inline bool control_decode_device(const uint8_t* in, size_t len, control_device_t* d) {
+    if (len < CONTROL_DEVICE_HEADER || in[0] != CONTROL_DISCOVER_MAGIC || in[1] != CONTROL_VERSION
+            || in[17] > CONTROL_VERSION_MAX || len != (size_t)CONTROL_DEVICE_HEADER + in[17]
+            || !command_decode_period(in + 12, COMMAND_PERIOD_SIZE, &d->period)) {
+        return false;
+    }
+    d->seq = control_get16(in + 2);
+    d->id = control_get16(in + 4);
+    for (int i = 0; i < CONTROL_MAC_SIZE; i++) {
+        d->mac[i] = in[6 + i];
+    }
+    d->windows = in[16];
+    for (int i = 0; i < in[17]; i++) {
+        d->version[i] = (char)in[CONTROL_DEVICE_HEADER + i];
+    }
+    d->version[in[17]] = '\0';
+    return true;
+}
+
+static inline bool control_is_query(const uint8_t* in, size_t len) {
+    return len == CONTROL_QUERY_SIZE && in[0] == CONTROL_QUERY_MAGIC && in[1] == CONTROL_VERSION;
+}
+
+// a query, or the start of its answer
+static inline size_t control_encode_query(uint16_t seq, uint8_t query, uint8_t* out) {
+    out[0] = CONTROL_QUERY_MAGIC;
+    out[1] = CONTROL_VERSION;
+    control_put16(out + 2, seq);
+    out[4] = query;
+    return CONTROL_QUERY_SIZE;
+}
+
+// true if in answers the query q, which it starts with
+static inline bool control_answers_query(const uint8_t* in, size_t len, const uint8_t* q) {
+    return len >= CONTROL_QUERY_SIZE && in[0] == q[0] && in[1] == q[1] && in[2] == q[2] && in[3] == q[3] && in[4] == q[4];
+}
+
+// out holds CONTROL_PROFILE_SIZE(p->count) bytes
+static inline size_t control_encode_profile(uint16_t seq, const control_profile_t* p, uint8_t* out) {
+    control_encode_query(seq, CONTROL_QUERY_PROFILE, out);
+    out[CONTROL_QUERY_SIZE] = p->reset_reason;
+    out[CONTROL_QUERY_SIZE + 1] = p->flags;
+    out[CONTROL_QUERY_SIZE + 2] = p->count;
+    for (int i = 0; i < p->count; i++) {
+        control_put32(out + CONTROL_QUERY_SIZE + 3 + 4 * i, p->ms[i]);
+    }
+    return CONTROL_PROFILE_SIZE(p->count);
+}
+
+static inline bool control_decode_profile(const uint8_t* in, size_t len, control_profile_t* p) {
+    if (len < CONTROL_PROFILE_SIZE(0) || in[0] != CONTROL_QUERY_MAGIC || in[4] != CONTROL_QUERY_PROFILE) {
+        return false;
+    }
+    p->reset_reason = in[CONTROL_QUERY_SIZE];
+    p->flags = in[CONTROL_QUERY_SIZE + 1];
+    p->count = in[CONTROL_QUERY_SIZE + 2];
+    if (p->count > CONTROL_MAX_PHASES || len != (size_t)CONTROL_PROFILE_SIZE(p->count)) {
+        return false;
+    }
+    for (int i = 0; i < p->count; i++) {
+        p->ms[i] = control_get32(in + CONTROL_QUERY_SIZE + 3 + 4 * i);
+    }
+    return true;
+}
+
+// upper bound of a latency bucket, in ms; the last one holds the rest
+static inline uint32_t control_latency_bound(int bucket) {
+    static const uint32_t bounds[CONTROL_LATENCY_BUCKETS - 1] = { 50, 100, 250, 500, 1000, 2500, 5000 };
+    return bucket < CONTROL_LATENCY_BUCKETS - 1 ? bounds[bucket] : UINT32_MAX;
+}
+
+// out holds CONTROL_METRICS_MAX_SIZE bytes
+static inline size_t control_encode_metrics(uint16_t seq, const control_metrics_t* m, uint8_t* out) {
+    control_encode_query(seq, CONTROL_QUERY_METRICS, out);
+    uint8_t* p = out + CONTROL_QUERY_SIZE;
+    *p++ = m->counters;
+    *p++ = m->gauges;
+    *p++ = m->buckets;
+    for (int i = 0; i < m->counters; i++, p += 4) {
+        control_put32(p, m->counter[i]);
+    }
+    for (int i = 0; i < m->gauges; i++, p += 4) {
+        control_put32(p, m->gauge[i]);
+    }
+    for (int i = 0; i < m->buckets; i++, p += 4) {
+        control_put32(p, m->bucket[i]);
+    }
+    control_put32(p, m->latency_sum_ms);
+    return CONTROL_METRICS_SIZE(m->counters, m->gauges, m->buckets);
+}
+
+static inline bool control_decode_metrics(const uint8_t* in, size_t len, control_metrics_t* m) {
+    if (len < CONTROL_METRICS_SIZE(0, 0, 0) || in[0] != CONTROL_QUERY_MAGIC || in[4] != CONTROL_QUERY_METRICS) {
+        return false;
+    }
+    const uint8_t* p = in + CONTROL_QUERY_SIZE;
+    m->counters = *p++;
+    m->gauges = *p++;
+    m->buckets = *p++;
+    if (m->counters > CONTROL_MAX_METRICS || m->gauges > CONTROL_MAX_METRICS || m->buckets > CONTROL_LATENCY_BUCKETS
+            || len != (size_t)CONTROL_METRICS_SIZE(m->counters, m->gauges, m->buckets)) {
+        return false;
+    }
+    for (int i = 0; i < m->counters; i++, p += 4) {
+        m->counter[i] = control_get32(p);
+    }
+    for (int i = 0; i < m->gauges; i++, p += 4) {
+        m->gauge[i] = control_get32(p);
+    }
+    for (int i = 0; i < m->buckets; i++, p += 4) {
+        m->bucket[i] = control_get32(p);
+    }
+    m->latency_sum_ms = control_get32(p);
+    return true;
+}
+
+static inline size_t control_encode_override_state(uint16_t seq, const control_override_state_t* s, uint8_t* out) {
+    control_encode_query(seq, CONTROL_QUERY_OVERRIDE, out);
+    out[CONTROL_QUERY_SIZE] = s->mode;
+    control_put32(out + CONTROL_QUERY_SIZE + 1, s->remaining_s);
+    control_put32(out + CONTROL_QUERY_SIZE + 5, s->relays);
+    return CONTROL_OVERRIDE_STATE_SIZE;
+}
+
+static inline bool control_decode_override_state(const uint8_t* in, size_t len, control_override_state_t* s) {
+    if (len != CONTROL_OVERRIDE_STATE_SIZE || in[0] != CONTROL_QUERY_MAGIC || in[4] != CONTROL_QUERY_OVERRIDE) {
+        return false;
+    }
+    s->mode = in[CONTROL_QUERY_SIZE];
+    s->remaining_s = control_get32(in + CONTROL_QUERY_SIZE + 1);
+    s->relays = control_get32(in + CONTROL_QUERY_SIZE + 5);
+    return true;
+}
+
+// phases of the profile, in the order of boot_phase_t (main/boot.h)
+static inline const char* control_phase_name(int phase) {
+    static const char* const names[] = {
+        "nvs", "config", "wifi start", "connected", "ip", "time sync",
+        "first reading", "first upload", "first relay",
+    };
+    return phase >= 0 && phase < (int)(sizeof(names) / sizeof(names[0])) ? names[phase] : "?";
+}
+
+static inline const char* control_status_name(uint8_t status) {
+    switch (status) {
+        case CONTROL_OK:
+            return "ok";
+        case CONTROL_INVALID:
+            return "invalid";
+        case CONTROL_UNKNOWN:
+            return "unknown command";
+        case CONTROL_NOT_APPLIED:
+            return "not applied";
+        case CONTROL_STORAGE:
+            return "storage error";
+        default:
+            return "?";
+    }
+}
+
+#endif
@@ -1,21 +1,88 @@
+#include <math.h>
+#include <float.h>
+#include <inttypes.h>
+#include <time.h>
+#include <sys/param.h>
 #include "driver/gpio.h"
 #include "driver/i2c.h"
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_sleep.h"
+#include "esp_sntp.h"
+#ifdef CONFIG_BME_HEAP_TRACE
+#include "esp_heap_trace.h"
+#endif
 #include "freertos/task.h"
 
 #include "sdkconfig.h" // generated by "make menuconfig"
 
 #include "bridge.h"
 #include "udp_server.h"
+#include "uploader.h"
+#include "boot.h"
+#include "metrics.h"
+#include "static_alloc.h"
 #include "bmx280.h"
 #define TAG_BME280 "BME280"
 #define BMX280_SDA_NUM GPIO_NUM_13
 #define BMX280_SCL_NUM GPIO_NUM_14
-const TickType_t LOOP_DELAY = 600000 / portTICK_PERIOD_MS;
+// one forced conversion every CONVERSION_PERIOD_US
+#define CONVERSION_PERIOD_US ((uint64_t)CONFIG_BME_SAMPLE_PERIOD * 1000000 / CONFIG_BME_CONVERSIONS)
+// deep sleep mode
+#define SNTP_WAIT_MS 5000
+#define MIN_SLEEP_US 1000000
 
-void bmx_task(void* params)
-{
+/* Running min/max/mean/variance of one quantity (Welford) */
+typedef struct stat_t {
+    uint32_t n;
+    float min;
+    float max;
+    double mean;
+    double m2;
+} stat_t;
+
+static void stat_reset(stat_t* s) {
+    *s = (stat_t) { 0, FLT_MAX, -FLT_MAX, 0, 0 };
+}
+
+static void stat_add(stat_t* s, float v) {
+    s->n++;
+    double delta = v - s->mean;
+    s->mean += delta / s->n;
+    s->m2 += delta * (v - s->mean);
+    s->min = fminf(s->min, v);
+    s->max = fmaxf(s->max, v);
+}
+
+static float stat_stddev(const stat_t* s) {
+    return s->n > 1 ? sqrt(s->m2 / (s->n - 1)) : 0;
+}
+
+static void stat_log(const char* name, const stat_t* s) {
+    ESP_LOGI(TAG_BME280, "%s: n = %" PRIu32 ", min = %f, max = %f, mean = %f, stddev = %f",
+            name, s->n, s->min, s->max, s->mean, stat_stddev(s));
+}
+
+// oversampling setting to number of samples
+static int oversampling(int setting) {
+    return setting == 0 ? 0 : 1 << (setting - 1);
+}
+
+// maximum measurement time of the datasheet (appendix B), in ms
+static int conversion_time_ms(void) {
+    float t = 1.25f + 2.3f * oversampling(CONFIG_BME_TEMP_OVERSAMPLING);
+    if (CONFIG_BME_PRESS_OVERSAMPLING) {
+        t += 2.3f * oversampling(CONFIG_BME_PRESS_OVERSAMPLING) + 0.575f;
+    }
+    if (CONFIG_BME_HUM_OVERSAMPLING) {
+        t += 2.3f * oversampling(CONFIG_BME_HUM_OVERSAMPLING) + 0.575f;
+    }
+    return (int)ceilf(t);
+}
+
+// NULL if the sensor does not answer
+static bmx280_t* sensor_init(void) {
     i2c_config_t i2c_cfg = {
         .mode = I2C_MODE_MASTER,
         .sda_io_num = BMX280_SDA_NUM,
@@ -35,34 +102,205 @@ void bmx_task(void* params)
 
     if (!bmx280) {
         ESP_LOGE("test", "Could not create bmx280 driver.");
-        return;
+        return NULL;
     }
 
     ESP_ERROR_CHECK(bmx280_init(bmx280));
 
-    bmx280_config_t bmx_cfg = BMX280_DEFAULT_CONFIG;
+    bmx280_config_t bmx_cfg = {
+        .t_sampling = (bmx280_tsmpl_t)CONFIG_BME_TEMP_OVERSAMPLING,
+        .p_sampling = (bmx280_psmpl_t)CONFIG_BME_PRESS_OVERSAMPLING,
+        .t_standby = BMX280_STANDBY_0M5, // unused in forced mode
+        .iir_filter = (bmx280_iirf_t)CONFIG_BME_IIR_FILTER,
+        .h_sampling = (bmx280_hsmpl_t)CONFIG_BME_HUM_OVERSAMPLING,
+    };
     ESP_ERROR_CHECK(bmx280_configure(bmx280, &bmx_cfg));
-    ESP_ERROR_CHECK(bmx280_setMode(bmx280, BMX280_MODE_CYCLE));
+    return bmx280;
+}
+
+// one forced conversion, after which the sensor sleeps again
+static void sensor_convert(bmx280_t* bmx280, float* temp, float* pres, float* hum) {
+    ESP_ERROR_CHECK(bmx280_setMode(bmx280, BMX280_MODE_FORCE));
+    vTaskDelay(pdMS_TO_TICKS(conversion_time_ms()) + 1);
+    while (bmx280_isSampling(bmx280)) {
+        vTaskDelay(1);
+    }
+    ESP_ERROR_CHECK(bmx280_readoutFloat(bmx280, temp, pres, hum));
+}
+
+#ifndef CONFIG_BME_DEEP_SLEEP
+#ifdef CONFIG_BME_HEAP_TRACE
+#define HEAP_TRACE_RECORDS 32
+static heap_trace_record_t s_heap_records[HEAP_TRACE_RECORDS];
+
+/* Called after each reading. Once an upload went through, every buffer
+ * and connection of the steady state exists: the next
+ * CONFIG_BME_HEAP_TRACE_CYCLES readings must not allocate. */
+static void heap_trace_cycle(void) {
+    static int s_cycles = -1;
+    if (s_cycles == -1) {
+        if (!boot_reached(BOOT_FIRST_UPLOAD)) {
+            return;
+        }
+        ESP_ERROR_CHECK(heap_trace_init_standalone(s_heap_records, HEAP_TRACE_RECORDS));
+        ESP_ERROR_CHECK(heap_trace_start(HEAP_TRACE_ALL));
+        ESP_LOGI(TAG_BME280, "Heap trace: %d readings", CONFIG_BME_HEAP_TRACE_CYCLES);
+        s_cycles = 0;
+        return;
+    }
+    if (s_cycles < 0 || ++s_cycles < CONFIG_BME_HEAP_TRACE_CYCLES) {
+        return;
+    }
+    heap_trace_stop();
+    size_t count = heap_trace_get_count();
+    if (count == 0) {
+        ESP_LOGI(TAG_BME280, "Heap trace: no allocation in %d readings", s_cycles);
+    } else {
+        ESP_LOGE(TAG_BME280, "Heap trace: %s%u allocations in %d readings",
+                count == HEAP_TRACE_RECORDS ? "at least " : "", (unsigned)count, s_cycles);
+        heap_trace_dump();
+    }
+    s_cycles = -2; // done
+}
+#endif
+
+static void conversion_timer_cb(void* arg) {
+    xTaskNotifyGive((TaskHandle_t)arg);
+}
+
+void bmx_task(void* params)
+{
+    bmx280_t* bmx280 = sensor_init();
+    if (!bmx280) {
+        return;
+    }
+
+    // the sensor sleeps between two conversions triggered by the timer
+    const esp_timer_create_args_t timer_args = {
+        .callback = conversion_timer_cb,
+        .arg = xTaskGetCurrentTaskHandle(),
+        .name = "bmx_conversion",
+    };
+    esp_timer_handle_t timer;
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &timer));
+    ESP_ERROR_CHECK(esp_timer_start_periodic(timer, CONVERSION_PERIOD_US));
+    ESP_LOGI(TAG_BME280, "%d conversions every %d s, %d ms each",
+            CONFIG_BME_CONVERSIONS, CONFIG_BME_SAMPLE_PERIOD, conversion_time_ms());
+
+    stat_t temp_stat, pres_stat, hum_stat;
+    stat_reset(&temp_stat);
+    stat_reset(&pres_stat);
+    stat_reset(&hum_stat);
+    // first reading at boot, as the cycle mode did
+    xTaskNotifyGive(xTaskGetCurrentTaskHandle());
 
     float temp = 0, pres = 0, hum = 0;
+    // the profile is logged once the first reading is sent
+    bool first_reading = false;
     while (1)
     {
-        do {
-            vTaskDelay(pdMS_TO_TICKS(1));
-        } while(bmx280_isSampling(bmx280));
+        // ticks missed during an upload are merged
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
 
-        ESP_ERROR_CHECK(bmx280_readoutFloat(bmx280, &temp, &pres, &hum));
+        sensor_convert(bmx280, &temp, &pres, &hum);
+        first_reading = boot_mark(BOOT_FIRST_READING) || first_reading;
+        stat_add(&temp_stat, temp);
+        stat_add(&pres_stat, pres);
+        stat_add(&hum_stat, hum);
+        if (temp_stat.n < CONFIG_BME_CONVERSIONS) {
+            continue;
+        }
 
-        ESP_LOGI(TAG_BME280, "Read Values: temp = %f, pres = %f, hum = %f", temp, pres, hum);
-        _bme280_res res = { temp, pres, hum };
+        if (CONFIG_BME_CONVERSIONS > 1) {
+            stat_log("temp", &temp_stat);
+            stat_log("pres", &pres_stat);
+            stat_log("hum", &hum_stat);
+        }
+        _bme280_res res = { temp_stat.mean, pres_stat.mean, hum_stat.mean };
+        ESP_LOGI(TAG_BME280, "Read Values: temp = %f, pres = %f, hum = %f", res.temp, res.press, res.hum);
         send_data(&res);
-        vTaskDelay(LOOP_DELAY);
+        if (first_reading) {
+            boot_log();
+            first_reading = false;
+        }
+#ifdef CONFIG_BME_HEAP_TRACE
+        heap_trace_cycle();
+#endif
+        stat_reset(&temp_stat);
+        stat_reset(&pres_stat);
+        stat_reset(&hum_stat);
     }
 }
 
 void app_main(void) {
     init();
     init_udp_and_lamp();
-    xTaskCreate(&bmx_task, "bmxtask", 4048, NULL, 6, NULL);
+    metrics_task(CONTROL_STACK_BMX, BME_TASK_CREATE(&bmx_task, "bmxtask", 4048, NULL, 6));
 }
+#else
+static TaskHandle_t s_main_task;
 
+static void time_synced(struct timeval* tv) {
+    boot_mark(BOOT_TIME_SYNC);
+    xTaskNotifyGive(s_main_task);
+}
+
+// the RTC keeps the time during deep sleep: SNTP is needed after a reset only
+static void sync_time(void) {
+    if (time(NULL) > 1600000000) {
+        return;
+    }
+    s_main_task = xTaskGetCurrentTaskHandle();
+    sntp_setoperatingmode(SNTP_OPMODE_POLL);
+    sntp_setservername(0, "pool.ntp.org");
+    sntp_set_time_sync_notification_cb(time_synced);
+    sntp_init();
+    if (ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(SNTP_WAIT_MS)) == 0) {
+        ESP_LOGE(TAG_BME280, "Time not synchronized");
+    }
+    sntp_stop();
+}
+
+/* Sensor-only node: one reading per wake, then deep sleep until the next.
+ * The conversions are taken back to back. The readings wait in RTC memory
+ * (see uploader.c) until a batch is full, so that the other wakes do not
+ * start the Wi-Fi. */
+void app_main(void) {
+    bool reset = esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_TIMER;
+    bmx280_t* bmx280 = sensor_init();
+    if (bmx280) {
+        stat_t temp_stat, pres_stat, hum_stat;
+        stat_reset(&temp_stat);
+        stat_reset(&pres_stat);
+        stat_reset(&hum_stat);
+        for (int i = 0; i < CONFIG_BME_CONVERSIONS; i++) {
+            float temp, pres, hum;
+            sensor_convert(bmx280, &temp, &pres, &hum);
+            boot_mark(BOOT_FIRST_READING);
+            stat_add(&temp_stat, temp);
+            stat_add(&pres_stat, pres);
+            stat_add(&hum_stat, hum);
+        }
+        if (CONFIG_BME_CONVERSIONS > 1) {
+            stat_log("temp", &temp_stat);
+            stat_log("pres", &pres_stat);
+            stat_log("hum", &hum_stat);
+        }
+        _bme280_res res = { temp_stat.mean, pres_stat.mean, hum_stat.mean };
+        ESP_LOGI(TAG_BME280, "Read Values: temp = %f, pres = %f, hum = %f", res.temp, res.press, res.hum);
+
+        // after a reset, the clock must be set before the first reading is timed
+        if (reset || uploader_batched() + 1 >= CONFIG_UPLOAD_BATCH_SIZE) {
+            init();
+            sync_time();
+        }
+        send_data(&res);
+        boot_log();
+    }
+
+    int64_t sleep_us = MAX((int64_t)CONFIG_BME_SAMPLE_PERIOD * 1000000 - esp_timer_get_time(), MIN_SLEEP_US);
+    ESP_LOGI(TAG_BME280, "Sleeping %" PRId64 " ms", sleep_us / 1000);
+    esp_sleep_enable_timer_wakeup(sleep_us);
+    esp_deep_sleep_start();
+}
+#endif
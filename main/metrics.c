@@ -0,0 +1,58 @@
+#include <stdatomic.h>
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#include "metrics.h"
+#include "clock.h"
+
+_Static_assert(CONTROL_COUNTERS <= CONTROL_MAX_METRICS, "too many counters");
+_Static_assert(CONTROL_GAUGES <= CONTROL_MAX_METRICS, "too many gauges");
+
+static atomic_uint_least32_t s_counter[CONTROL_COUNTERS];
+static atomic_uint_least32_t s_bucket[CONTROL_LATENCY_BUCKETS];
+static atomic_uint_least32_t s_latency_sum_ms;
+static TaskHandle_t volatile s_task[CONTROL_GAUGES];
+
+void metrics_add(control_counter_t counter, uint32_t n) {
+    atomic_fetch_add_explicit(&s_counter[counter], n, memory_order_relaxed);
+}
+
+void metrics_latency(uint32_t ms) {
+    int i = 0;
+    while (ms > control_latency_bound(i)) {
+        i++;
+    }
+    atomic_fetch_add_explicit(&s_bucket[i], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&s_latency_sum_ms, ms, memory_order_relaxed);
+}
+
+void metrics_task(control_gauge_t gauge, TaskHandle_t task) {
+    s_task[gauge] = task;
+}
+
+void metrics_snapshot(control_metrics_t* m) {
+    m->counters = CONTROL_COUNTERS;
+    for (int i = 0; i < CONTROL_COUNTERS; i++) {
+        m->counter[i] = atomic_load_explicit(&s_counter[i], memory_order_relaxed);
+    }
+    m->buckets = CONTROL_LATENCY_BUCKETS;
+    for (int i = 0; i < CONTROL_LATENCY_BUCKETS; i++) {
+        m->bucket[i] = atomic_load_explicit(&s_bucket[i], memory_order_relaxed);
+    }
+    m->latency_sum_ms = atomic_load_explicit(&s_latency_sum_ms, memory_order_relaxed);
+
+    m->gauges = CONTROL_GAUGES;
+    m->gauge[CONTROL_UPTIME_S] = (uint32_t)(esp_timer_get_time() / 1000000);
+    m->gauge[CONTROL_HEAP_FREE] = esp_get_free_heap_size();
+    m->gauge[CONTROL_HEAP_MIN_FREE] = esp_get_minimum_free_heap_size();
+    for (int i = CONTROL_STACK_BMX; i <= CONTROL_STACK_LIGHT; i++) {
+        TaskHandle_t task = s_task[i];
+        // counted in StackType_t, a byte on the ESP32
+        m->gauge[i] = task != NULL ? uxTaskGetStackHighWaterMark(task) * sizeof(StackType_t) : 0;
+    }
+    uint32_t age_s;
+    int32_t drift_us;
+    bool synced = clock_status(&age_s, &drift_us);
+    m->gauge[CONTROL_CLOCK_SYNC_AGE_S] = synced ? age_s : CONTROL_CLOCK_NONE;
+    m->gauge[CONTROL_CLOCK_DRIFT_US] = (uint32_t)drift_us;
+}
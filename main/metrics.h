@@ -0,0 +1,21 @@
+#ifndef METRICS_H
+#define METRICS_H
+#include <stdint.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "control.h"
+
+/* Counters and latencies updated from the hot paths, served on the control
+ * port (CONTROL_QUERY_METRICS). Lock-free: every update is one relaxed
+ * atomic add, so that any task may call them.
+ */
+
+void metrics_add(control_counter_t counter, uint32_t n);
+// one upload that took ms
+void metrics_latency(uint32_t ms);
+// task whose stack watermark is the gauge; NULL once the task is deleted
+void metrics_task(control_gauge_t gauge, TaskHandle_t task);
+// the counters, with the gauges read now
+void metrics_snapshot(control_metrics_t* m);
+
+#endif
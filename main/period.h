@@ -0,0 +1,12 @@
+#ifndef PERIOD_H
+#define PERIOD_H
+
+// daily time window during which the relay is on
+struct Period {
+  int start_h;
+  int start_m;
+  int end_h;
+  int end_m;
+};
+
+#endif
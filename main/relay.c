@@ -13,90 +13,151 @@
 #include "esp_flash.h"
 #include "esp_system.h"
 #include "driver/gpio.h"
+#include "soc/gpio_reg.h"
 #include "relay.h"
 
 #define TAG "Relay"
-bool IS_RELAY_ON = true;
 
-bool is_NC_relay_on() {
-    // true if Normally Closed relay is closed,
-    // ie, current is on
-    return IS_RELAY_ON;
+static const relay_channel_t s_channels[] = {
+    // NC relay energized by enabling the pin, which is driven low
+    { GPIO_NUM_19, true, RELAY_NC, RELAY_DRIVE_ENABLE, 0 },
+    // NC relay energized through a transistor. Set schedule to 0 to switch it
+    { GPIO_NUM_21, false, RELAY_NC, RELAY_DRIVE_LEVEL, RELAY_NO_SCHEDULE },
+};
+
+#define CHANNEL_COUNT (sizeof(s_channels) / sizeof(s_channels[0]))
+
+static portMUX_TYPE s_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t s_state = 0;
+
+int relay_count(void) {
+    return CHANNEL_COUNT;
 }
 
+static bool coil_energized(const relay_channel_t* ch, bool on) {
+    return ch->mode == RELAY_NC ? !on : on;
+}
 
-esp_err_t switch_off_NC_relay() {
-    esp_err_t err = gpio_set_direction(PIN, GPIO_MODE_INPUT_OUTPUT);
-    if (err != ESP_OK) {
-        return err;
-    }
-    err = gpio_set_level(PIN, 0);
-    if (err != ESP_OK) {
-        return err;
+esp_err_t relay_init(void) {
+    uint32_t all = 0;
+    for (int i = 0; i < CHANNEL_COUNT; i++) {
+        const relay_channel_t* ch = &s_channels[i];
+        if (ch->pin >= 32) {
+            ESP_LOGE(TAG, "Channel %d: GPIO%d is not in the first bank", i, ch->pin);
+            return ESP_ERR_INVALID_ARG;
+        }
+        esp_rom_gpio_pad_select_gpio(ch->pin);
+        if (ch->drive == RELAY_DRIVE_ENABLE) {
+            // the level stays the active one, the output is enabled to energize
+            gpio_set_level(ch->pin, !ch->active_low);
+            gpio_set_direction(ch->pin, GPIO_MODE_DISABLE);
+        } else {
+            gpio_set_level(ch->pin, ch->active_low);
+            gpio_set_direction(ch->pin, GPIO_MODE_INPUT_OUTPUT);
+        }
+        all |= 1u << i;
     }
-    IS_RELAY_ON = false;
-    return ESP_OK;
+    // force every channel to be written, without setting the bits past them
+    s_state = 0;
+    return relay_apply(all, all);
 }
 
-esp_err_t switch_on_NC_relay() {
-    esp_err_t err = gpio_set_direction(PIN, GPIO_MODE_DISABLE);
-    if (err != ESP_OK) {
-        return err;
+esp_err_t relay_apply(uint32_t mask, uint32_t on) {
+    if (mask >> CHANNEL_COUNT) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    portENTER_CRITICAL(&s_lock);
+    uint32_t changed = (s_state ^ on) & mask;
+    uint32_t out_set = 0, out_clear = 0, enable_set = 0, enable_clear = 0;
+    for (int i = 0; changed >> i; i++) {
+        if (!(changed & (1u << i))) {
+            continue;
+        }
+        const relay_channel_t* ch = &s_channels[i];
+        bool energized = coil_energized(ch, on & (1u << i));
+        uint32_t bit = 1u << ch->pin;
+        if (ch->drive == RELAY_DRIVE_ENABLE) {
+            if (energized) {
+                enable_set |= bit;
+            } else {
+                enable_clear |= bit;
+            }
+        } else if (energized != ch->active_low) {
+            out_set |= bit;
+        } else {
+            out_clear |= bit;
+        }
+    }
+    /* The set/clear registers change only their own bits, unlike a write of
+     * GPIO_OUT_REG which would race with gpio_set_level() on other pins. */
+    if (out_set) {
+        REG_WRITE(GPIO_OUT_W1TS_REG, out_set);
+    }
+    if (out_clear) {
+        REG_WRITE(GPIO_OUT_W1TC_REG, out_clear);
+    }
+    if (enable_set) {
+        REG_WRITE(GPIO_ENABLE_W1TS_REG, enable_set);
+    }
+    if (enable_clear) {
+        REG_WRITE(GPIO_ENABLE_W1TC_REG, enable_clear);
     }
-    IS_RELAY_ON = true;
+    s_state = (s_state & ~mask) | (on & mask);
+    portEXIT_CRITICAL(&s_lock);
+#ifdef DEBUG
+    ESP_LOGI(TAG, "Changed 0x%" PRIx32 ", state 0x%" PRIx32, changed, s_state);
+#endif
     return ESP_OK;
 }
 
-esp_err_t switch_NC_relay(bool v) {
-    if (is_NC_relay_on() + v != 1) {
-        // in this case, the relay is off and we want to off it,
-        // or the relay is on and we want to on it
-        // in every case, we must do nothing
-#ifdef DEBUG
-        ESP_LOGI(TAG,"Same state (%d). Do nothing.\n", is_NC_relay_on() + v);
-#endif
-        return ESP_OK;
-    }
-    else if (v) {
-        // we must switch on
-        return switch_on_NC_relay();
-    } else {
-        // switch off
-        // We should use gpio_set_level but actually,
-        // the esp_32 doesnt' work properly and there is enough current
-        // to switch the relay
-        return switch_off_NC_relay();
-    }
+uint32_t relay_state(void) {
+    return s_state;
+}
 
+bool relay_is_on(int channel) {
+    return s_state & (1u << channel);
 }
+
+uint32_t relay_schedule_mask(int schedule) {
+    uint32_t mask = 0;
+    for (int i = 0; i < CHANNEL_COUNT; i++) {
+        if (s_channels[i].schedule == schedule) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+}
+
 #ifdef DEBUG
-#define ON ESP_LOGI(TAG," is_NC_relay_on? %d\n", is_NC_relay_on())
+#define ON ESP_LOGI(TAG," relay state: 0x%" PRIx32 "\n", relay_state())
 #define DELAY vTaskDelay ( 3000 / portTICK_PERIOD_MS)
 void app_main(void)
 {
+    relay_init();
+    uint32_t all = (1u << relay_count()) - 1;
 
     while (1) {
-        ESP_LOGI(TAG,"Relay opened (default)\n");
+        ESP_LOGI(TAG,"Relays on (default)\n");
         ON;
 
         DELAY;
-        ESP_LOGI(TAG,"\nClose NC relay.\n");
-        switch_NC_relay(false);
+        ESP_LOGI(TAG,"\nSwitch off every channel at once.\n");
+        relay_apply(all, 0);
         ON;
 
         DELAY;
-        ESP_LOGI(TAG,"\nClose again NC relay. Supposed to do nothing\n");
-        switch_NC_relay(false);
+        ESP_LOGI(TAG,"\nSwitch off again. Supposed to do nothing\n");
+        relay_apply(all, 0);
         ON;
 
         DELAY;
-        switch_NC_relay(true);
-        ESP_LOGI(TAG,"\nOpen NC relay\n");
+        relay_apply(all, all);
+        ESP_LOGI(TAG,"\nSwitch on every channel\n");
         ON;
 
         DELAY;
-        ESP_LOGI(TAG,"\nOpen again NC relay. Supposed to do nothing\n");
-        switch_NC_relay(true);
+        ESP_LOGI(TAG,"\nSwitch on channel 0 only\n");
+        relay_apply(all, 1);
         ON;
 
         DELAY;
@@ -1,11 +1,53 @@
 #ifndef RELAY_H
 #define RELAY_H
+#include <stdint.h>
+#include <stdbool.h>
+#include "driver/gpio.h"
 #include "esp_log.h"
 
-#define PIN GPIO_NUM_19
+/* Relay channels of the board, described by the table of relay.c.
+ *
+ * A channel is "on" when its load is powered. Whether that means the coil
+ * is energized depends on the mode (NC or NO), and energizing the coil means
+ * driving the pin to its active level (LEVEL) or enabling the output driver
+ * of a pin kept at its active level (ENABLE, for relays that switch on the
+ * leak current of a disabled pin).
+ *
+ * Pins must be below 32: every change of relay_apply() is written to the
+ * GPIO set/clear registers of the first bank at once.
+ */
 
-bool is_NC_relay_on();
-esp_err_t switch_NC_relay(bool);
+#define RELAY_MAX_CHANNELS 32
+#define RELAY_NO_SCHEDULE -1
 
+typedef enum relay_mode_t {
+    RELAY_NC, // normally closed: load on while the coil is off
+    RELAY_NO  // normally open: load on while the coil is on
+} relay_mode_t;
+
+typedef enum relay_drive_t {
+    RELAY_DRIVE_LEVEL,
+    RELAY_DRIVE_ENABLE
+} relay_drive_t;
+
+typedef struct relay_channel_t {
+    gpio_num_t pin;
+    bool active_low;    // level which energizes the coil
+    relay_mode_t mode;
+    relay_drive_t drive;
+    int schedule;       // schedule switching the channel, or RELAY_NO_SCHEDULE
+} relay_channel_t;
+
+// configures the pins, every load on
+esp_err_t relay_init(void);
+int relay_count(void);
+/* Sets the channels of mask (bit i is channel i) to the state of the same
+ * bit of on, in a single critical section. */
+esp_err_t relay_apply(uint32_t mask, uint32_t on);
+// bit i set if the load of channel i is powered
+uint32_t relay_state(void);
+bool relay_is_on(int channel);
+// channels bound to schedule
+uint32_t relay_schedule_mask(int schedule);
 
 #endif
@@ -0,0 +1,279 @@
+#include <stddef.h>
+#include <string.h>
+#include <inttypes.h>
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_rom_crc.h"
+
+#include "ring_log.h"
+
+#define TAG "Ring log"
+#define RING_MAGIC 0x4c524d42 // "BMRL"
+#define RING_EMPTY 0xFFFFFFFF
+#define SECTOR_SIZE 4096
+#define PEEK_MAX 32
+
+/* The partition is split in flash sectors, written one after the other
+ * and erased only when the writer comes back to them, so that every
+ * sector gets the same wear. Each sector starts with a header holding
+ * a sequence number, which gives the order of the sectors at boot.
+ * A record is written once; its 'sent' word is cleared afterwards,
+ * which flash allows without erasing.
+ */
+typedef struct ring_sector_header_t {
+    uint32_t magic;
+    uint32_t seq;
+} ring_sector_header_t;
+
+#define SLOTS_PER_SECTOR ((SECTOR_SIZE - sizeof(ring_sector_header_t)) / sizeof(ring_record_t))
+
+typedef struct ring_pos_t {
+    uint32_t sector;
+    uint32_t slot;
+} ring_pos_t;
+
+static const esp_partition_t* s_part = NULL;
+static uint32_t s_sectors = 0;
+static ring_pos_t s_head;          // next slot to write
+static uint32_t s_head_sector_seq;
+static ring_pos_t s_tail;          // no unsent record before it
+static uint32_t s_last_seq = 0;
+static uint32_t s_pending = 0;
+static ring_pos_t s_peeked[PEEK_MAX];
+static int s_peeked_count = 0;
+
+static size_t sector_offset(uint32_t sector) {
+    return sector * SECTOR_SIZE;
+}
+
+static size_t slot_offset(ring_pos_t pos) {
+    return sector_offset(pos.sector) + sizeof(ring_sector_header_t) + pos.slot * sizeof(ring_record_t);
+}
+
+static uint32_t record_crc(const ring_record_t* rec) {
+    return esp_rom_crc32_le(0, (const uint8_t*)rec, offsetof(ring_record_t, crc));
+}
+
+static bool read_header(uint32_t sector, ring_sector_header_t* header) {
+    if (esp_partition_read(s_part, sector_offset(sector), header, sizeof(*header)) != ESP_OK) {
+        return false;
+    }
+    return header->magic == RING_MAGIC;
+}
+
+static bool read_record(ring_pos_t pos, ring_record_t* rec) {
+    if (esp_partition_read(s_part, slot_offset(pos), rec, sizeof(*rec)) != ESP_OK) {
+        return false;
+    }
+    return rec->seq != RING_EMPTY && rec->crc == record_crc(rec);
+}
+
+static bool is_head(ring_pos_t pos) {
+    ring_pos_t head = s_head;
+    if (head.slot == SLOTS_PER_SECTOR) {
+        // full sector: the next write goes to the next one
+        head.slot = 0;
+        head.sector = (head.sector + 1) % s_sectors;
+    }
+    return pos.sector == head.sector && pos.slot == head.slot;
+}
+
+static ring_pos_t next_pos(ring_pos_t pos) {
+    if (++pos.slot == SLOTS_PER_SECTOR) {
+        pos.slot = 0;
+        pos.sector = (pos.sector + 1) % s_sectors;
+    }
+    return pos;
+}
+
+static esp_err_t start_sector(uint32_t sector, uint32_t seq) {
+    esp_err_t err = esp_partition_erase_range(s_part, sector_offset(sector), SECTOR_SIZE);
+    if (err != ESP_OK) {
+        return err;
+    }
+    ring_sector_header_t header = { RING_MAGIC, seq };
+    err = esp_partition_write(s_part, sector_offset(sector), &header, sizeof(header));
+    if (err != ESP_OK) {
+        return err;
+    }
+    s_head.sector = sector;
+    s_head.slot = 0;
+    s_head_sector_seq = seq;
+    return ESP_OK;
+}
+
+esp_err_t ring_log_init(void) {
+    s_part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "readings");
+    if (s_part == NULL) {
+        ESP_LOGE(TAG, "No 'readings' partition: readings will not be kept");
+        return ESP_ERR_NOT_FOUND;
+    }
+    s_sectors = s_part->size / SECTOR_SIZE;
+    if (s_sectors < 2) {
+        s_part = NULL;
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    s_pending = 0;
+    s_last_seq = 0;
+    s_peeked_count = 0;
+
+    // the newest sector is the one being written
+    bool found = false;
+    for (uint32_t i = 0; i < s_sectors; i++) {
+        ring_sector_header_t header;
+        if (read_header(i, &header) && (!found || header.seq > s_head_sector_seq)) {
+            found = true;
+            s_head.sector = i;
+            s_head_sector_seq = header.seq;
+        }
+    }
+    if (!found) {
+        ESP_LOGI(TAG, "Empty partition, formatting");
+        s_tail.sector = s_tail.slot = 0;
+        return start_sector(0, 1);
+    }
+    ring_record_t rec;
+    for (s_head.slot = 0; s_head.slot < SLOTS_PER_SECTOR; s_head.slot++) {
+        esp_partition_read(s_part, slot_offset(s_head), &rec, sizeof(rec));
+        if (rec.seq == RING_EMPTY) {
+            break;
+        }
+    }
+
+    // walk from the oldest sector to find the first unsent record
+    bool tail_found = false;
+    for (uint32_t i = 1; i <= s_sectors; i++) {
+        ring_pos_t pos = { (s_head.sector + i) % s_sectors, 0 };
+        ring_sector_header_t header;
+        if (!read_header(pos.sector, &header)) {
+            continue;
+        }
+        bool head_sector = pos.sector == s_head.sector;
+        for (; pos.slot < SLOTS_PER_SECTOR && !(head_sector && pos.slot == s_head.slot); pos.slot++) {
+            if (!read_record(pos, &rec)) {
+                continue;
+            }
+            if (rec.seq > s_last_seq) {
+                s_last_seq = rec.seq;
+            }
+            if (rec.sent == RING_EMPTY) {
+                if (!tail_found) {
+                    tail_found = true;
+                    s_tail = pos;
+                }
+                s_pending++;
+            }
+        }
+    }
+    if (!tail_found) {
+        s_tail = s_head;
+    }
+    ESP_LOGI(TAG, "%" PRIu32 " readings waiting, last sequence %" PRIu32, s_pending, s_last_seq);
+    return ESP_OK;
+}
+
+esp_err_t ring_log_append(const ring_record_t* record) {
+    if (s_part == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (s_head.slot == SLOTS_PER_SECTOR) {
+        // the oldest sector is overwritten: its unsent readings are lost
+        uint32_t sector = (s_head.sector + 1) % s_sectors;
+        ring_sector_header_t header;
+        if (read_header(sector, &header)) {
+            ring_pos_t pos = { sector, 0 };
+            ring_record_t rec;
+            for (; pos.slot < SLOTS_PER_SECTOR; pos.slot++) {
+                if (read_record(pos, &rec) && rec.sent == RING_EMPTY) {
+                    s_pending--;
+                }
+            }
+            if (s_tail.sector == sector) {
+                s_tail.sector = (sector + 1) % s_sectors;
+                s_tail.slot = 0;
+            }
+        }
+        esp_err_t err = start_sector(sector, s_head_sector_seq + 1);
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Error (%s) erasing sector %" PRIu32, esp_err_to_name(err), sector);
+            return err;
+        }
+    }
+
+    ring_record_t rec = {
+        .seq = record->seq,
+        .timestamp = record->timestamp,
+        .res = record->res,
+        .sent = RING_EMPTY,
+    };
+    rec.crc = record_crc(&rec);
+    esp_err_t err = esp_partition_write(s_part, slot_offset(s_head), &rec, sizeof(rec));
+    // the slot is used even if the write failed
+    s_head.slot++;
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Error (%s) writing reading %" PRIu32, esp_err_to_name(err), rec.seq);
+        return err;
+    }
+    if (s_pending == 0) {
+        s_tail = s_head;
+        s_tail.slot--;
+    }
+    if (rec.seq > s_last_seq) {
+        s_last_seq = rec.seq;
+    }
+    s_pending++;
+    return ESP_OK;
+}
+
+int ring_log_peek(ring_record_t* out, int max) {
+    s_peeked_count = 0;
+    if (s_part == NULL || s_pending == 0) {
+        return 0;
+    }
+    if (max > PEEK_MAX) {
+        max = PEEK_MAX;
+    }
+
+    ring_pos_t pos = s_tail;
+    while (s_peeked_count < max && !is_head(pos)) {
+        if (pos.slot == 0) {
+            ring_sector_header_t header;
+            if (!read_header(pos.sector, &header)) {
+                // erased sector: nothing in it
+                pos.slot = SLOTS_PER_SECTOR - 1;
+                pos = next_pos(pos);
+                continue;
+            }
+        }
+        if (read_record(pos, &out[s_peeked_count]) && out[s_peeked_count].sent == RING_EMPTY) {
+            s_peeked[s_peeked_count++] = pos;
+        }
+        pos = next_pos(pos);
+    }
+    return s_peeked_count;
+}
+
+void ring_log_ack(int n) {
+    if (n > s_peeked_count) {
+        n = s_peeked_count;
+    }
+    const uint32_t sent = 0;
+    for (int i = 0; i < n; i++) {
+        esp_partition_write(s_part, slot_offset(s_peeked[i]) + offsetof(ring_record_t, sent), &sent, sizeof(sent));
+        s_pending--;
+    }
+    if (n > 0) {
+        s_tail = s_pending ? next_pos(s_peeked[n - 1]) : s_head;
+    }
+    s_peeked_count = 0;
+}
+
+uint32_t ring_log_pending(void) {
+    return s_pending;
+}
+
+uint32_t ring_log_last_seq(void) {
+    return s_last_seq;
+}
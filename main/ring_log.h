@@ -0,0 +1,32 @@
+#ifndef RING_LOG_H
+#define RING_LOG_H
+#include <stdint.h>
+#include "esp_err.h"
+#include "bridge.h"
+
+/* Readings that could not be uploaded, kept in the "readings" flash
+ * partition until the collector is reachable again.
+ * When the partition is full, the oldest readings are dropped.
+ * Not thread safe: only the upload path uses it.
+ */
+
+typedef struct ring_record_t {
+    uint32_t seq;
+    uint32_t timestamp; // unix time, 0 if the clock was not set
+    _bme280_res res;
+    uint32_t crc;       // of the fields above
+    uint32_t sent;      // 0xFFFFFFFF until uploaded, then cleared in place
+} ring_record_t;
+
+esp_err_t ring_log_init(void);
+// keeps seq, timestamp and res of rec
+esp_err_t ring_log_append(const ring_record_t* rec);
+// copies up to max of the oldest readings not sent yet, returns how many
+int ring_log_peek(ring_record_t* out, int max);
+// marks the first n readings returned by the last peek as sent
+void ring_log_ack(int n);
+uint32_t ring_log_pending(void);
+// highest sequence number in the log, 0 if empty
+uint32_t ring_log_last_seq(void);
+
+#endif
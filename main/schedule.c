@@ -0,0 +1,72 @@
+#include <string.h>
+#include "schedule.h"
+
+static void set_range(schedule_t* sched, int from, int to) {
+    for (int m = from; m < to; m++) {
+        int minute = m % SCHEDULE_MINUTES;
+        sched->bits[minute / 8] |= 1 << (minute % 8);
+    }
+}
+
+void schedule_from_period(schedule_spec_t* spec, const struct Period* period) {
+    memset(spec, 0, sizeof(*spec));
+    spec->count = 1;
+    spec->window[0] = (command_window_t) {
+        0x7f, period->start_h, period->start_m, period->end_h, period->end_m
+    };
+}
+
+void schedule_build(schedule_t* sched, const schedule_spec_t* spec) {
+    memset(sched, 0, sizeof(*sched));
+    for (int i = 0; i < spec->count && i < SCHEDULE_MAX_WINDOWS; i++) {
+        const command_window_t* w = &spec->window[i];
+        if (!command_valid_window(w)) {
+            continue;
+        }
+        int start = w->start_h * 60 + w->start_m;
+        int end = w->end_h * 60 + w->end_m;
+        if (end < start) {
+            end += 24 * 60;
+        }
+        for (int day = 0; day < 7; day++) {
+            if (w->days & (1 << day)) {
+                set_range(sched, day * 24 * 60 + start, day * 24 * 60 + end);
+            }
+        }
+    }
+
+    // a transition is a minute whose state differs from the one before
+    int t = 0;
+    bool prev = schedule_is_on(sched, SCHEDULE_MINUTES - 1);
+    for (int m = 0; m < SCHEDULE_MINUTES; m++) {
+        if (m % 60 == 0) {
+            sched->hour_index[m / 60] = t;
+        }
+        bool on = schedule_is_on(sched, m);
+        if (on != prev && t < SCHEDULE_MAX_TRANSITIONS) {
+            sched->transition[t++] = m;
+        }
+        prev = on;
+    }
+    sched->count = t;
+}
+
+bool schedule_is_on(const schedule_t* sched, int minute) {
+    return sched->bits[minute / 8] & (1 << (minute % 8));
+}
+
+int schedule_next_transition(const schedule_t* sched, int minute) {
+    if (sched->count == 0) {
+        return -1;
+    }
+    // only the transitions of the current hour are skipped
+    int i = sched->hour_index[minute / 60];
+    while (i < sched->count && sched->transition[i] <= minute) {
+        i++;
+    }
+    if (i == sched->count) {
+        // wrap to next week
+        return sched->transition[0] + SCHEDULE_MINUTES - minute;
+    }
+    return sched->transition[i] - minute;
+}
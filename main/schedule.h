@@ -0,0 +1,50 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "period.h"
+#include "command.h"
+
+/* Weekly schedule of the relay.
+ *
+ * A schedule_spec_t is the list of windows as set by the user, kept in NVS
+ * (CFG_SCHEDULE). schedule_build() turns it into a schedule_t: one bit per
+ * minute of the week, and the sorted list of the minutes where the relay
+ * changes state with an index per hour, so that both "is it on now" and
+ * "when is the next change" are answered without scanning the week.
+ *
+ * Minutes of the week start on Sunday 00:00, as tm_wday; clock.h gives the
+ * current one.
+ */
+
+#define SCHEDULE_MAX_WINDOWS COMMAND_MAX_WINDOWS
+#define SCHEDULE_MINUTES (7 * 24 * 60)
+#define SCHEDULE_HOURS (7 * 24)
+// each window starts and ends once a day at most
+#define SCHEDULE_MAX_TRANSITIONS (2 * 7 * SCHEDULE_MAX_WINDOWS)
+
+/* A window (command_window_t) is on from start to end on each day of days
+ * (bit 0 is Sunday). A window ending before it starts goes on past
+ * midnight, and start == end is empty, as for struct Period.
+ * No window: the daily CFG_PERIOD is used instead.
+ */
+typedef command_schedule_t schedule_spec_t;
+
+typedef struct schedule_t {
+    uint8_t bits[SCHEDULE_MINUTES / 8];
+    uint16_t transition[SCHEDULE_MAX_TRANSITIONS];
+    uint16_t count;
+    // first transition at or after the start of each hour of the week
+    uint8_t hour_index[SCHEDULE_HOURS];
+} schedule_t;
+
+// the same window every day
+void schedule_from_period(schedule_spec_t* spec, const struct Period* period);
+void schedule_build(schedule_t* sched, const schedule_spec_t* spec);
+
+bool schedule_is_on(const schedule_t* sched, int minute);
+// minutes from minute to the next change of state, or -1 if it never changes
+int schedule_next_transition(const schedule_t* sched, int minute);
+
+#endif
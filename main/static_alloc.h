@@ -0,0 +1,41 @@
+#ifndef STATIC_ALLOC_H
+#define STATIC_ALLOC_H
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "sdkconfig.h"
+
+/* Creation of the tasks and kernel objects of the firmware. With
+ * CONFIG_BME_STATIC_ALLOC, each use of a macro reserves its own storage in
+ * .bss, so a macro must be used once per object, not in a loop. Each one
+ * returns the handle, NULL on failure.
+ */
+
+#ifdef CONFIG_BME_STATIC_ALLOC
+#define BME_TASK_CREATE(fn, name, depth, arg, prio) ({ \
+        static StackType_t stack_[depth]; \
+        static StaticTask_t task_; \
+        xTaskCreateStatic(fn, name, depth, arg, prio, stack_, &task_); })
+#define BME_QUEUE_CREATE(len, size) ({ \
+        static uint8_t storage_[(len) * (size)]; \
+        static StaticQueue_t queue_; \
+        xQueueCreateStatic(len, size, storage_, &queue_); })
+#define BME_MUTEX_CREATE() ({ \
+        static StaticSemaphore_t mutex_; \
+        xSemaphoreCreateMutexStatic(&mutex_); })
+#define BME_EVENT_GROUP_CREATE() ({ \
+        static StaticEventGroup_t group_; \
+        xEventGroupCreateStatic(&group_); })
+#else
+#define BME_TASK_CREATE(fn, name, depth, arg, prio) ({ \
+        TaskHandle_t task_ = NULL; \
+        xTaskCreate(fn, name, depth, arg, prio, &task_); \
+        task_; })
+#define BME_QUEUE_CREATE(len, size) xQueueCreate(len, size)
+#define BME_MUTEX_CREATE() xSemaphoreCreateMutex()
+#define BME_EVENT_GROUP_CREATE() xEventGroupCreate()
+#endif
+
+#endif
@@ -0,0 +1,169 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <math.h>
+
+/* Binary form of a reading, sent instead of the
+ * "temp=..&hum=..&press=..&source=.." line when CONFIG_TELEMETRY_BINARY is set.
+ * Header only, so that the collector decodes with the same code.
+ *
+ * Record, 20 bytes, little endian:
+ *   0  u8   version
+ *   1  u8   reserved (0)
+ *   2  u16  sensor id (CONFIG_BME_ID)
+ *   4  u32  sequence number
+ *   8  u32  unix time, 0 if the clock was not set
+ *   12 i16  temperature, 1/100 °C
+ *   14 u16  humidity, 1/100 %
+ *   16 u32  pressure, 1/10 Pa
+ * Frame: u8 TELEMETRY_MAGIC, u8 number of records, then the records.
+ * Ack, answered to a frame sent over UDP:
+ *   u8 TELEMETRY_ACK_MAGIC, u16 sensor id, u32 sequence number of the last record
+ */
+
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_MAGIC 0x54 // 'T'
+#define TELEMETRY_RECORD_SIZE 20
+#define TELEMETRY_FRAME_HEADER 2
+#define TELEMETRY_FRAME_SIZE(n) (TELEMETRY_FRAME_HEADER + (n) * TELEMETRY_RECORD_SIZE)
+#define TELEMETRY_CONTENT_TYPE "application/x-bme-telemetry"
+#define TELEMETRY_ACK_MAGIC 0x41 // 'A'
+#define TELEMETRY_ACK_SIZE 7
+
+typedef struct telemetry_record_t {
+    uint8_t version;
+    uint16_t sensor;
+    uint32_t seq;
+    uint32_t timestamp;
+    int16_t temp;   // 1/100 °C
+    uint16_t hum;   // 1/100 %
+    uint32_t press; // 1/10 Pa
+} telemetry_record_t;
+
+// out of range values are clamped, and NaN (failed conversion) is sent as min
+static inline int32_t telemetry_round(float v, float scale, int32_t min, int32_t max) {
+    float x = v * scale;
+    if (isnan(x)) {
+        return min;
+    }
+    x += x < 0 ? -0.5f : 0.5f;
+    if (x < (float)min) {
+        return min;
+    }
+    // (float)INT32_MAX is 2^31, which does not fit: compared before the cast
+    if (x >= (float)max) {
+        return max;
+    }
+    return (int32_t)x;
+}
+
+static inline void telemetry_from_reading(telemetry_record_t* rec, uint16_t sensor, uint32_t seq,
+        uint32_t timestamp, float temp, float press, float hum) {
+    rec->version = TELEMETRY_VERSION;
+    rec->sensor = sensor;
+    rec->seq = seq;
+    rec->timestamp = timestamp;
+    rec->temp = (int16_t)telemetry_round(temp, 100.0f, INT16_MIN, INT16_MAX);
+    rec->hum = (uint16_t)telemetry_round(hum, 100.0f, 0, UINT16_MAX);
+    rec->press = (uint32_t)telemetry_round(press, 10.0f, 0, INT32_MAX);
+}
+
+static inline float telemetry_temp(const telemetry_record_t* rec) {
+    return rec->temp / 100.0f;
+}
+
+static inline float telemetry_hum(const telemetry_record_t* rec) {
+    return rec->hum / 100.0f;
+}
+
+static inline float telemetry_press(const telemetry_record_t* rec) {
+    return rec->press / 10.0f;
+}
+
+static inline void telemetry_put16(uint8_t* p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static inline void telemetry_put32(uint8_t* p, uint32_t v) {
+    telemetry_put16(p, (uint16_t)v);
+    telemetry_put16(p + 2, (uint16_t)(v >> 16));
+}
+
+static inline uint16_t telemetry_get16(const uint8_t* p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t telemetry_get32(const uint8_t* p) {
+    return telemetry_get16(p) | ((uint32_t)telemetry_get16(p + 2) << 16);
+}
+
+static inline void telemetry_encode_record(const telemetry_record_t* rec, uint8_t* out) {
+    out[0] = rec->version;
+    out[1] = 0;
+    telemetry_put16(out + 2, rec->sensor);
+    telemetry_put32(out + 4, rec->seq);
+    telemetry_put32(out + 8, rec->timestamp);
+    telemetry_put16(out + 12, (uint16_t)rec->temp);
+    telemetry_put16(out + 14, rec->hum);
+    telemetry_put32(out + 16, rec->press);
+}
+
+// false if the record has an unknown version
+static inline bool telemetry_decode_record(const uint8_t* in, telemetry_record_t* rec) {
+    if (in[0] != TELEMETRY_VERSION) {
+        return false;
+    }
+    rec->version = in[0];
+    rec->sensor = telemetry_get16(in + 2);
+    rec->seq = telemetry_get32(in + 4);
+    rec->timestamp = telemetry_get32(in + 8);
+    rec->temp = (int16_t)telemetry_get16(in + 12);
+    rec->hum = telemetry_get16(in + 14);
+    rec->press = telemetry_get32(in + 16);
+    return true;
+}
+
+// returns the size of the frame, 0 if out is too small
+static inline size_t telemetry_encode_frame(const telemetry_record_t* recs, uint8_t count, uint8_t* out, size_t size) {
+    if (size < TELEMETRY_FRAME_SIZE((size_t)count)) {
+        return 0;
+    }
+    out[0] = TELEMETRY_MAGIC;
+    out[1] = count;
+    for (uint8_t i = 0; i < count; i++) {
+        telemetry_encode_record(&recs[i], out + TELEMETRY_FRAME_SIZE(i));
+    }
+    return TELEMETRY_FRAME_SIZE((size_t)count);
+}
+
+// returns the number of records of the frame, or -1 if it is malformed
+static inline int telemetry_frame_count(const uint8_t* in, size_t len) {
+    if (len < TELEMETRY_FRAME_HEADER || in[0] != TELEMETRY_MAGIC || len != TELEMETRY_FRAME_SIZE((size_t)in[1])) {
+        return -1;
+    }
+    return in[1];
+}
+
+static inline const uint8_t* telemetry_frame_record(const uint8_t* in, int i) {
+    return in + TELEMETRY_FRAME_SIZE(i);
+}
+
+static inline void telemetry_encode_ack(uint16_t sensor, uint32_t seq, uint8_t* out) {
+    out[0] = TELEMETRY_ACK_MAGIC;
+    telemetry_put16(out + 1, sensor);
+    telemetry_put32(out + 3, seq);
+}
+
+static inline bool telemetry_decode_ack(const uint8_t* in, size_t len, uint16_t* sensor, uint32_t* seq) {
+    if (len != TELEMETRY_ACK_SIZE || in[0] != TELEMETRY_ACK_MAGIC) {
+        return false;
+    }
+    *sensor = telemetry_get16(in + 1);
+    *seq = telemetry_get32(in + 3);
+    return true;
+}
+
+#endif
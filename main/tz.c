@@ -0,0 +1,216 @@
+#include <stdlib.h>
+#include <ctype.h>
+#include "tz.h"
+
+#define DAY 86400
+#define HOUR 3600
+
+static bool is_leap(int year) {
+    return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+static int days_in_month(int year, int month) {
+    static const uint8_t days[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    return month == 2 && is_leap(year) ? 29 : days[month - 1];
+}
+
+// H. Hinnant's algorithm
+int64_t tz_days_from_civil(int year, int month, int day) {
+    int64_t y = year - (month <= 2);
+    int64_t era = (y >= 0 ? y : y - 399) / 400;
+    int64_t yoe = y - era * 400;
+    int64_t doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+static int64_t floor_div(int64_t a, int64_t b) {
+    return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+static const char* parse_int(const char* p, int min, int max, int* out) {
+    if (!isdigit((unsigned char)*p)) {
+        return NULL;
+    }
+    long v = strtol(p, (char**)&p, 10);
+    if (v < min || v > max) {
+        return NULL;
+    }
+    *out = (int)v;
+    return p;
+}
+
+// [+-]hh[:mm[:ss]], hours up to max
+static const char* parse_time(const char* p, int max_hours, int32_t* out) {
+    int sign = 1;
+    if (*p == '+' || *p == '-') {
+        sign = *p++ == '-' ? -1 : 1;
+    }
+    int h, m = 0, s = 0;
+    if ((p = parse_int(p, 0, max_hours, &h)) == NULL) {
+        return NULL;
+    }
+    if (*p == ':' && (p = parse_int(p + 1, 0, 59, &m)) != NULL && *p == ':') {
+        p = parse_int(p + 1, 0, 59, &s);
+    }
+    if (p != NULL) {
+        *out = sign * (h * HOUR + m * 60 + s);
+    }
+    return p;
+}
+
+// "CET" or "<+0330>"
+static const char* parse_name(const char* p) {
+    const char* start = p;
+    if (*p == '<') {
+        while (*p && *p != '>') {
+            p++;
+        }
+        return *p == '>' && p - start >= 4 ? p + 1 : NULL;
+    }
+    while (isalpha((unsigned char)*p)) {
+        p++;
+    }
+    return p - start >= 3 ? p : NULL;
+}
+
+static const char* parse_date(const char* p, tz_date_t* d) {
+    int a, b, c;
+    if (*p == 'M') {
+        if ((p = parse_int(p + 1, 1, 12, &a)) == NULL || *p != '.'
+                || (p = parse_int(p + 1, 1, 5, &b)) == NULL || *p != '.'
+                || (p = parse_int(p + 1, 0, 6, &c)) == NULL) {
+            return NULL;
+        }
+        *d = (tz_date_t) { .kind = TZ_MONTH, .month = a, .week = b, .day = c, .time = 2 * HOUR };
+    } else if (*p == 'J') {
+        if ((p = parse_int(p + 1, 1, 365, &a)) == NULL) {
+            return NULL;
+        }
+        *d = (tz_date_t) { .kind = TZ_JULIAN1, .yday = a, .time = 2 * HOUR };
+    } else {
+        if ((p = parse_int(p, 0, 365, &a)) == NULL) {
+            return NULL;
+        }
+        *d = (tz_date_t) { .kind = TZ_JULIAN0, .yday = a, .time = 2 * HOUR };
+    }
+    if (*p == '/') {
+        // RFC 8536 allows -167 to 167 hours
+        p = parse_time(p + 1, 167, &d->time);
+    }
+    return p;
+}
+
+bool tz_parse(const char* spec, tz_rule_t* rule) {
+    const char* p = parse_name(spec);
+    int32_t offset;
+    if (p == NULL || (p = parse_time(p, 24, &offset)) == NULL) {
+        return false;
+    }
+    *rule = (tz_rule_t) { .std_offset = -offset, .dst_offset = -offset, .has_dst = false };
+    if (*p == '\0') {
+        return true;
+    }
+    if ((p = parse_name(p)) == NULL) {
+        return false;
+    }
+    rule->has_dst = true;
+    rule->dst_offset = rule->std_offset + HOUR;
+    if (*p != ',' && *p != '\0') {
+        if ((p = parse_time(p, 24, &offset)) == NULL) {
+            return false;
+        }
+        rule->dst_offset = -offset;
+    }
+    if (*p == '\0') {
+        // no rule: the one of the US, as glibc does
+        return parse_date("M3.2.0", &rule->start) != NULL && parse_date("M11.1.0", &rule->end) != NULL;
+    }
+    if (*p != ',' || (p = parse_date(p + 1, &rule->start)) == NULL
+            || *p != ',' || (p = parse_date(p + 1, &rule->end)) == NULL) {
+        return false;
+    }
+    return *p == '\0';
+}
+
+// local midnight of d in year, as seconds since the epoch of a UTC clock
+static int64_t date_midnight(const tz_date_t* d, int year) {
+    int64_t jan1 = tz_days_from_civil(year, 1, 1);
+    switch (d->kind) {
+        case TZ_JULIAN1:
+            // day 60 is March 1 even in a leap year
+            return (jan1 + d->yday - 1 + (is_leap(year) && d->yday >= 60)) * DAY;
+        case TZ_JULIAN0:
+            return (jan1 + d->yday) * DAY;
+        default: {
+            int64_t first = tz_days_from_civil(year, d->month, 1);
+            // the epoch was a Thursday
+            int wday = (int)((first % 7 + 11) % 7);
+            int mday = 1 + (d->day - wday + 7) % 7 + (d->week - 1) * 7;
+            if (mday > days_in_month(year, d->month)) {
+                mday -= 7;
+            }
+            return (first + mday - 1) * DAY;
+        }
+    }
+}
+
+void tz_year(const tz_rule_t* rule, int year, tz_year_t* out) {
+    out->year = year;
+    out->begin = tz_days_from_civil(year, 1, 1) * DAY - rule->std_offset;
+    out->end = tz_days_from_civil(year + 1, 1, 1) * DAY - rule->std_offset;
+    if (rule->has_dst) {
+        out->dst_start = date_midnight(&rule->start, year) + rule->start.time - rule->std_offset;
+        out->dst_end = date_midnight(&rule->end, year) + rule->end.time - rule->dst_offset;
+    } else {
+        out->dst_start = out->dst_end = INT64_MAX;
+    }
+}
+
+static void year_of(const tz_rule_t* rule, tz_year_t* year, int64_t t) {
+    if (t >= year->begin && t < year->end) {
+        return;
+    }
+    // civil year of the standard local time, from the days since the epoch
+    int64_t days = floor_div(t + rule->std_offset, DAY);
+    int y = (int)(1970 + floor_div(days * 400, 146097));
+    while (tz_days_from_civil(y, 1, 1) > days) {
+        y--;
+    }
+    while (tz_days_from_civil(y + 1, 1, 1) <= days) {
+        y++;
+    }
+    tz_year(rule, y, year);
+}
+
+int32_t tz_offset(const tz_rule_t* rule, tz_year_t* year, int64_t t) {
+    if (!rule->has_dst) {
+        return rule->std_offset;
+    }
+    year_of(rule, year, t);
+    bool dst = year->dst_start < year->dst_end
+        ? t >= year->dst_start && t < year->dst_end
+        : t >= year->dst_start || t < year->dst_end;
+    return dst ? rule->dst_offset : rule->std_offset;
+}
+
+int64_t tz_next_change(const tz_rule_t* rule, tz_year_t* year, int64_t t) {
+    if (!rule->has_dst) {
+        return INT64_MAX;
+    }
+    year_of(rule, year, t);
+    int64_t next = INT64_MAX;
+    if (year->dst_start > t) {
+        next = year->dst_start;
+    }
+    if (year->dst_end > t && year->dst_end < next) {
+        next = year->dst_end;
+    }
+    if (next == INT64_MAX) {
+        // both are behind: the first one of the next year
+        tz_year_t following;
+        tz_year(rule, year->year + 1, &following);
+        next = following.dst_start < following.dst_end ? following.dst_start : following.dst_end;
+    }
+    return next;
+}
@@ -0,0 +1,65 @@
+#ifndef TZ_H
+#define TZ_H
+#include <stdint.h>
+#include <stdbool.h>
+
+/* POSIX TZ rules, such as "CET-1CEST,M3.5.0,M10.5.0/3", computed without
+ * newlib: tz_parse() reads the rule once, and tz_year_t holds the UTC
+ * instants where the offset changes in one year, so that the offset of a
+ * time of that year is two comparisons. No ESP-IDF dependency, so that it
+ * also builds on the host (see bench.cpp).
+ *
+ * Times are seconds since the epoch, UTC. Offsets are seconds east of UTC,
+ * the opposite of the sign in the TZ string.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum tz_date_kind_t {
+    TZ_JULIAN1,  // Jn: day 1..365, February 29 never counted
+    TZ_JULIAN0,  // n: day 0..365, February 29 counted
+    TZ_MONTH,    // Mm.w.d: day d (0 is Sunday) of week w (5 is the last) of month m
+} tz_date_kind_t;
+
+typedef struct tz_date_t {
+    uint8_t kind;
+    uint8_t month;
+    uint8_t week;
+    uint8_t day;
+    uint16_t yday;
+    int32_t time; // local time of the change, seconds after midnight
+} tz_date_t;
+
+typedef struct tz_rule_t {
+    int32_t std_offset;
+    int32_t dst_offset;
+    bool has_dst;
+    tz_date_t start; // in standard time
+    tz_date_t end;   // in daylight saving time
+} tz_rule_t;
+
+typedef struct tz_year_t {
+    int year;          // of the standard local time
+    int64_t begin;     // January 1 00:00 standard time
+    int64_t end;       // begin of the next year
+    int64_t dst_start;
+    int64_t dst_end;   // before dst_start in the southern hemisphere
+} tz_year_t;
+
+// false if spec is not a POSIX TZ rule
+bool tz_parse(const char* spec, tz_rule_t* rule);
+void tz_year(const tz_rule_t* rule, int year, tz_year_t* out);
+// recomputes *year if t is not in it
+int32_t tz_offset(const tz_rule_t* rule, tz_year_t* year, int64_t t);
+// first time after t where the offset changes, INT64_MAX without DST
+int64_t tz_next_change(const tz_rule_t* rule, tz_year_t* year, int64_t t);
+// days since the epoch of a date of the proleptic Gregorian calendar
+int64_t tz_days_from_civil(int year, int month, int day);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -8,6 +8,7 @@
 */
 #include <stdio.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include <string.h>
 #include <sys/param.h>
 #include <time.h>
@@ -15,8 +16,10 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
-#include "freertos/queue.h"
 #include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_mac.h"
+#include "esp_app_desc.h"
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
@@ -30,43 +33,22 @@
 #include "lwip/sys.h"
 #include <lwip/netdb.h>
 
+#include "boot.h"
+#include "clock.h"
+#include "metrics.h"
+#include "static_alloc.h"
 #include "bridge.h"
 #include "relay.h"
+#include "config.h"
+#include "period.h"
+#include "schedule.h"
+#include "control.h"
+#include "command.h"
+#include "util.h"
 
 
-struct Period {
-  int start_h;
-  int start_m;
-  int end_h;
-  int end_m;
-};
-
-bool create_period(struct Period* period, char * array) {
-  if (period == NULL || array == NULL) {
-    return false;
-  }
-
-  period->start_h = array[0];
-  period->start_m = array[1];
-  period->end_h = array[2];
-  period->end_m = array[3];
-
-  if (period->start_h < 0 || period->start_h > 23 || period->end_h < 0 || period->end_h > 23 ||
-      period->start_m < 0 || period->start_m > 59 || period->end_m < 0 || period->end_m > 59) {
-    return false;
-  }
-
-  return true;
-}
-
-
-
-QueueHandle_t period_queue = NULL;
-
 
 #define LED_PIN 2
-#define TRANSISTOR_PIN 21
-#define TEST_PIN 19
 
 static void led_light(bool val) {
   gpio_set_level(LED_PIN, val);
@@ -98,61 +80,272 @@ void print_period(const struct Period *period) {
 
 #define PORT CONFIG_EXAMPLE_PORT
 
+/* Events of light_manager, notified as bits of its task notification value */
+#define LIGHT_SCHEDULE 0x01 // new period or schedule
+#define LIGHT_CLOCK 0x02    // clock set or adjusted
+#define LIGHT_OVERRIDE 0x04 // override set or cleared
+// light_manager checks an override at least this often
+#define OVERRIDE_MAX_WAIT_MS (24 * 3600 * 1000)
 
-esp_err_t save_string_nvs(const char* key, const char* val) {
-    nvs_handle_t nvsh;
-    esp_err_t err = nvs_open("storage", NVS_READWRITE, &nvsh);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error %s opening NVS", esp_err_to_name(err));
-    } else {
-        err = nvs_set_str(nvsh, key, val);
-        ESP_LOGI(TAG, "NVS set %s: %s",key, esp_err_to_name(err));
-        err = nvs_commit(nvsh);
-        ESP_LOGI(TAG, "NVS set %s commit: %s", key, esp_err_to_name(err));
-        nvs_close(nvsh);
+static TaskHandle_t s_light_task = NULL;
+
+/* Manual override of the schedule (CONTROL_OVERRIDE), applied by
+ * light_manager. RAM only: a reboot goes back to the schedule. */
+static portMUX_TYPE s_override_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t s_override = COMMAND_OVERRIDE_NONE;
+static int64_t s_override_until = 0; // esp_timer time, 0 for never
+
+static void light_notify(uint32_t event) {
+    if (s_light_task != NULL) {
+        xTaskNotify(s_light_task, event, eSetBits);
     }
-    return ESP_OK;
 }
 
+static void override_set(const command_override_t* o) {
+    portENTER_CRITICAL(&s_override_lock);
+    s_override = o->mode;
+    s_override_until = o->duration_s ? esp_timer_get_time() + o->duration_s * 1000000LL : 0;
+    portEXIT_CRITICAL(&s_override_lock);
+    /* On or off is applied here, before the command is acked: on two cores
+     * light_manager may only run after the ack. It only re-evaluates, and
+     * takes the relay back to the schedule on auto. */
+    if (o->mode != COMMAND_OVERRIDE_NONE) {
+        uint32_t channels = relay_schedule_mask(0);
+        relay_apply(channels, o->mode == COMMAND_OVERRIDE_ON ? channels : 0);
+    }
+    light_notify(LIGHT_OVERRIDE);
+}
 
-enum MSG_FLAG {
-    PERIOD_FLAG,
-    ADRESS_FLAG,
-    SSID_FLAG
-};
+/* The mode of the override, and the µs left before it expires, 0 if it
+ * never does. An expired override is cleared. */
+static uint8_t override_get(int64_t* remaining_us) {
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&s_override_lock);
+    bool expired = s_override != COMMAND_OVERRIDE_NONE && s_override_until != 0 && now >= s_override_until;
+    if (expired) {
+        s_override = COMMAND_OVERRIDE_NONE;
+        s_override_until = 0;
+    }
+    uint8_t mode = s_override;
+    *remaining_us = s_override_until ? s_override_until - now : 0;
+    portEXIT_CRITICAL(&s_override_lock);
+    if (expired) {
+        ESP_LOGI(TAG, "Override expired, back to the schedule");
+    }
+    return mode;
+}
 
-bool is_valid_url(const char* str) {
-    // Check for NULL input
-    if (str == NULL) {
-        return false;
+/* Value of a command, checked before anything is changed */
+typedef struct command_t {
+    uint8_t type;
+    union {
+        struct Period period;
+        char url[COMMAND_URL_MAX + 1];
+        command_wifi_t wifi;
+        schedule_spec_t schedule;
+        command_override_t override;
+    };
+} command_t;
+
+// CONTROL_OK, or the reason why the command is refused
+static uint8_t command_parse(uint8_t type, const uint8_t* value, size_t len, command_t* cmd) {
+    cmd->type = type;
+    switch (type) {
+        case CONTROL_PERIOD:
+            if (!command_decode_period(value, len, &cmd->period)) {
+                ESP_LOGE(TAG, "Invalid period. %d bytes received", (int)len);
+                return CONTROL_INVALID;
+            }
+            ESP_LOGI(TAG, "Msg decoded: %d:%d %d:%d", value[0], value[1], value[2], value[3]);
+            return CONTROL_OK;
+        case CONTROL_URL:
+            if (!command_decode_url(value, len, cmd->url, sizeof(cmd->url))) {
+                ESP_LOGE(TAG, "Invalid adress. %d bytes received", (int)len);
+                return CONTROL_INVALID;
+            }
+            if (!is_valid_url(cmd->url)) {
+                ESP_LOGE(TAG, "'%s' is not a valid url.", cmd->url);
+                return CONTROL_INVALID;
+            }
+            return CONTROL_OK;
+        case CONTROL_WIFI:
+            if (!command_decode_wifi(value, len, &cmd->wifi)) {
+                ESP_LOGE(TAG, "Incomplete message for new SSID and Password. %d bytes received", (int)len);
+                return CONTROL_INVALID;
+            }
+            return CONTROL_OK;
+        case CONTROL_SCHEDULE:
+            if (!command_decode_schedule(value, len, &cmd->schedule)) {
+                ESP_LOGE(TAG, "Invalid schedule. %d bytes received", (int)len);
+                return CONTROL_INVALID;
+            }
+            return CONTROL_OK;
+        case CONTROL_OVERRIDE:
+            if (!command_decode_override(value, len, &cmd->override)) {
+                ESP_LOGE(TAG, "Invalid override. %d bytes received", (int)len);
+                return CONTROL_INVALID;
+            }
+            return CONTROL_OK;
+        default:
+            ESP_LOGE(TAG, "Unknown flag sent: %d", type);
+            return CONTROL_UNKNOWN;
+    }
+}
+
+/* Changes the RAM config; the caller commits it. An override is not part
+ * of the config, and is applied at once. */
+static void command_stage(const command_t* cmd) {
+    switch (cmd->type) {
+        case CONTROL_PERIOD: {
+            // a daily period replaces the weekly schedule
+            schedule_spec_t none = { 0 };
+            config_set(CFG_PERIOD, &cmd->period, sizeof(cmd->period));
+            config_set(CFG_SCHEDULE, &none, sizeof(none));
+            print_period(&cmd->period);
+            break;
+        }
+        case CONTROL_URL:
+            config_set(CFG_URL, cmd->url, strlen(cmd->url) + 1);
+            ESP_LOGI(TAG, "New adress set: %s", cmd->url);
+            break;
+        case CONTROL_WIFI:
+            config_set(CFG_SSID, cmd->wifi.ssid, sizeof(cmd->wifi.ssid));
+            config_set(CFG_PASS, cmd->wifi.pass, sizeof(cmd->wifi.pass));
+            ESP_LOGI(TAG, "New ssid and password saved: %s - %s", cmd->wifi.ssid, cmd->wifi.pass);
+            break;
+        case CONTROL_SCHEDULE:
+            config_set(CFG_SCHEDULE, &cmd->schedule, sizeof(cmd->schedule));
+            ESP_LOGI(TAG, "New schedule set: %d windows", cmd->schedule.count);
+            break;
+        case CONTROL_OVERRIDE:
+            ESP_LOGI(TAG, "Override %d for %" PRIu32 " s", cmd->override.mode, cmd->override.duration_s);
+            override_set(&cmd->override);
+            break;
     }
+}
 
-    // Minimum length check (needs at least 7 characters for "http://")
-    size_t len = strlen(str);
-    if (len <= 8) {
+static command_t s_commands[CONTROL_MAX_COMMANDS];
+// last v2 response, sent again to a retry
+static uint8_t s_response[CONTROL_RESPONSE_SIZE(CONTROL_MAX_COMMANDS)];
+static size_t s_response_len = 0;
+static uint16_t s_response_seq;
+static struct sockaddr_storage s_response_to;
+
+static bool same_source(const struct sockaddr_storage* a, const struct sockaddr_storage* b) {
+    if (a->ss_family != b->ss_family) {
         return false;
     }
+    if (a->ss_family == PF_INET) {
+        const struct sockaddr_in* a4 = (const struct sockaddr_in*)a;
+        const struct sockaddr_in* b4 = (const struct sockaddr_in*)b;
+        return a4->sin_port == b4->sin_port && a4->sin_addr.s_addr == b4->sin_addr.s_addr;
+    }
+    const struct sockaddr_in6* a6 = (const struct sockaddr_in6*)a;
+    const struct sockaddr_in6* b6 = (const struct sockaddr_in6*)b;
+    return a6->sin6_port == b6->sin6_port && memcmp(&a6->sin6_addr, &b6->sin6_addr, sizeof(a6->sin6_addr)) == 0;
+}
 
-    // Convert first characters to lowercase for case-insensitive comparison
-    char first_letters[9] = {0};
-    for (int i = 0; i < 8; i++) {
-        first_letters[i] = tolower(str[i]);
+/* Handles a v2 datagram; out holds CONTROL_RESPONSE_SIZE(CONTROL_MAX_COMMANDS)
+ * bytes. Sets restart if the wifi credentials were changed.
+ */
+static size_t control_v2(const uint8_t* in, size_t len, const struct sockaddr_storage* source, bool* restart, uint8_t* out) {
+    control_header_t h = { 0 };
+    control_command_t cmds[CONTROL_MAX_COMMANDS];
+    uint8_t status[CONTROL_MAX_COMMANDS];
+    // a malformed datagram is not kept for the retries: it cannot evict the last response
+    if (!control_decode_header(in, len, &h) || h.version != CONTROL_VERSION
+            || !control_decode_commands(in, len, &h, cmds, CONTROL_MAX_COMMANDS)) {
+        ESP_LOGE(TAG, "Malformed v%d datagram of %d bytes", h.version, (int)len);
+        metrics_add(CONTROL_UDP_INVALID, 1);
+        return control_encode_response(h.seq, status, 0, out);
+    }
+    if (s_response_len && h.seq == s_response_seq && same_source(source, &s_response_to)) {
+        ESP_LOGI(TAG, "Retry of %d, same response", h.seq);
+        memcpy(out, s_response, s_response_len);
+        return s_response_len;
     }
 
-    // Check if starts with "http"
-    if (strncmp(first_letters, "http://", 7) == 0 || strncmp(first_letters, "https://", 8) == 0) {
-        return true;
+    bool valid = true;
+    for (int i = 0; i < h.count; i++) {
+        status[i] = command_parse(cmds[i].type, cmds[i].value, cmds[i].len, &s_commands[i]);
+        valid = valid && status[i] == CONTROL_OK;
+        if (status[i] != CONTROL_OK) {
+            metrics_add(CONTROL_UDP_INVALID, 1);
+        }
+    }
+    if (valid) {
+        for (int i = 0; i < h.count; i++) {
+            command_stage(&s_commands[i]);
+            *restart = *restart || s_commands[i].type == CONTROL_WIFI;
+        }
+        // light_manager and uploader are told by config_commit()
+        if (config_commit() != ESP_OK) {
+            for (int i = 0; i < h.count; i++) {
+                // an override does not go to NVS
+                if (s_commands[i].type != CONTROL_OVERRIDE) {
+                    status[i] = CONTROL_STORAGE;
+                }
+            }
+        }
+    } else {
+        for (int i = 0; i < h.count; i++) {
+            if (status[i] == CONTROL_OK) {
+                status[i] = CONTROL_NOT_APPLIED;
+            }
+        }
     }
+    s_response_seq = h.seq;
+    s_response_to = *source;
+    s_response_len = control_encode_response(h.seq, status, h.count, s_response);
+    memcpy(out, s_response, s_response_len);
+    return s_response_len;
+}
 
-    return false;
+// answer to a discovery probe; out holds CONTROL_DEVICE_MAX_SIZE bytes
+static size_t control_discover(const uint8_t* in, uint8_t* out) {
+    control_device_t d = { 0 };
+    d.seq = control_get16(in + 2);
+    d.id = CONFIG_BME_ID;
+    esp_read_mac(d.mac, ESP_MAC_WIFI_STA);
+    config_get(CFG_PERIOD, &d.period, sizeof(d.period));
+    schedule_spec_t spec;
+    config_get(CFG_SCHEDULE, &spec, sizeof(spec));
+    d.windows = spec.count;
+    snprintf(d.version, sizeof(d.version), "%s", esp_app_get_description()->version);
+    return control_encode_device(&d, out);
 }
 
+// answer to a query; out holds CONTROL_QUERY_MAX_SIZE bytes
+static size_t control_query(const uint8_t* in, uint8_t* out) {
+    uint16_t seq = control_get16(in + 2);
+    if (in[4] == CONTROL_QUERY_PROFILE) {
+        control_profile_t profile;
+        boot_profile(&profile);
+        return control_encode_profile(seq, &profile, out);
+    }
+    if (in[4] == CONTROL_QUERY_METRICS) {
+        control_metrics_t metrics;
+        metrics_snapshot(&metrics);
+        return control_encode_metrics(seq, &metrics, out);
+    }
+    if (in[4] == CONTROL_QUERY_OVERRIDE) {
+        int64_t remaining_us;
+        control_override_state_t state;
+        state.mode = override_get(&remaining_us);
+        // rounded up, so that 0 is left for never
+        state.remaining_s = (uint32_t)((remaining_us + 999999) / 1000000);
+        state.relays = relay_state();
+        return control_encode_override_state(seq, &state, out);
+    }
+    return control_encode_query(seq, in[4], out);
+}
 
 static void udp_server_task(void *pvParameters)
 {
-    char rx_buffer[200];
+    // a v2 datagram may hold every command
+    char rx_buffer[512];
     char addr_str[128];
-    int addr_family = (int)pvParameters;
+    int addr_family = (int)(intptr_t)pvParameters;
     int ip_protocol = 0;
     struct sockaddr_in6 dest_addr;
 
@@ -165,7 +358,7 @@ static void udp_server_task(void *pvParameters)
             dest_addr_ip4->sin_port = htons(PORT);
             ip_protocol = IPPROTO_IP;
         } else if (addr_family == AF_INET6) {
-            bzero(&dest_addr.sin6_addr.un, sizeof(dest_addr.sin6_addr.un));
+            memset(&dest_addr.sin6_addr, 0, sizeof(dest_addr.sin6_addr));
             dest_addr.sin6_family = AF_INET6;
             dest_addr.sin6_port = htons(PORT);
             ip_protocol = IPPROTO_IPV6;
@@ -197,6 +390,9 @@ static void udp_server_task(void *pvParameters)
         timeout.tv_sec = 10;
         timeout.tv_usec = 0;
         setsockopt (sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+        // lwIP drops broadcasts, such as the discovery probes, without it
+        int broadcast = 1;
+        setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &broadcast, sizeof(broadcast));
 
         int err = bind(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
         if (err < 0) {
@@ -259,94 +455,57 @@ static void udp_server_task(void *pvParameters)
                  * - 4 bytes = changement d'horaire pour l'interrupteur
                  * - x bytes = nouvelle adresse d'envoi des informations
                  * - y bytes = nouveau ssid/password
-                 *  
+                 * - 1 + 5n bytes = programme hebdomadaire (n fenêtres)
+                 * - v2 : plusieurs commandes à la fois (voir control.h)
+                 * - sonde de découverte, diffusée par le client
+                 * - requête (profil de démarrage, métriques, forçage)
                  */
                 bool restart_udp_server = false;
-                switch (rx_buffer[0]) {
-                    case PERIOD_FLAG:
-                        if (len != 5) {
-                            ESP_LOGE(TAG, "Incomplete message for new period. %d bytes received",len);
-                            err = sendto(sock, "invalid", 7, 0, (struct sockaddr *)&source_addr, sizeof(source_addr));
-                            restart_udp_server = true;
-                            break;
-                        }
-
-                        ESP_LOGI(TAG, "Msg decoded: %d:%d %d:%d",
-                                rx_buffer[1],
-                                rx_buffer[2],
-                                rx_buffer[3],
-                                rx_buffer[4]);
-                        struct Period p;
-                        if (create_period(&p, &rx_buffer[1])) {
-                            xQueueSend(period_queue, &p, 0);
-                            ESP_LOGI(TAG, "Sending answer: %s", rx_buffer);
-                            err = sendto(sock, rx_buffer, len, 0, (struct sockaddr *)&source_addr, sizeof(source_addr));
-                        }
-                        else {
-                            err = sendto(sock, "invalid", 7, 0, (struct sockaddr *)&source_addr, sizeof(source_addr));
-                        }
-
-                        if (err < 0) {
-                            ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
-                            restart_udp_server = true;
-                            break;
-                        }
-                        break;
-                    case ADRESS_FLAG:
-                        if (len > 200) {
-                            ESP_LOGE(TAG, "Adress received too long: %d", len);
-                            err = sendto(sock, "invalid", 7, 0, (struct sockaddr *)&source_addr, sizeof(source_addr));
-                            restart_udp_server = true;
-                            break;
-                        } else {
-                            char addr[len];
-                            strncpy(addr, &rx_buffer[1], len -1);
-                            addr[len-1] = '\0';
-                            if (!is_valid_url(addr)) {
-                                ESP_LOGE(TAG, "'%s' is not a valid url.", addr);
-                                err = sendto(sock, "invalid", 7, 0, (struct sockaddr *)&source_addr, sizeof(source_addr));
-                                restart_udp_server = true;
-                                break;
-                            } else {
-                                save_string_nvs("adress", addr);
-                                ESP_LOGI(TAG, "New adress set: %s", addr);
-                                err = sendto(sock, rx_buffer, len, 0, (struct sockaddr *)&source_addr, sizeof(source_addr));
-                                if (err < 0) {
-                                    ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
-                                    restart_udp_server = true;
-                                    break;
-                                }
-                            }
-                        }
-                        break;
-                    case SSID_FLAG:
-                        if (len != 32 + 64 + 1) { // SSID + Password + flag 
-                            ESP_LOGE(TAG, "Incomplete message for new SSID and Password. %d bytes received", len);
-                            err = sendto(sock, "invalid", 7, 0, (struct sockaddr *) & source_addr, sizeof(source_addr));
-                            restart_udp_server = true;
-                            break;
-                        }
-                        char ssid[33], pass[65];
-                        strncpy(ssid, &rx_buffer[1], 32);
-                        strncpy(pass, &rx_buffer[33], 64);
-                        save_string_nvs("ssid", ssid);
-                        save_string_nvs("pass", pass);
-                        ESP_LOGI(TAG, "New ssid and password saved: %s - %s", ssid, pass);
+                bool restart_esp = false;
+                if (len == 0) {
+                    continue;
+                }
+                metrics_add(CONTROL_UDP_RECEIVED, 1);
+                if (control_is_probe((uint8_t*)rx_buffer, len)) {
+                    uint8_t device[CONTROL_DEVICE_MAX_SIZE];
+                    size_t device_len = control_discover((uint8_t*)rx_buffer, device);
+                    err = sendto(sock, device, device_len, 0, (struct sockaddr *)&source_addr, sizeof(source_addr));
+                } else if (control_is_query((uint8_t*)rx_buffer, len)) {
+                    uint8_t answer[CONTROL_QUERY_MAX_SIZE];
+                    size_t answer_len = control_query((uint8_t*)rx_buffer, answer);
+                    err = sendto(sock, answer, answer_len, 0, (struct sockaddr *)&source_addr, sizeof(source_addr));
+                } else if (control_is_v2((uint8_t*)rx_buffer, len)) {
+                    uint8_t response[CONTROL_RESPONSE_SIZE(CONTROL_MAX_COMMANDS)];
+                    size_t response_len = control_v2((uint8_t*)rx_buffer, len, &source_addr, &restart_esp, response);
+                    err = sendto(sock, response, response_len, 0, (struct sockaddr *)&source_addr, sizeof(source_addr));
+                } else {
+                    uint8_t status = command_parse(rx_buffer[0], (uint8_t*)&rx_buffer[1], len - 1, &s_commands[0]);
+                    if (status == CONTROL_UNKNOWN) {
+                        metrics_add(CONTROL_UDP_INVALID, 1);
+                        continue;
+                    }
+                    if (status == CONTROL_OK) {
+                        command_stage(&s_commands[0]);
+                        // light_manager and uploader are told by config_commit()
+                        config_commit();
+                        restart_esp = s_commands[0].type == CONTROL_WIFI;
+                        // v1 acknowledges by echoing the message
                         err = sendto(sock, rx_buffer, len, 0, (struct sockaddr *)&source_addr, sizeof(source_addr));
-                        if (err < 0) {
-                            ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
-                            restart_udp_server = true;
-                            break;
-                        }
-                        // TODO il faut redémarrer le wifi aussitôt !
-                        const int sec = 10;
-                        ESP_LOGI(TAG, "Wifi reset. Restarting ESP-32 in %d seconds", sec);
-                        vTaskDelay((sec * 1000)/ portTICK_PERIOD_MS);
-                        esp_restart();
-
-                        break;
-                    default:
-                        ESP_LOGE(TAG, "Unknown flag sent: %d",rx_buffer[0]);
+                    } else {
+                        metrics_add(CONTROL_UDP_INVALID, 1);
+                        err = sendto(sock, "invalid", 7, 0, (struct sockaddr *)&source_addr, sizeof(source_addr));
+                    }
+                }
+                if (err < 0) {
+                    ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
+                    restart_udp_server = true;
+                }
+                if (restart_esp) {
+                    // TODO il faut redémarrer le wifi aussitôt !
+                    const int sec = 10;
+                    ESP_LOGI(TAG, "Wifi reset. Restarting ESP-32 in %d seconds", sec);
+                    vTaskDelay((sec * 1000)/ portTICK_PERIOD_MS);
+                    esp_restart();
                 }
                 if (restart_udp_server) {
                     break;
@@ -356,10 +515,12 @@ static void udp_server_task(void *pvParameters)
 
         if (sock != -1) {
             ESP_LOGE(TAG, "Shutting down socket and restarting...");
+            metrics_add(CONTROL_UDP_RESTARTS, 1);
             shutdown(sock, 0);
             close(sock);
         }
     }
+    metrics_task(CONTROL_STACK_UDP, NULL);
     vTaskDelete(NULL);
 }
 
@@ -379,153 +540,117 @@ void time_test() {
 
 
 
-static void relay_toggle() {
-    static bool is_open = false;
-    gpio_set_level(TRANSISTOR_PIN,is_open);
-    is_open = ! is_open;
-    //ESP_LOGI(TAG,"Open? %d",gpio_get_level(TEST_PIN));
-}
-
-static bool is_relay_on() {
-    // true if relay is on
-    //return !gpio_get_level(TEST_PIN);
-    // relay is on if pin is off
-    return !gpio_get_level(TRANSISTOR_PIN);
-}
-
 static void pin_init() {
 // led
   esp_rom_gpio_pad_select_gpio(LED_PIN);
   gpio_set_direction(LED_PIN, GPIO_MODE_OUTPUT);
 
-// relay 
-  esp_rom_gpio_pad_select_gpio(TRANSISTOR_PIN);
-  gpio_set_direction(TRANSISTOR_PIN, GPIO_MODE_INPUT_OUTPUT);
-  // first call: transistor is now off, relay is on
-  gpio_set_level(TRANSISTOR_PIN, false);
-  // test3d
-  //esp_rom_gpio_pad_select_gpio(TEST_PIN);
-  //gpio_set_direction(TEST_PIN,GPIO_MODE_INPUT);
-}
-
-struct tm* fill_time() {
-    time_t rawtime;
-    time(&rawtime);
-    return localtime( &rawtime);
+// relays: every load is on
+  relay_init();
 }
 
-bool is_time_in(struct tm* current_time, struct Period* period) {
-    // Convert the start and end times to minutes since midnight
-    int start_time_minutes = period->start_h* 60 + period->start_m;
-    int end_time_minutes = period->end_h * 60 + period->end_m;
+static schedule_t s_schedule;
 
-    // Convert the current time to minutes since midnight
-    int current_time_minutes = current_time->tm_hour * 60 + current_time->tm_min;
-
-    // Check if the current time is within the given period
-    if (start_time_minutes <= end_time_minutes) {
-        // Start time is before or equal to end time
-        return start_time_minutes <= current_time_minutes && current_time_minutes < end_time_minutes;
+// the weekly schedule, or the daily period if none was set
+static void load_schedule(void) {
+    schedule_spec_t spec;
+    config_get(CFG_SCHEDULE, &spec, sizeof(spec));
+    if (spec.count == 0) {
+        struct Period p;
+        config_get(CFG_PERIOD, &p, sizeof(p));
+        print_period(&p);
+        schedule_from_period(&spec, &p);
     } else {
-        // Start time is after end time
-        return start_time_minutes <= current_time_minutes || current_time_minutes < end_time_minutes;
+        ESP_LOGI(TAG, "Weekly schedule: %d windows", spec.count);
     }
+    schedule_build(&s_schedule, &spec);
 }
 
+// called by config_commit() when a new period or schedule is set
+static void schedule_changed(config_key_t key, void* arg) {
+    light_notify(LIGHT_SCHEDULE);
+}
 
+static void time_synced(struct timeval* tv) {
+    ESP_LOGI(TAG, "Time synchronized");
+    clock_synced(tv);
+    boot_mark(BOOT_TIME_SYNC);
+    light_notify(LIGHT_CLOCK);
+}
 
+/* Sleeps on its task notification until the next transition of the
+ * schedule, the end of an override or a LIGHT_* event, then sets the relay. */
 void light_manager(void *pvParameter) {
-    struct Period p = { 7, 0, 22, 0 }; // default values
-    // trying to load from NVS
-    nvs_handle_t nvsh;
-    esp_err_t err = nvs_open("storage", NVS_READONLY, &nvsh);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG, "Error loading Period from NVS");
-    } else {
-        //char arr[10];
-        size_t size = sizeof(p);
-        err = nvs_get_blob(nvsh, "period", &p, &size);
-        print_period(&p);
-        switch (err) {
-            case ESP_OK:
-                //create_period(&p, arr); // probably useless when saved as a blob
-                ESP_LOGI(TAG, "Period loaded");
-                print_period(&p);
-                break;
-            case ESP_ERR_NVS_NOT_FOUND:
-                ESP_LOGI(TAG,"Period not loaded from NVS: not initialized yet. Falling back to default");
-                break;
-            default:
-                ESP_LOGE(TAG, "Error (%s) when loading Period from NVS. Falling back to default",esp_err_to_name(err));
-        }
-    }
-    nvs_close(nvsh);
-    ESP_LOGI(TAG, "Period set");
-    print_period(&p);
+    load_schedule();
+    config_subscribe(CFG_PERIOD, schedule_changed, NULL);
+    config_subscribe(CFG_SCHEDULE, schedule_changed, NULL);
 
     while (1) {
-        if (uxQueueMessagesWaiting(period_queue)) {
-            xQueueReceive(period_queue, &p, 0);
-            ESP_LOGI(TAG, "New period set.");
-            print_period(&p);
-            // save in NVS 
-            nvs_handle_t nvsh;
-            esp_err_t err = nvs_open("storage", NVS_READWRITE, &nvsh);
-            if (err != ESP_OK) {
-                ESP_LOGE(TAG, "Error %s opening NVS", esp_err_to_name(err));
-            } else {
-                /*
-                char arr[10] = { p.start_h, p.start_m, p.end_h, p.end_m , '\0'};
-                * TODO erreur ici: nvs enregistre chaque byte, mais si ce byte est égal à 0, il le considère comme la fin de la chaîne e
-                 * ne va pas plus loin. Il faut faire en sorte que tous les bytes soient enregistrés.
-                 * utiliser un set_blob à la place (et get blob de l'autre côté)
-                 */
-                err = nvs_set_blob(nvsh, "period",&p, sizeof(p));
-                ESP_LOGI(TAG, "NVS set period: %s",esp_err_to_name(err));
-                err = nvs_commit(nvsh);
-                ESP_LOGI(TAG, "NVS set period commit: %s",esp_err_to_name(err));
-                nvs_close(nvsh);
-                print_period(&p);
+        TickType_t timeout = portMAX_DELAY;
+        // every channel bound to the schedule switches at once
+        uint32_t channels = relay_schedule_mask(0);
+        int64_t remaining_us;
+        uint8_t override = override_get(&remaining_us);
+        int64_t now;
+        int minute;
+        if (override != COMMAND_OVERRIDE_NONE) {
+            relay_apply(channels, override == COMMAND_OVERRIDE_ON ? channels : 0);
+            ESP_LOGI(TAG, "Relay forced %s", override == COMMAND_OVERRIDE_ON ? "on" : "off");
+            if (remaining_us > 0) {
+                timeout = pdMS_TO_TICKS(MIN(remaining_us / 1000, OVERRIDE_MAX_WAIT_MS)) + 1;
             }
-        }
-        struct tm* time = fill_time();
-        if (time->tm_year == 70) {
+        } else if ((minute = clock_minute_of_week(&now)) < 0) {
+            // woken up by time_synced()
             ESP_LOGE(TAG, "Time not yet updated");
         } else {
-            if (is_time_in(time, &p)) {
-                switch_NC_relay(true);
-            } else {
-                switch_NC_relay(false);
+            uint32_t before = relay_state();
+            relay_apply(channels, schedule_is_on(&s_schedule, minute) ? channels : 0);
+            metrics_add(CONTROL_SCHEDULE_CHECKS, 1);
+            metrics_add(CONTROL_RELAY_SWITCHES, __builtin_popcount((before ^ relay_state()) & channels));
+            boot_mark(BOOT_FIRST_RELAY);
+            int next = schedule_next_transition(&s_schedule, minute);
+            if (next > 0) {
+                // or at the change of the UTC offset, which moves the minute
+                uint32_t ms = clock_next_boundary(now, next);
+                ESP_LOGI(TAG, "Next check in %" PRIu32 " ms", ms);
+                timeout = pdMS_TO_TICKS(ms) + 1;
             }
         }
-        sleep(1);
+        uint32_t events = 0;
+        xTaskNotifyWait(0, UINT32_MAX, &events, timeout);
+        if (events & LIGHT_SCHEDULE) {
+            ESP_LOGI(TAG, "New schedule set.");
+            load_schedule();
+        }
     }
 }
 
 void init_udp_and_lamp(void)
 {
-    // local time
-    setenv("TZ","UTC-1",1);
+    // local time, of the schedule and of newlib
+    clock_init(CONFIG_BME_TZ);
+    setenv("TZ", CONFIG_BME_TZ, 1);
     tzset();
 
+    // pin init
+    pin_init();
+
+    // before time_synced() and the commands can notify it
+    s_light_task = BME_TASK_CREATE(light_manager, "light_manager", 4096, NULL, 6);
+    metrics_task(CONTROL_STACK_LIGHT, s_light_task);
+
     // update time
     ESP_LOGI(TAG, "Set SNTP update");
     sntp_setoperatingmode(SNTP_OPMODE_POLL);
     sntp_setservername(0, "pool.ntp.org");
+    sntp_set_time_sync_notification_cb(time_synced);
     sntp_init();
-    // pin init
-    pin_init();
-
-    // queue to transmit messages
-    period_queue = xQueueCreate(5, sizeof(struct Period));
 
     // udp server
 #ifdef CONFIG_EXAMPLE_IPV4
-    xTaskCreate(udp_server_task, "udp_server", 4096, (void*)AF_INET, 5, NULL);
+    metrics_task(CONTROL_STACK_UDP, BME_TASK_CREATE(udp_server_task, "udp_server", 4096, (void*)AF_INET, 5));
 #endif
 #ifdef CONFIG_EXAMPLE_IPV6
-    xTaskCreate(udp_server_task, "udp_server", 4096, (void*)AF_INET6, 5, NULL);
+    metrics_task(CONTROL_STACK_UDP, BME_TASK_CREATE(udp_server_task, "udp_server", 4096, (void*)AF_INET6, 5));
 #endif
-
-    xTaskCreate(light_manager, "light_manager", 4096, NULL, 5, NULL);
 }
@@ -0,0 +1,456 @@
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "esp_http_client.h"
+#include "lwip/sockets.h"
+#include <lwip/netdb.h>
+
+#include "sdkconfig.h"
+#include "bridge.h"
+#include "boot.h"
+#include "metrics.h"
+#include "static_alloc.h"
+#include "uploader.h"
+#include "ring_log.h"
+#include "telemetry.h"
+#include "config.h"
+
+#define TAG "Uploader"
+#define URL_SIZE 200
+#define HOST_SIZE 64
+// "temp=%f&hum=%f&press=%f&source=%d&time=%lu&seq=%lu\n" fits easily
+#define LINE_SIZE 128
+// readings of the flash store sent per POST, and POSTs per reading
+#define REPLAY_MAX_POSTS 8
+// sequence numbers reserved in NVS at once
+#define SEQ_RESERVE 64
+#ifdef CONFIG_TELEMETRY_BINARY
+#define REPLAY_BATCH 16
+#define BODY_RECORDS MAX(CONFIG_UPLOAD_BATCH_SIZE, REPLAY_BATCH)
+#define BODY_SIZE TELEMETRY_FRAME_SIZE(BODY_RECORDS)
+#else
+/* No more lines than a live upload: a form parser (the legacy
+ * update-sensor.php) reads a multi-line body as a single reading, so
+ * several lines are only sent when batching was chosen for the collector. */
+#define REPLAY_BATCH CONFIG_UPLOAD_BATCH_SIZE
+#define BODY_SIZE (LINE_SIZE * CONFIG_UPLOAD_BATCH_SIZE)
+#endif
+
+/* One client handle (or UDP socket) is kept for the whole life of the firmware:
+ * the connection to the collector stays open between two uploads
+ * (HTTP keep-alive) and the address of the collector is resolved
+ * only once, or again after a failure.
+ */
+#ifndef CONFIG_TELEMETRY_TRANSPORT_UDP
+static esp_http_client_handle_t s_client = NULL;
+#endif
+static SemaphoreHandle_t s_url_mutex = NULL;
+static char s_url[URL_SIZE];
+static bool s_url_changed = true;
+static bool s_resolved = false;
+
+#ifdef CONFIG_BME_DEEP_SLEEP
+// kept during deep sleep, so that the wakes which do not upload need no Wi-Fi
+#define BATCH_ATTR RTC_DATA_ATTR
+#else
+#define BATCH_ATTR
+#endif
+
+// readings waiting to be sent in one POST body
+static BATCH_ATTR ring_record_t s_batch[CONFIG_UPLOAD_BATCH_SIZE];
+static BATCH_ATTR int s_batched = 0;
+static char s_body[BODY_SIZE];
+static size_t s_body_len = 0;
+static bool s_store_ok = false;
+/* Sequence number of the last reading. It goes on across resets: the
+ * numbers up to s_seq_reserved are written to NVS before they are used,
+ * and a reset starts after them (a few are skipped, never reused). */
+static BATCH_ATTR uint32_t s_seq = 0;
+static BATCH_ATTR uint32_t s_seq_reserved = 0;
+
+#ifndef CONFIG_TELEMETRY_TRANSPORT_UDP
+static esp_err_t _http_event_handle(esp_http_client_event_t *evt)
+{
+    switch(evt->event_id) {
+        case HTTP_EVENT_ERROR:
+            ESP_LOGI(TAG, "HTTP_EVENT_ERROR");
+            break;
+        case HTTP_EVENT_ON_CONNECTED:
+            ESP_LOGI(TAG, "HTTP_EVENT_ON_CONNECTED");
+            break;
+        case HTTP_EVENT_HEADER_SENT:
+            ESP_LOGI(TAG, "HTTP_EVENT_HEADER_SENT");
+            break;
+        case HTTP_EVENT_ON_HEADER:
+            ESP_LOGI(TAG, "HTTP_EVENT_ON_HEADER");
+            printf("%.*s", evt->data_len, (char*)evt->data);
+            break;
+        case HTTP_EVENT_ON_DATA:
+            ESP_LOGI(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
+            if (!esp_http_client_is_chunked_response(evt->client)) {
+                printf("%.*s", evt->data_len, (char*)evt->data);
+            }
+
+            break;
+        case HTTP_EVENT_ON_FINISH:
+            ESP_LOGI(TAG, "HTTP_EVENT_ON_FINISH");
+            break;
+        case HTTP_EVENT_DISCONNECTED:
+            ESP_LOGI(TAG, "HTTP_EVENT_DISCONNECTED");
+            break;
+
+        case HTTP_EVENT_REDIRECT:
+            ESP_LOGI(TAG, "HTTP_EVENT_REDIRECT");
+            break;
+    }
+    return ESP_OK;
+}
+#endif
+
+// called when the URL is changed over UDP
+static void uploader_url_changed(config_key_t key, void* arg) {
+    xSemaphoreTake(s_url_mutex, portMAX_DELAY);
+    config_get(CFG_URL, s_url, sizeof(s_url));
+    s_url_changed = true;
+    xSemaphoreGive(s_url_mutex);
+    ESP_LOGI(TAG, "URl: %s", s_url);
+}
+
+#ifndef CONFIG_TELEMETRY_TRANSPORT_UDP
+/* The client and its buffers are allocated at boot, before the first
+ * reading, so that the uploads only reuse them. */
+static esp_err_t uploader_client_init(const char* url) {
+    esp_http_client_config_t config = {
+        .url = url,
+        .event_handler = _http_event_handle,
+        .keep_alive_enable = true,
+    };
+    s_client = esp_http_client_init(&config);
+    if (s_client == NULL) {
+        ESP_LOGE(TAG, "Unable to create the HTTP client");
+        return ESP_ERR_NO_MEM;
+    }
+    esp_http_client_set_method(s_client, HTTP_METHOD_POST);
+#ifdef CONFIG_TELEMETRY_BINARY
+    esp_http_client_set_header(s_client, "Content-Type", TELEMETRY_CONTENT_TYPE);
+#endif
+    return ESP_OK;
+}
+#endif
+
+// the next batch must be numbered without NVS: a deep sleep wake may not init it
+static void seq_reserve(void) {
+    if (s_seq + CONFIG_UPLOAD_BATCH_SIZE <= s_seq_reserved) {
+        return;
+    }
+    uint32_t reserved = s_seq + SEQ_RESERVE;
+    if (config_set(CFG_SEQ, &reserved, sizeof(reserved)) == ESP_OK && config_commit() == ESP_OK) {
+        s_seq_reserved = reserved;
+    }
+}
+
+void uploader_init(void) {
+    s_url_mutex = BME_MUTEX_CREATE();
+    config_get(CFG_URL, s_url, sizeof(s_url));
+    config_subscribe(CFG_URL, uploader_url_changed, NULL);
+    ESP_LOGI(TAG, "URl: %s", s_url);
+#ifndef CONFIG_TELEMETRY_TRANSPORT_UDP
+    uploader_client_init(s_url);
+#endif
+    if (s_seq_reserved == 0) {
+        // reset: the numbers up to the last reservation may have been used
+        config_get(CFG_SEQ, &s_seq_reserved, sizeof(s_seq_reserved));
+        s_seq = MAX(s_seq, s_seq_reserved);
+    }
+    s_store_ok = ring_log_init() == ESP_OK;
+    if (s_store_ok) {
+        s_seq = MAX(s_seq, ring_log_last_seq());
+    }
+    seq_reserve();
+}
+
+/* Copies the host name of url in name, and returns what follows
+ * it (":port/path"), or NULL if url is not http[s]://host...
+ */
+static const char* url_host(const char* url, char* name, size_t size) {
+    const char* host = strstr(url, "://");
+    if (host == NULL) {
+        return NULL;
+    }
+    host += 3;
+    size_t name_len = strcspn(host, ":/");
+    if (name_len == 0 || name_len >= size) {
+        return NULL;
+    }
+    memcpy(name, host, name_len);
+    name[name_len] = '\0';
+    return host + name_len;
+}
+
+static bool resolve_ipv4(const char* name, struct in_addr* addr) {
+    const struct addrinfo hints = {
+        .ai_family = AF_INET,
+    };
+    struct addrinfo *res = NULL;
+    if (getaddrinfo(name, NULL, &hints, &res) != 0 || res == NULL) {
+        ESP_LOGE(TAG, "Unable to resolve %s", name);
+        return false;
+    }
+    *addr = ((struct sockaddr_in *)res->ai_addr)->sin_addr;
+    freeaddrinfo(res);
+    return true;
+}
+
+#ifdef CONFIG_TELEMETRY_TRANSPORT_UDP
+/* Each frame is one datagram to the collector, on the host of the URL.
+ * The socket is connected once, so the address is resolved only once.
+ */
+static int s_sock = -1;
+
+static esp_err_t uploader_post_udp(const char* url, bool url_changed) {
+    if (s_sock < 0) {
+        s_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+        if (s_sock < 0) {
+            ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
+            return ESP_FAIL;
+        }
+#ifdef CONFIG_TELEMETRY_UDP_ACK
+        struct timeval timeout = {
+            .tv_sec = CONFIG_TELEMETRY_UDP_ACK_TIMEOUT_MS / 1000,
+            .tv_usec = (CONFIG_TELEMETRY_UDP_ACK_TIMEOUT_MS % 1000) * 1000,
+        };
+        setsockopt(s_sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+#endif
+    }
+    if (url_changed || !s_resolved) {
+        char name[HOST_SIZE];
+        struct sockaddr_in addr = {
+            .sin_family = AF_INET,
+            .sin_port = htons(CONFIG_TELEMETRY_UDP_PORT),
+        };
+        if (url_host(url, name, sizeof(name)) == NULL || !resolve_ipv4(name, &addr.sin_addr)) {
+            return ESP_FAIL;
+        }
+        if (connect(s_sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            ESP_LOGE(TAG, "Unable to connect socket: errno %d", errno);
+            return ESP_FAIL;
+        }
+        s_resolved = true;
+    }
+
+    if (send(s_sock, s_body, s_body_len, 0) < 0) {
+        ESP_LOGE(TAG, "Error occurred during sending: errno %d", errno);
+        s_resolved = false;
+        return ESP_FAIL;
+    }
+
+#ifdef CONFIG_TELEMETRY_UDP_ACK
+    // the collector acks the last record of the frame; unacked readings go to the flash store
+    telemetry_record_t last;
+    telemetry_decode_record(telemetry_frame_record((uint8_t*)s_body, s_body[1] - 1), &last);
+    while (1) {
+        uint8_t ack[TELEMETRY_ACK_SIZE + 1];
+        uint16_t sensor;
+        uint32_t seq;
+        int len = recv(s_sock, ack, sizeof(ack), 0);
+        if (len < 0) {
+            ESP_LOGE(TAG, "No ack for reading %" PRIu32, last.seq);
+            return ESP_ERR_TIMEOUT;
+        }
+        if (telemetry_decode_ack(ack, len, &sensor, &seq) && sensor == CONFIG_BME_ID && seq == last.seq) {
+            return ESP_OK;
+        }
+        // late ack of a previous frame
+    }
+#endif
+    return ESP_OK;
+}
+#else
+/* Points the client to the IP address of the collector, so that
+ * a reconnection does not need a DNS request.
+ * The name is kept for https, since the certificate is checked against it.
+ */
+static void uploader_resolve(const char* url) {
+    s_resolved = true;
+    char name[HOST_SIZE];
+    const char* rest = url_host(url, name, sizeof(name));
+    if (rest != NULL) {
+        // host[:port] of url, set at each change so that it never names the previous collector
+        char host_port[HOST_SIZE + 8];
+        snprintf(host_port, sizeof(host_port), "%s%.*s", name, (int)strcspn(rest, "/"), rest);
+        esp_http_client_set_header(s_client, "Host", host_port);
+    }
+    struct in_addr addr;
+    if (strncasecmp(url, "http://", 7) != 0 || rest == NULL) {
+        esp_http_client_set_url(s_client, url);
+        return;
+    }
+    if (!resolve_ipv4(name, &addr)) {
+        esp_http_client_set_url(s_client, url);
+        s_resolved = false;
+        return;
+    }
+    char ip[16];
+    inet_ntoa_r(addr, ip, sizeof(ip));
+
+    char resolved_url[URL_SIZE + sizeof(ip)];
+    snprintf(resolved_url, sizeof(resolved_url), "http://%s%s", ip, rest);
+    esp_http_client_set_url(s_client, resolved_url);
+    ESP_LOGI(TAG, "%s resolved to %s", name, ip);
+}
+
+static esp_err_t uploader_post_http(const char* url, bool url_changed) {
+    if (s_client == NULL && uploader_client_init(url) != ESP_OK) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (url_changed || !s_resolved) {
+        uploader_resolve(url);
+    }
+
+#ifndef CONFIG_TELEMETRY_BINARY
+    printf("%.*s", (int)s_body_len, s_body);
+#endif
+    esp_http_client_set_post_field(s_client, s_body, s_body_len);
+    esp_err_t err = esp_http_client_perform(s_client);
+
+    if (err == ESP_OK) {
+       int status = esp_http_client_get_status_code(s_client);
+       ESP_LOGI(TAG, "Status = %d, content_length = %" PRId64,
+               status,
+               esp_http_client_get_content_length(s_client));
+       if (status < 200 || status >= 300) {
+           err = ESP_FAIL;
+       }
+    } else {
+        ESP_LOGE(TAG, "Upload failed: %s", esp_err_to_name(err));
+        // the collector may have moved: resolve it again next time
+        esp_http_client_close(s_client);
+        s_resolved = false;
+    }
+    return err;
+}
+#endif
+
+static void body_finish(void);
+
+static esp_err_t uploader_post(void) {
+    body_finish();
+    char url[URL_SIZE];
+    bool url_changed;
+    xSemaphoreTake(s_url_mutex, portMAX_DELAY);
+    url_changed = s_url_changed;
+    s_url_changed = false;
+    strcpy(url, s_url);
+    xSemaphoreGive(s_url_mutex);
+
+    int64_t start = esp_timer_get_time();
+#ifdef CONFIG_TELEMETRY_TRANSPORT_UDP
+    esp_err_t err = uploader_post_udp(url, url_changed);
+#else
+    esp_err_t err = uploader_post_http(url, url_changed);
+#endif
+    metrics_latency((uint32_t)((esp_timer_get_time() - start) / 1000));
+    metrics_add(CONTROL_UPLOADS, 1);
+    metrics_add(CONTROL_UPLOAD_BYTES, s_body_len);
+    if (err == ESP_OK) {
+        boot_mark(BOOT_FIRST_UPLOAD);
+    } else {
+        metrics_add(CONTROL_UPLOAD_FAILURES, 1);
+    }
+    s_body_len = 0;
+    return err;
+}
+
+#ifdef CONFIG_TELEMETRY_BINARY
+// records of the next frame, encoded by body_finish()
+static telemetry_record_t s_records[BODY_RECORDS];
+static uint8_t s_record_count = 0;
+
+static void body_add(const ring_record_t* rec) {
+    telemetry_from_reading(&s_records[s_record_count++], CONFIG_BME_ID, rec->seq, rec->timestamp,
+            rec->res.temp, rec->res.press, rec->res.hum);
+}
+
+static void body_finish(void) {
+    s_body_len = telemetry_encode_frame(s_records, s_record_count, (uint8_t*)s_body, sizeof(s_body));
+    s_record_count = 0;
+}
+#else
+/* Every reading carries its own time: a batch, or the readings kept in
+ * flash or across deep sleep, reach the collector long after they were
+ * taken. time=0 (clock not set yet) makes the collector use the arrival time.
+ */
+static void body_add(const ring_record_t* rec) {
+    s_body_len += snprintf(s_body + s_body_len, sizeof(s_body) - s_body_len,
+            "temp=%f&hum=%f&press=%f&source=%d&time=%" PRIu32 "&seq=%" PRIu32 "\n",
+            rec->res.temp, rec->res.hum, rec->res.press, CONFIG_BME_ID, rec->timestamp, rec->seq);
+}
+
+// the lines are written as they are added
+static void body_finish(void) {
+}
+#endif
+
+static uint32_t now_or_zero(void) {
+    time_t now = time(NULL);
+    // before SNTP sync the clock starts in 1970
+    return now > 1600000000 ? (uint32_t)now : 0;
+}
+
+/* Sends the readings kept in flash, oldest first, while the collector answers.
+ */
+static void uploader_replay(void) {
+    ring_record_t records[REPLAY_BATCH];
+    for (int i = 0; i < REPLAY_MAX_POSTS; i++) {
+        int n = ring_log_peek(records, REPLAY_BATCH);
+        if (n == 0) {
+            return;
+        }
+        for (int j = 0; j < n; j++) {
+            body_add(&records[j]);
+        }
+        if (uploader_post() != ESP_OK) {
+            return;
+        }
+        ring_log_ack(n);
+        ESP_LOGI(TAG, "%d stored readings sent, %" PRIu32 " left", n, ring_log_pending());
+    }
+}
+
+int uploader_batched(void) {
+    return s_batched;
+}
+
+esp_err_t send_data(const _bme280_res* results) {
+    ring_record_t* rec = &s_batch[s_batched++];
+    rec->res = *results;
+    rec->timestamp = now_or_zero();
+    rec->seq = ++s_seq;
+    if (s_batched < CONFIG_UPLOAD_BATCH_SIZE) {
+        ESP_LOGI(TAG, "Reading batched (%d/%d)", s_batched, CONFIG_UPLOAD_BATCH_SIZE);
+        return ESP_OK;
+    }
+
+    for (int i = 0; i < s_batched; i++) {
+        body_add(&s_batch[i]);
+    }
+    esp_err_t err = uploader_post();
+    if (err != ESP_OK) {
+        // kept in flash until the collector is back
+        for (int i = 0; s_store_ok && i < s_batched; i++) {
+            ring_log_append(&s_batch[i]);
+        }
+    } else if (s_store_ok) {
+        uploader_replay();
+    }
+    s_batched = 0;
+    seq_reserve();
+    return err;
+}
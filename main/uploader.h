@@ -0,0 +1,8 @@
+#ifndef UPLOADER_H
+#define UPLOADER_H
+
+void uploader_init(void);
+// readings waiting for the batch to be full
+int uploader_batched(void);
+
+#endif
@@ -3,6 +3,8 @@
 #include <string.h> 
 #include <ctype.h>
 
+#include "util.h"
+
 bool is_valid_url(const char* str) {
     // Check for NULL input
     if (str == NULL) {
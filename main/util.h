@@ -0,0 +1,20 @@
+#ifndef UTIL_H
+#define UTIL_H
+#include <stdbool.h>
+
+/* Checks of the values received over UDP, without any ESP-IDF dependency
+ * so that they also build on the host (see bench.cpp).
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// http:// or https:// followed by something
+bool is_valid_url(const char* str);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
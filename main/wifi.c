@@ -14,6 +14,8 @@
 #include "esp_wifi.h"
 #include "esp_event.h"
 #include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_netif.h"
 #include "nvs_flash.h"
 
 #include "driver/gpio.h"
@@ -21,12 +23,16 @@
 #include "lwip/sys.h"
 
 
-#include "esp_http_client.h"
-
 #include "rom/ets_sys.h"
 #include <stdio.h>
 #include "sdkconfig.h"
 #include "bridge.h"
+#include "uploader.h"
+#include "config.h"
+#include "boot.h"
+#include "metrics.h"
+#include "static_alloc.h"
+#include "wifi.h"
 
 #define LED_PIN 2
 #define TAG "BMX"
@@ -49,74 +55,6 @@ static void led_pin_init() {
     gpio_set_direction(LED_PIN,GPIO_MODE_OUTPUT);
 }
 
-// NVS
-
-esp_err_t read_write_nvs_value_str(const char* key, char* fallback, size_t l) {
-    esp_err_t err;
-    nvs_handle_t handle;
-    err = nvs_open("storage",NVS_READWRITE, &handle);
-    if (err != ESP_OK) {
-        ESP_LOGE(TAG,"Error (%s) opening NVS handle. Falling back to default...",esp_err_to_name(err));
-        return err;
-    } 
-
-    err = nvs_get_str(handle, key, fallback, &l);
-    switch (err) {
-        case ESP_OK:
-            break;
-        case ESP_ERR_NVS_NOT_FOUND:
-            // saving fallback
-            nvs_set_str(handle, key, fallback);
-            err = nvs_commit(handle);
-            ESP_LOGI(TAG, "Saving key %s",key);
-            break;
-        default:
-            ESP_LOGE(TAG, "Error (%s) reading key %s",esp_err_to_name(err), key);
-    }
-    nvs_close(handle);
-    return err;
-}
-
-
-/* HTTP
- */
-esp_err_t _http_event_handle(esp_http_client_event_t *evt)
-{
-    switch(evt->event_id) {
-        case HTTP_EVENT_ERROR:
-            ESP_LOGI(TAG, "HTTP_EVENT_ERROR");
-            break;
-        case HTTP_EVENT_ON_CONNECTED:
-            ESP_LOGI(TAG, "HTTP_EVENT_ON_CONNECTED");
-            break;
-        case HTTP_EVENT_HEADER_SENT:
-            ESP_LOGI(TAG, "HTTP_EVENT_HEADER_SENT");
-            break;
-        case HTTP_EVENT_ON_HEADER:
-            ESP_LOGI(TAG, "HTTP_EVENT_ON_HEADER");
-            printf("%.*s", evt->data_len, (char*)evt->data);
-            break;
-        case HTTP_EVENT_ON_DATA:
-            ESP_LOGI(TAG, "HTTP_EVENT_ON_DATA, len=%d", evt->data_len);
-            if (!esp_http_client_is_chunked_response(evt->client)) {
-                printf("%.*s", evt->data_len, (char*)evt->data);
-            }
-
-            break;
-        case HTTP_EVENT_ON_FINISH:
-            ESP_LOGI(TAG, "HTTP_EVENT_ON_FINISH");
-            break;
-        case HTTP_EVENT_DISCONNECTED:
-            ESP_LOGI(TAG, "HTTP_EVENT_DISCONNECTED");
-            break;
-
-        case HTTP_EVENT_REDIRECT:
-            ESP_LOGI(TAG, "HTTP_EVENT_REDIRECT");
-            break;
-    }
-    return ESP_OK;
-}
-
 /* The examples use WiFi configuration that you can set via project configuration menu
 
    If you'd rather not, just change the below entries to strings with
@@ -135,6 +73,23 @@ static EventGroupHandle_t s_wifi_event_group;
 #define WIFI_CONNECTED_BIT BIT0
 #define WIFI_FAIL_BIT      BIT1
 
+// AP of this connection, and whether it was the one of the last boot
+static wifi_ap_t s_ap;
+// connecting to the cached AP, until connected
+static bool s_cached_ap = false;
+// the config is bound to the BSSID and channel of the cached AP
+static bool s_ap_pinned = false;
+
+// the cached AP is gone or moved: scan every channel, as without a cache
+static void scan_all_channels(void) {
+    wifi_config_t wifi_config;
+    s_ap_pinned = false;
+    esp_wifi_get_config(WIFI_IF_STA, &wifi_config);
+    wifi_config.sta.bssid_set = false;
+    wifi_config.sta.channel = 0;
+    esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
+    esp_wifi_connect();
+}
 
 
 static void event_handler(void* arg, esp_event_base_t event_base,
@@ -148,7 +103,18 @@ static void event_handler(void* arg, esp_event_base_t event_base,
         s_retry_num = 0;
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
         led_light(false);
-        if (s_retry_num < EXAMPLE_ESP_MAXIMUM_RETRY) {
+        metrics_add(CONTROL_WIFI_RECONNECTS, 1);
+        if (s_ap_pinned) {
+            if (s_cached_ap) {
+                // only a failure of the cache at boot counts as a full scan
+                ESP_LOGI(TAG, "cached AP failed, scanning");
+                s_cached_ap = false;
+                boot_flag(BOOT_FULL_SCAN);
+            } else {
+                ESP_LOGI(TAG, "AP lost, scanning");
+            }
+            scan_all_channels();
+        } else if (s_retry_num < EXAMPLE_ESP_MAXIMUM_RETRY) {
             esp_wifi_connect();
             s_retry_num++;
             ESP_LOGI(TAG, "retry to connect to the AP");
@@ -182,9 +148,15 @@ static void event_handler(void* arg, esp_event_base_t event_base,
         }
         ESP_LOGI(TAG,"connect to the AP fail");
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_CONNECTED) {
+        wifi_event_sta_connected_t* event = (wifi_event_sta_connected_t*) event_data;
+        memcpy(s_ap.bssid, event->bssid, sizeof(s_ap.bssid));
+        s_ap.channel = event->channel;
+        s_cached_ap = false;
+        boot_mark(BOOT_WIFI_CONNECTED);
         led_light(true);
         s_retry_num = 0;
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+        boot_mark(BOOT_GOT_IP);
         s_retry_num = 0;
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
         ESP_LOGI(TAG, "got ip:" IPSTR, IP2STR(&event->ip_info.ip));
@@ -192,14 +164,48 @@ static void event_handler(void* arg, esp_event_base_t event_base,
     }
 }
 
+#ifdef CONFIG_BME_STATIC_IP
+// no DHCP exchange: the address is known at boot
+static void set_static_ip(esp_netif_t* netif) {
+    esp_netif_ip_info_t ip = {
+        .ip.addr = esp_ip4addr_aton(CONFIG_BME_STATIC_IP_ADDR),
+        .netmask.addr = esp_ip4addr_aton(CONFIG_BME_STATIC_NETMASK),
+        .gw.addr = esp_ip4addr_aton(CONFIG_BME_STATIC_GW),
+    };
+    esp_netif_dns_info_t dns = {
+        .ip.u_addr.ip4.addr = esp_ip4addr_aton(CONFIG_BME_STATIC_DNS),
+        .ip.type = ESP_IPADDR_TYPE_V4,
+    };
+    esp_netif_dhcpc_stop(netif);
+    ESP_ERROR_CHECK(esp_netif_set_ip_info(netif, &ip));
+    ESP_ERROR_CHECK(esp_netif_set_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns));
+    boot_flag(BOOT_STATIC_IP);
+    ESP_LOGI(TAG, "static ip: %s", CONFIG_BME_STATIC_IP_ADDR);
+}
+#endif
+
+// written only when the AP changed, to spare the flash
+static void save_ap(void) {
+    wifi_ap_t saved;
+    config_get(CFG_WIFI_AP, &saved, sizeof(saved));
+    if (memcmp(&saved, &s_ap, sizeof(s_ap)) != 0) {
+        config_set(CFG_WIFI_AP, &s_ap, sizeof(s_ap));
+        config_commit();
+    }
+}
+
 void wifi_init_sta(void) 
 {
-    s_wifi_event_group = xEventGroupCreate();
+    s_wifi_event_group = BME_EVENT_GROUP_CREATE();
 
     ESP_ERROR_CHECK(esp_netif_init());
 
         ESP_ERROR_CHECK(esp_event_loop_create_default());
+#ifdef CONFIG_BME_STATIC_IP
+        set_static_ip(esp_netif_create_default_wifi_sta());
+#else
         esp_netif_create_default_wifi_sta();
+#endif
 
         wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
         ESP_ERROR_CHECK(esp_wifi_init(&cfg));
@@ -217,11 +223,11 @@ void wifi_init_sta(void)
                                                             NULL,
                                                             &instance_got_ip));
 
-    // load from nvs storage
-    char ssid[33] = EXAMPLE_ESP_WIFI_SSID;
-    char pass[65] = EXAMPLE_ESP_WIFI_PASS;
-    read_write_nvs_value_str("ssid",ssid, sizeof(ssid));
-    read_write_nvs_value_str("pass",pass, sizeof(pass));
+    // loaded from nvs storage by config_init()
+    char ssid[33];
+    char pass[65];
+    config_get(CFG_SSID, ssid, sizeof(ssid));
+    config_get(CFG_PASS, pass, sizeof(pass));
 
     wifi_config_t wifi_config = {
         .sta = {
@@ -239,9 +245,25 @@ void wifi_init_sta(void)
     };
     strncpy((char*)wifi_config.sta.ssid, (char*)&ssid[0], 32);
     strncpy((char*)wifi_config.sta.password, (char*)&pass[0], 64);
+
+    // the AP of the last boot, without scanning the other channels
+    wifi_ap_t ap;
+    config_get(CFG_WIFI_AP, &ap, sizeof(ap));
+    if (ap.channel != 0) {
+        memcpy(wifi_config.sta.bssid, ap.bssid, sizeof(ap.bssid));
+        wifi_config.sta.bssid_set = true;
+        wifi_config.sta.channel = ap.channel;
+        s_cached_ap = true;
+        s_ap_pinned = true;
+        boot_flag(BOOT_FAST_CONNECT);
+        ESP_LOGI(TAG, "cached AP " MACSTR ", channel %d", MAC2STR(ap.bssid), ap.channel);
+    } else {
+        boot_flag(BOOT_FULL_SCAN);
+    }
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA) );
     ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config) );
     ESP_ERROR_CHECK(esp_wifi_start() );
+    boot_mark(BOOT_WIFI_START);
 
     ESP_LOGI(TAG, "wifi_init_sta finished.");
 
@@ -259,6 +281,7 @@ void wifi_init_sta(void)
         ESP_LOGI(TAG, "connected to ap SSID:%s",
                  ssid);
         led_light(true);
+        save_ap();
     } else {
         led_light(false);
 
@@ -293,42 +316,13 @@ void init(void)
       ret = nvs_flash_init();
     }
     ESP_ERROR_CHECK(ret);
+    boot_mark(BOOT_NVS);
+    config_init();
+    boot_mark(BOOT_CONFIG);
 
     ESP_LOGI(TAG, "ESP_WIFI_MODE_STA");
     wifi_init_sta();
     ESP_LOGI(TAG, "ESP wifi set up");
-}
 
-esp_err_t send_data(const _bme280_res* results) {
-    char url[200] = "http://palantir/thermo/update-sensor.php"; // default
-    if (read_write_nvs_value_str("adress", url, sizeof(url)) != ESP_OK) {
-        ESP_LOGE(TAG, "URl default: %s",url);
-    }
-    ESP_LOGI(TAG, "URl: %s",url);
-
-    // HTTP
-    esp_http_client_config_t config = {
-       //.url = "http://palantir:8765/update-sensor",
-       //.url = "https://househomestuff.000webhostapp.com/update-sensor.php",
-       .event_handler = _http_event_handle,
-       .port = 80,
-    };
-    config.url = url;
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    //esp_http_client_set_url(client, url);
-    const char* data_base = "temp=%f&hum=%f&press=%f&source=%d\n"; 
-    char data[200];
-    sprintf(data,data_base,results->temp,results->hum,results->press,CONFIG_BME_ID);
-    printf(data);
-    esp_http_client_set_post_field (client,data,strlen(data));
-    esp_http_client_set_method(client, HTTP_METHOD_POST);
-    esp_err_t err = esp_http_client_perform(client);
-
-    if (err == ESP_OK) {
-       ESP_LOGI(TAG, "Status = %d, content_length = %" PRId64,
-               esp_http_client_get_status_code(client),
-               esp_http_client_get_content_length(client));
-    }
-    esp_http_client_cleanup(client);
-    return err;
+    uploader_init();
 }
@@ -0,0 +1,11 @@
+#ifndef WIFI_H
+#define WIFI_H
+#include <stdint.h>
+
+// AP of the last connection, tried first at the next boot; channel 0 if none
+typedef struct wifi_ap_t {
+    uint8_t bssid[6];
+    uint8_t channel;
+} wifi_ap_t;
+
+#endif
@@ -0,0 +1,533 @@
+#include "tsdb.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace tsdb {
+
+static const char* COLUMN_FILES[COLUMNS] = { "temp.col", "press.col", "hum.col" };
+
+const char* column_name(Column col) {
+    static const char* names[COLUMNS] = { "temp", "press", "hum" };
+    return names[col];
+}
+
+void Stats::add(float v) {
+    if (count == 0 || v < min) {
+        min = v;
+    }
+    if (count == 0 || v > max) {
+        max = v;
+    }
+    sum += v;
+    count++;
+}
+
+void Stats::merge(const BlockIndex& block, Column col) {
+    if (block.count == 0) {
+        return;
+    }
+    if (count == 0 || block.min[col] < min) {
+        min = block.min[col];
+    }
+    if (count == 0 || block.max[col] > max) {
+        max = block.max[col];
+    }
+    sum += block.sum[col];
+    count += block.count;
+}
+
+/* Encoding
+ */
+
+static uint64_t zigzag(int64_t v) {
+    return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v) {
+    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+static void put_varint(std::vector<uint8_t>& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<uint8_t>(v) | 0x80);
+        v >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(v));
+}
+
+static uint64_t get_varint(const uint8_t*& p, const uint8_t* end) {
+    uint64_t v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        uint8_t b = *p++;
+        v |= static_cast<uint64_t>(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            break;
+        }
+    }
+    return v;
+}
+
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<uint8_t>& out) : out_(out) {}
+
+    void write(uint64_t v, int bits) {
+        for (int i = bits - 1; i >= 0; i--) {
+            acc_ = (acc_ << 1) | ((v >> i) & 1);
+            if (++count_ == 8) {
+                out_.push_back(acc_);
+                acc_ = 0;
+                count_ = 0;
+            }
+        }
+    }
+
+    void finish() {
+        if (count_) {
+            out_.push_back(acc_ << (8 - count_));
+            acc_ = 0;
+            count_ = 0;
+        }
+    }
+
+private:
+    std::vector<uint8_t>& out_;
+    uint8_t acc_ = 0;
+    int count_ = 0;
+};
+
+class BitReader {
+public:
+    BitReader(const uint8_t* data, size_t size) : data_(data), bits_(size * 8) {}
+
+    uint64_t read(int bits) {
+        uint64_t v = 0;
+        for (int i = 0; i < bits; i++) {
+            v <<= 1;
+            if (pos_ < bits_) {
+                v |= (data_[pos_ >> 3] >> (7 - (pos_ & 7))) & 1;
+                pos_++;
+            }
+        }
+        return v;
+    }
+
+private:
+    const uint8_t* data_;
+    size_t bits_;
+    size_t pos_ = 0;
+};
+
+static uint32_t float_bits(float f) {
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+static float bits_float(uint32_t u) {
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+static void encode_times(const std::vector<Point>& points, std::vector<uint8_t>& out) {
+    int64_t prev = 0;
+    int64_t prev_delta = 0;
+    for (size_t i = 0; i < points.size(); i++) {
+        if (i == 0) {
+            put_varint(out, zigzag(points[0].time));
+        } else {
+            int64_t delta = points[i].time - prev;
+            put_varint(out, zigzag(delta - prev_delta));
+            prev_delta = delta;
+        }
+        prev = points[i].time;
+    }
+}
+
+static void decode_times(const uint8_t* p, size_t size, std::vector<Point>& points) {
+    const uint8_t* end = p + size;
+    int64_t prev = 0;
+    int64_t prev_delta = 0;
+    for (size_t i = 0; i < points.size(); i++) {
+        if (i == 0) {
+            prev = unzigzag(get_varint(p, end));
+        } else {
+            prev_delta += unzigzag(get_varint(p, end));
+            prev += prev_delta;
+        }
+        points[i].time = prev;
+    }
+}
+
+/* A value is stored as its XOR with the previous one: '0' if equal,
+ * '10' + the meaningful bits if they fit in the previous window,
+ * '11' + 5 bits of leading zeros + 5 bits of length - 1 + the meaningful bits otherwise.
+ */
+static void encode_floats(const std::vector<Point>& points, Column col, std::vector<uint8_t>& out) {
+    BitWriter w(out);
+    uint32_t prev = 0;
+    int lead = -1;
+    int len = 0;
+    for (size_t i = 0; i < points.size(); i++) {
+        uint32_t bits = float_bits(points[i].value[col]);
+        if (i == 0) {
+            w.write(bits, 32);
+        } else {
+            uint32_t x = bits ^ prev;
+            if (x == 0) {
+                w.write(0, 1);
+            } else {
+                int l = std::min(__builtin_clz(x), 31);
+                int t = __builtin_ctz(x);
+                if (lead >= 0 && l >= lead && t >= 32 - lead - len) {
+                    w.write(0b10, 2);
+                    w.write(x >> (32 - lead - len), len);
+                } else {
+                    lead = l;
+                    len = 32 - l - t;
+                    w.write(0b11, 2);
+                    w.write(lead, 5);
+                    w.write(len - 1, 5);
+                    w.write(x >> t, len);
+                }
+            }
+        }
+        prev = bits;
+    }
+    w.finish();
+}
+
+static void decode_floats(const uint8_t* p, size_t size, Column col, std::vector<Point>& points) {
+    BitReader r(p, size);
+    uint32_t prev = 0;
+    int lead = 0;
+    int len = 0;
+    for (size_t i = 0; i < points.size(); i++) {
+        if (i == 0) {
+            prev = r.read(32);
+        } else if (r.read(1)) {
+            if (r.read(1)) {
+                lead = r.read(5);
+                len = r.read(5) + 1;
+            }
+            prev ^= static_cast<uint32_t>(r.read(len)) << (32 - lead - len);
+        }
+        points[i].value[col] = bits_float(prev);
+    }
+}
+
+/* Files
+ */
+
+static void write_all(int fd, const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error(std::string("write: ") + strerror(errno));
+        }
+        p += n;
+        size -= n;
+    }
+}
+
+static uint64_t append_file(const std::string& path, const std::vector<uint8_t>& data) {
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+    if (fd == -1) {
+        throw std::runtime_error("Unable to open " + path);
+    }
+    off_t offset = lseek(fd, 0, SEEK_END);
+    write_all(fd, data.data(), data.size());
+    close(fd);
+    return offset;
+}
+
+static off_t file_size(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+/* The index entry of a block is written before the head is truncated: after
+ * a crash in between, or to a reader in between, the head still holds the
+ * points of the last block, as its first points.
+ */
+static bool head_sealed(const BlockIndex& last, const uint8_t* times, const std::vector<Point>& head) {
+    if (head.empty() || head.size() > last.count) {
+        return false;
+    }
+    std::vector<Point> points(last.count);
+    decode_times(times, last.time_size, points);
+    for (size_t i = 0; i < head.size(); i++) {
+        if (head[i].time != points[i].time) {
+            return false;
+        }
+    }
+    return true;
+}
+
+Series::Series(const std::string& dir) : dir_(dir) {
+    mkdir(dir_.c_str(), 0755);
+
+    // a crash may leave bytes after the last complete block or point
+    std::string index_path = dir_ + "/index";
+    off_t blocks = file_size(index_path) / sizeof(BlockIndex);
+    truncate(index_path.c_str(), blocks * sizeof(BlockIndex));
+    BlockIndex last {};
+    if (blocks > 0) {
+        int fd = open(index_path.c_str(), O_RDONLY);
+        pread(fd, &last, sizeof(last), (blocks - 1) * sizeof(BlockIndex));
+        close(fd);
+    }
+    truncate((dir_ + "/time.col").c_str(), last.time_offset + last.time_size);
+    for (int c = 0; c < COLUMNS; c++) {
+        truncate((dir_ + "/" + COLUMN_FILES[c]).c_str(), last.offset[c] + last.size[c]);
+    }
+
+    std::string head_path = dir_ + "/head";
+    head_fd_ = open(head_path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (head_fd_ == -1) {
+        throw std::runtime_error("Unable to open " + head_path);
+    }
+    off_t points = file_size(head_path) / sizeof(Point);
+    head_.resize(points);
+    pread(head_fd_, head_.data(), points * sizeof(Point), 0);
+    if (blocks > 0) {
+        std::vector<uint8_t> times(last.time_size);
+        int fd = open((dir_ + "/time.col").c_str(), O_RDONLY);
+        pread(fd, times.data(), times.size(), last.time_offset);
+        close(fd);
+        if (head_sealed(last, times.data(), head_)) {
+            head_.clear();
+        }
+    }
+    ftruncate(head_fd_, head_.size() * sizeof(Point));
+    head_.reserve(BLOCK_POINTS);
+    head_synced_ = head_.size();
+    lseek(head_fd_, 0, SEEK_END);
+}
+
+Series::~Series() {
+    sync();
+    close(head_fd_);
+}
+
+void Series::append(const Point& p) {
+    head_.push_back(p);
+    if (head_.size() == BLOCK_POINTS) {
+        seal();
+    }
+}
+
+void Series::sync() {
+    if (head_synced_ < head_.size()) {
+        write_all(head_fd_, head_.data() + head_synced_, (head_.size() - head_synced_) * sizeof(Point));
+        head_synced_ = head_.size();
+    }
+}
+
+/* The index entry is written last: a block is part of the series
+ * only once its columns are complete.
+ */
+void Series::seal() {
+    BlockIndex block {};
+    block.count = head_.size();
+    block.min_time = block.max_time = head_[0].time;
+    for (int c = 0; c < COLUMNS; c++) {
+        block.min[c] = block.max[c] = head_[0].value[c];
+    }
+    for (const Point& p : head_) {
+        block.min_time = std::min(block.min_time, p.time);
+        block.max_time = std::max(block.max_time, p.time);
+        for (int c = 0; c < COLUMNS; c++) {
+            block.min[c] = std::min(block.min[c], p.value[c]);
+            block.max[c] = std::max(block.max[c], p.value[c]);
+            block.sum[c] += p.value[c];
+        }
+    }
+
+    std::vector<uint8_t> buf;
+    buf.reserve(BLOCK_POINTS * sizeof(Point));
+    encode_times(head_, buf);
+    block.time_offset = append_file(dir_ + "/time.col", buf);
+    block.time_size = buf.size();
+    for (int c = 0; c < COLUMNS; c++) {
+        buf.clear();
+        encode_floats(head_, static_cast<Column>(c), buf);
+        block.offset[c] = append_file(dir_ + "/" + COLUMN_FILES[c], buf);
+        block.size[c] = buf.size();
+    }
+    std::vector<uint8_t> entry(reinterpret_cast<uint8_t*>(&block), reinterpret_cast<uint8_t*>(&block + 1));
+    append_file(dir_ + "/index", entry);
+
+    ftruncate(head_fd_, 0);
+    lseek(head_fd_, 0, SEEK_SET);
+    head_.clear();
+    head_synced_ = 0;
+}
+
+Writer::Writer(const std::string& root) : root_(root) {
+    mkdir(root_.c_str(), 0755);
+}
+
+void Writer::append(int source, const Point& p) {
+    auto it = series_.find(source);
+    if (it == series_.end()) {
+        it = series_.emplace(source, std::make_unique<Series>(root_ + "/" + std::to_string(source))).first;
+    }
+    it->second->append(p);
+}
+
+void Writer::sync() {
+    for (auto& s : series_) {
+        s.second->sync();
+    }
+}
+
+/* Reader
+ */
+
+Reader::Mapping Reader::map(const std::string& path) {
+    Mapping m;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return m;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (p != MAP_FAILED) {
+            m.data = static_cast<const uint8_t*>(p);
+            m.size = st.st_size;
+        }
+    }
+    close(fd);
+    return m;
+}
+
+// the head is copied: the writer truncates it under a mapping
+std::vector<Point> Reader::read_points(const std::string& path) {
+    std::vector<Point> points;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return points;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        points.resize(st.st_size / sizeof(Point));
+        ssize_t n = pread(fd, points.data(), points.size() * sizeof(Point), 0);
+        points.resize(n > 0 ? n / sizeof(Point) : 0);
+    }
+    close(fd);
+    return points;
+}
+
+Reader::Reader(const std::string& root, int source) {
+    std::string dir = root + "/" + std::to_string(source);
+    struct stat st;
+    ok_ = stat(dir.c_str(), &st) == 0;
+    // in the order of the writes: a block sealed in between is in the index
+    head_ = read_points(dir + "/head");
+    index_ = map(dir + "/index");
+    time_ = map(dir + "/time.col");
+    for (int c = 0; c < COLUMNS; c++) {
+        col_[c] = map(dir + "/" + COLUMN_FILES[c]);
+    }
+    size_t blocks = index_.size / sizeof(BlockIndex);
+    if (blocks > 0) {
+        const BlockIndex& last = reinterpret_cast<const BlockIndex*>(index_.data)[blocks - 1];
+        if (last.time_offset + last.time_size <= time_.size && head_sealed(last, time_.data + last.time_offset, head_)) {
+            head_.clear();
+        }
+    }
+}
+
+Reader::~Reader() {
+    for (const Mapping* m : { &index_, &time_, &col_[TEMP], &col_[PRESS], &col_[HUM] }) {
+        if (m->data) {
+            munmap(const_cast<uint8_t*>(m->data), m->size);
+        }
+    }
+}
+
+void Reader::decode_block(const BlockIndex& block, std::vector<Point>& points, bool columns[COLUMNS]) const {
+    points.resize(block.count);
+    if (block.time_offset + block.time_size > time_.size) {
+        points.clear();
+        return;
+    }
+    decode_times(time_.data + block.time_offset, block.time_size, points);
+    for (int c = 0; c < COLUMNS; c++) {
+        if (columns[c] && block.offset[c] + block.size[c] <= col_[c].size) {
+            decode_floats(col_[c].data + block.offset[c], block.size[c], static_cast<Column>(c), points);
+        }
+    }
+}
+
+void Reader::scan(int64_t from, int64_t to, const std::function<void(const Point&)>& fn) const {
+    const BlockIndex* blocks = reinterpret_cast<const BlockIndex*>(index_.data);
+    size_t count = index_.size / sizeof(BlockIndex);
+    bool all[COLUMNS] = { true, true, true };
+    std::vector<Point> points;
+    for (size_t i = 0; i < count; i++) {
+        if (blocks[i].max_time < from || blocks[i].min_time >= to) {
+            continue;
+        }
+        decode_block(blocks[i], points, all);
+        for (const Point& p : points) {
+            if (p.time >= from && p.time < to) {
+                fn(p);
+            }
+        }
+    }
+
+    for (const Point& p : head_) {
+        if (p.time >= from && p.time < to) {
+            fn(p);
+        }
+    }
+}
+
+Stats Reader::aggregate(int64_t from, int64_t to, Column col) const {
+    Stats stats;
+    const BlockIndex* blocks = reinterpret_cast<const BlockIndex*>(index_.data);
+    size_t count = index_.size / sizeof(BlockIndex);
+    bool only[COLUMNS] = {};
+    only[col] = true;
+    std::vector<Point> points;
+    for (size_t i = 0; i < count; i++) {
+        if (blocks[i].max_time < from || blocks[i].min_time >= to) {
+            continue;
+        }
+        if (blocks[i].min_time >= from && blocks[i].max_time < to) {
+            // whole block: the index has the answer
+            stats.merge(blocks[i], col);
+            continue;
+        }
+        decode_block(blocks[i], points, only);
+        for (const Point& p : points) {
+            if (p.time >= from && p.time < to) {
+                stats.add(p.value[col]);
+            }
+        }
+    }
+
+    for (const Point& p : head_) {
+        if (p.time >= from && p.time < to) {
+            stats.add(p.value[col]);
+        }
+    }
+    return stats;
+}
+
+}
@@ -0,0 +1,127 @@
+#ifndef TSDB_H
+#define TSDB_H
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+/* Append-only store for the readings of the sensors.
+ *
+ * Each source (CONFIG_BME_ID) has its own directory with one file per column:
+ *   time.col  delta-of-delta encoded timestamps
+ *   temp.col, press.col, hum.col  XOR encoded floats (as in Gorilla)
+ *   index     one BlockIndex per sealed block, with the offsets of the block
+ *             in each column and its min/max/sum
+ *   head      raw points of the block being filled
+ * Points are sealed in blocks of BLOCK_POINTS. Readers mmap the files that
+ * only grow and copy the head, which is truncated at each seal; they answer
+ * aggregations over whole blocks from the index alone.
+ */
+
+namespace tsdb {
+
+constexpr uint32_t BLOCK_POINTS = 1024;
+
+enum Column {
+    TEMP,
+    PRESS,
+    HUM,
+    COLUMNS
+};
+
+struct Point {
+    int64_t time;
+    float value[COLUMNS];
+};
+
+struct BlockIndex {
+    int64_t min_time;
+    int64_t max_time;
+    uint32_t count;
+    uint32_t time_size;
+    uint64_t time_offset;
+    uint64_t offset[COLUMNS];
+    uint32_t size[COLUMNS];
+    float min[COLUMNS];
+    float max[COLUMNS];
+    double sum[COLUMNS];
+};
+
+struct Stats {
+    uint64_t count = 0;
+    float min = 0;
+    float max = 0;
+    double sum = 0;
+
+    void add(float v);
+    void merge(const BlockIndex& block, Column col);
+    double mean() const { return count ? sum / count : 0; }
+};
+
+const char* column_name(Column col);
+
+class Series {
+public:
+    // opens or creates the series of dir
+    explicit Series(const std::string& dir);
+    ~Series();
+
+    void append(const Point& p);
+    // writes the head file: the points appended so far survive a crash
+    void sync();
+
+private:
+    void seal();
+
+    std::string dir_;
+    int head_fd_ = -1;
+    std::vector<Point> head_;
+    size_t head_synced_ = 0;
+};
+
+class Writer {
+public:
+    explicit Writer(const std::string& root);
+
+    void append(int source, const Point& p);
+    void sync();
+
+private:
+    std::string root_;
+    std::map<int, std::unique_ptr<Series>> series_;
+};
+
+class Reader {
+public:
+    Reader(const std::string& root, int source);
+    ~Reader();
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    bool ok() const { return ok_; }
+    // points with from <= time < to, block after block
+    void scan(int64_t from, int64_t to, const std::function<void(const Point&)>& fn) const;
+    Stats aggregate(int64_t from, int64_t to, Column col) const;
+
+private:
+    struct Mapping {
+        const uint8_t* data = nullptr;
+        size_t size = 0;
+    };
+    static Mapping map(const std::string& path);
+    static std::vector<Point> read_points(const std::string& path);
+    void decode_block(const BlockIndex& block, std::vector<Point>& points, bool columns[COLUMNS]) const;
+
+    bool ok_ = false;
+    Mapping index_;
+    Mapping time_;
+    Mapping col_[COLUMNS];
+    std::vector<Point> head_;
+};
+
+}
+
+#endif
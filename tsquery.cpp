@@ -0,0 +1,119 @@
+#include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <ctime>
+#include <limits>
+#include <string>
+
+#include "tsdb.h"
+
+/* Reads the store written by collector --store.
+ *
+ * g++ -std=c++17 -O2 -o tsquery tsquery.cpp tsdb.cpp
+ */
+
+void usage(const char* prog) {
+    std::cout << "Usage: " << prog << " DIR SOURCE [--from TIME] [--to TIME] [--agg] [--column temp|press|hum]" << std::endl;
+    std::cout << std::endl;
+    std::cout << "  DIR             Directory of the store" << std::endl;
+    std::cout << "  SOURCE          CONFIG_BME_ID of the sensor" << std::endl;
+    std::cout << "  --from TIME     First time included: unix time or YYYY-MM-DD[Thh:mm] (UTC)" << std::endl;
+    std::cout << "  --to TIME       First time excluded" << std::endl;
+    std::cout << "  --agg           Print count/min/max/mean instead of the readings" << std::endl;
+    std::cout << "  --column COL    Aggregate only this column (all by default)" << std::endl;
+}
+
+bool parse_time(const char* s, int64_t& t) {
+    char* end;
+    long long v = strtoll(s, &end, 10);
+    if (*end == '\0') {
+        t = v;
+        return true;
+    }
+    struct tm tm {};
+    const char* rest = strptime(s, "%Y-%m-%d", &tm);
+    if (rest == nullptr) {
+        return false;
+    }
+    if (*rest == 'T' || *rest == ' ') {
+        rest = strptime(rest + 1, "%H:%M", &tm);
+        if (rest == nullptr) {
+            return false;
+        }
+    }
+    t = timegm(&tm);
+    return *rest == '\0';
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        usage(argv[0]);
+        return argc == 1 ? 0 : 1;
+    }
+    std::string root = argv[1];
+    int source = atoi(argv[2]);
+    int64_t from = std::numeric_limits<int64_t>::min();
+    int64_t to = std::numeric_limits<int64_t>::max();
+    bool agg = false;
+    int column = -1;
+
+    for (int i = 3; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--from" && i + 1 < argc) {
+            if (!parse_time(argv[++i], from)) {
+                std::cout << "Error: invalid time " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--to" && i + 1 < argc) {
+            if (!parse_time(argv[++i], to)) {
+                std::cout << "Error: invalid time " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--agg") {
+            agg = true;
+        } else if (arg == "--column" && i + 1 < argc) {
+            std::string name = argv[++i];
+            for (int c = 0; c < tsdb::COLUMNS; c++) {
+                if (name == tsdb::column_name(static_cast<tsdb::Column>(c))) {
+                    column = c;
+                }
+            }
+            if (column == -1) {
+                std::cout << "Error: unknown column " << name << std::endl;
+                return 1;
+            }
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    tsdb::Reader reader(root, source);
+    if (!reader.ok()) {
+        std::cout << "Error: no data for source " << source << " in " << root << std::endl;
+        return 1;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (agg) {
+        std::cout << "column,count,min,max,mean" << std::endl;
+        for (int c = 0; c < tsdb::COLUMNS; c++) {
+            if (column != -1 && column != c) {
+                continue;
+            }
+            tsdb::Stats s = reader.aggregate(from, to, static_cast<tsdb::Column>(c));
+            std::cout << tsdb::column_name(static_cast<tsdb::Column>(c)) << "," << s.count << ","
+                << s.min << "," << s.max << "," << s.mean() << std::endl;
+        }
+    } else {
+        std::cout << "time,temp,press,hum" << std::endl;
+        reader.scan(from, to, [](const tsdb::Point& p) {
+            printf("%lld,%.2f,%.2f,%.2f\n", static_cast<long long>(p.time),
+                    p.value[tsdb::TEMP], p.value[tsdb::PRESS], p.value[tsdb::HUM]);
+        });
+    }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << "Query: " << ms << " ms" << std::endl;
+    return 0;
+}